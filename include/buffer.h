@@ -1,6 +1,6 @@
 /**
  * @file buffer.h
- * @brief Simple append-only string buffer used for terminal drawing.
+ * @brief Simple append-only string buffer used for terminal drawing and on-disk records.
  * @defgroup buffer Append buffer
  * @ingroup core
  * @{
@@ -28,6 +28,9 @@ void abAppend(struct abuf *ab, const char *s, int len);
 
 void abFree(struct abuf *ab);
 
+void abPutVarint(struct abuf *ab, unsigned long long v);
+int abGetVarint(const unsigned char **p, const unsigned char *end, unsigned long long *v);
+
 /** @} */
 
 
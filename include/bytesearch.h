@@ -0,0 +1,14 @@
+/**
+ * @file bytesearch.h
+ * @brief Substring search over length-delimited byte strings.
+ * @defgroup bytesearch Byte search
+ * @ingroup core
+ * @{
+ */
+#pragma once
+
+#include <stddef.h>
+
+const char *byteSearch(const char *hay, size_t hlen, const char *needle, size_t nlen);
+
+/** @} */
@@ -0,0 +1,33 @@
+/**
+ * @file compress.h
+ * @brief Streaming reads and writes of plain, gzip, and zstd files.
+ * @defgroup compress Compression
+ * @ingroup core
+ * @{
+ */
+#pragma once
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/** On-disk format of a file. */
+enum editorCompress {
+  COMPRESS_NONE = 0,
+  COMPRESS_GZIP,
+  COMPRESS_ZSTD
+};
+
+/** A file being read or written through an optional (de)compressor. */
+struct cstream;
+
+int compressForName(const char *path);
+int compressMaxLevel(int kind);
+const char *compressName(int kind);
+struct cstream *cstreamOpenRead(int fd, int *kind);
+ssize_t cstreamRead(struct cstream *c, char *buf, size_t len);
+struct cstream *cstreamOpenWrite(int fd, int kind, int level);
+int cstreamWrite(struct cstream *c, const char *buf, size_t len);
+int cstreamClose(struct cstream *c, long long *written);
+const char *cstreamError(const struct cstream *c);
+
+/** @} */
@@ -0,0 +1,20 @@
+/**
+ * @file dfa.h
+ * @brief Regular expression matching with a lazily built DFA.
+ * @defgroup dfa Regular expressions
+ * @ingroup core
+ * @{
+ */
+#pragma once
+
+/** A compiled regular expression. */
+struct dfa;
+
+struct dfa *dfaCompile(const char *pattern, const char **error);
+struct dfa *dfaCached(const char *pattern, const char **error);
+void dfaFree(struct dfa *re);
+int dfaSearch(struct dfa *re, const char *s, int len, int from, int *mlen);
+int dfaSearchAll(struct dfa *re, const char *s, int len,
+                 void (*emit)(void *ctx, int at, int mlen), void *ctx);
+
+/** @} */
@@ -0,0 +1,18 @@
+/**
+ * @file dirview.h
+ * @brief Directory listings that load and sort in the background.
+ * @defgroup dirview Directory browser
+ * @ingroup core
+ * @{
+ */
+#pragma once
+
+/** Column of each listing row where the entry name starts. */
+#define DIRVIEW_NAME_COL 28
+
+void dirviewOpen(const char *path);
+void dirviewClose(void);
+int dirviewActive(void);
+void dirviewEnter(void);
+
+/** @} */
@@ -22,9 +22,19 @@ void editorCloneTemplate(void);
 /** Open a file or directory by path (prompts if NULL). */
 void editorOpen(char *filename);
 
-/** Save the current buffer to `E.filename`, prompting if necessary. */
+/**
+ * Save the current buffer to `E.filename`, prompting if necessary. The rows
+ * are snapshotted and written by a background thread; editing continues and
+ * the result appears in the status bar when the write completes.
+ */
 void editorSave(void);
 
+/** Wait for a background save to finish and report its result. */
+void editorSaveWait(void);
+
+/** Whether a background save is still being written or reported. */
+int editorSaveRunning(void);
+
 /** @} */
 
 
@@ -0,0 +1,15 @@
+/**
+ * @file follow.h
+ * @brief Follow mode: show lines as they are appended to the open file.
+ * @defgroup follow Follow mode
+ * @ingroup core
+ * @{
+ */
+#pragma once
+
+int followStart(int pin);
+void followStop(void);
+void followRestart(void);
+int followActive(void);
+
+/** @} */
@@ -0,0 +1,17 @@
+/**
+ * @file hookpool.h
+ * @brief Worker threads that run async hooks against buffer snapshots.
+ * @defgroup hookpool Async hooks
+ * @ingroup core
+ * @{
+ */
+#pragma once
+
+#include <libguile.h>
+
+/** Guile threads started for the first async hook. */
+#define HOOK_POOL_THREADS 2
+
+void hookPoolSubmit(const char *where, SCM proc, SCM snap, int argc, SCM a, SCM b);
+
+/** @} */
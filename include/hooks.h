@@ -10,6 +10,29 @@
 #include "ze.h"
 #include <libguile.h>
 
+/** Events plugins can subscribe to with @c add-hook!. */
+enum hookEvent {
+  HOOK_PRE_DIR_OPEN = 0, /**< 'pre-dir-open: directory path. */
+  HOOK_POST_DIR_OPEN,    /**< 'post-dir-open: number of entries. */
+  HOOK_PRE_FILE_OPEN,    /**< 'pre-file-open: file path. */
+  HOOK_POST_FILE_OPEN,   /**< 'post-file-open: buffer handle. */
+  HOOK_PRE_SAVE,         /**< 'pre-save: buffer handle. */
+  HOOK_POST_SAVE,        /**< 'post-save: buffer handle. */
+  HOOK_PRE_EDIT,         /**< 'pre-edit: key code and cursor line. */
+  HOOK_POST_EDIT,        /**< 'post-edit: key code and cursor line. */
+  HOOK_BUFFER_SWITCH,    /**< 'buffer-switch: new filename, or #f. */
+  HOOK_IDLE,             /**< 'idle: no arguments. */
+  HOOK_EVENTS
+};
+
+/** Milliseconds without a keypress before the idle hooks run. */
+#define HOOK_IDLE_DELAY 500
+
+int hooksEventByName(const char *name);
+int hooksAdd(int event, SCM proc, int priority, int async);
+int hooksRemove(int event, SCM proc);
+void hooksInit(void);
+
 /** Called before reading a directory listing into the buffer. */
 void preDirOpenHook(void);
 /** Called after reading a directory listing; provides file count. */
@@ -22,7 +45,13 @@ void postFileOpenHook(void);
 void editorPreSaveHook(void);
 /** Called after saving the current buffer to disk. */
 void editorPostSaveHook(void);
+/** Called before a key that edits the buffer is applied. */
+void preEditHook(int key);
+/** Called after a key that edits the buffer has been applied. */
+void postEditHook(int key);
+/** Called when a different file or directory is shown. */
+void bufferSwitchHook(void);
+/** Called on every keypress; restarts the wait for the idle hooks. */
+void idleHookReset(void);
 
 /** @} */
-
-
@@ -0,0 +1,26 @@
+/**
+ * @file idle.h
+ * @brief Background work run while the editor waits for input.
+ * @defgroup idle Idle tasks
+ * @ingroup core
+ * @{
+ */
+#pragma once
+
+/** Returned by an idle task that has more work queued. */
+#define IDLE_MORE (1<<0)
+/** Returned by an idle task that changed what is on screen. */
+#define IDLE_REDRAW (1<<1)
+
+/**
+ * A slice of background work. Must return promptly (a few milliseconds) with
+ * a combination of IDLE_MORE and IDLE_REDRAW.
+ */
+typedef int (*editorIdleTask)(void *data);
+
+void editorIdleAdd(editorIdleTask task, void *data);
+void editorIdleRemove(editorIdleTask task, void *data);
+int editorIdleRun(void);
+int editorInputPending(void);
+
+/** @} */
@@ -0,0 +1,29 @@
+/**
+ * @file journal.h
+ * @brief Append-only log of buffer edits for crash recovery.
+ * @defgroup journal Edit journal
+ * @ingroup core
+ * @{
+ */
+#pragma once
+
+#include <stddef.h>
+#include <sys/types.h>
+
+void journalOpen(const char *path);
+void journalClose(void);
+void journalDiscard(void);
+off_t journalMark(void);
+void journalRebase(off_t mark, const char *path);
+void journalSuspend(void);
+void journalResume(const char *path);
+
+void journalInsertRow(int at, const char *s, size_t len);
+void journalDeleteRow(int at);
+void journalInsertChar(int row, int at, int c);
+void journalAppend(int row, const char *s, size_t len);
+void journalDeleteChar(int row, int at);
+void journalTruncate(int row, int at);
+void journalSetRow(int row, const char *s, size_t len);
+
+/** @} */
@@ -0,0 +1,34 @@
+/**
+ * @file pager.h
+ * @brief Read-only viewing of files too large to load into memory.
+ * @defgroup pager Pager
+ * @ingroup core
+ * @{
+ */
+#pragma once
+
+#include <sys/types.h>
+
+/** How far a file's line index has been built; see pagerIndexGet(). */
+struct pagerIndex {
+  const off_t *idx;     /**< Offset of every PAGER_STRIDE-th line, from line 0. */
+  long long nidx;       /**< Entries in @c idx. */
+  off_t scanned;        /**< Bytes counted from the start of the file. */
+  long long newlines;   /**< Newlines in those bytes. */
+  int complete;         /**< The whole file has been counted. */
+  int tail;             /**< The last line has no newline; set once complete. */
+};
+
+off_t pagerDefaultLimit(void);
+void pagerOpen(int fd, off_t size);
+void pagerClose(void);
+int pagerActive(void);
+void pagerSync(void);
+long long pagerLineOf(int row);
+long long pagerLineCount(int *complete);
+void pagerGoto(long long line, int col);
+void pagerFind(void);
+int pagerIndexGet(struct pagerIndex *out);
+void pagerIndexSet(const struct pagerIndex *in);
+
+/** @} */
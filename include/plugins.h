@@ -15,10 +15,13 @@ void loadPlugins(void);
 SCM scmBindKey(SCM keySpec, SCM proc);
 int pluginsHandleKey(unsigned char code);
 void editorExec(void);
+void pluginsMainThreadOnly(const char *who);
 
 /* Scheme bindings exposed to plugin authors */
 SCM scmBufferToString(void);
-SCM scmBufferLineCount(void);
+SCM scmBufferLineCount(SCM buf_scm);
+SCM scmBufferLength(SCM buf_scm);
+SCM scmBufferText(SCM buf_scm, SCM start_scm, SCM end_scm);
 SCM scmGetLine(SCM idx_scm);
 SCM scmSetLine(SCM idx_scm, SCM str_scm);
 SCM scmInsertLine(SCM idx_scm, SCM str_scm);
@@ -28,25 +31,46 @@ SCM scmInsertText(SCM str_scm);
 SCM scmInsertChar(SCM ch_scm);
 SCM scmInsertNewline(void);
 SCM scmDeleteChar(void);
+SCM scmCallWithEditBatch(SCM thunk);
+SCM scmGetLines(SCM start_scm, SCM end_scm);
+SCM scmSetLines(SCM start_scm, SCM end_scm, SCM lines_scm);
+SCM scmMapLines(SCM proc, SCM start_scm, SCM end_scm);
 SCM scmGetCursor(void);
 SCM scmSetCursor(SCM x_scm, SCM y_scm);
 SCM scmMoveCursor(SCM dir_scm);
 SCM scmScreenSize(void);
+SCM scmSetSoftWrap(SCM on_scm);
 SCM scmOpenFile(SCM path_scm);
+SCM scmFollowFile(SCM on_scm, SCM pin_scm);
 SCM scmSaveFile(void);
+SCM scmSetSaveDurability(SCM level_scm);
+SCM scmSetCompressionLevel(SCM level_scm);
+SCM scmSetPagerThreshold(SCM bytes_scm);
 SCM scmGetFilename(void);
 SCM scmSetFilename(SCM path_scm);
 SCM scmPrompt(SCM msg_scm);
 SCM scmRefreshScreen(void);
 SCM scmSearchForward(SCM query_scm);
+SCM scmSearchRegex(SCM pattern_scm);
+SCM scmReplaceAll(SCM query_scm, SCM with_scm, SCM regex_scm);
 SCM scmSelectSyntaxForFilename(SCM path_scm);
 SCM scmGetFiletype(void);
 SCM scmUnbindKey(SCM keySpec);
+SCM scmAddHook(SCM event_scm, SCM proc, SCM priority_scm);
+SCM scmRemoveHook(SCM event_scm, SCM proc);
+SCM scmAddAsyncHook(SCM event_scm, SCM proc, SCM priority_scm);
+SCM scmPluginStats(void);
+SCM scmShowPluginStats(void);
+SCM scmSetPluginBudget(SCM ms_scm, SCM abort_scm);
 SCM scmListBindings(void);
 SCM scmBufferDirty(void);
 SCM scmSetBufferDirty(SCM bool_scm);
 SCM scmCloneTemplate(void);
 
-SCM pluginsGetHook(const char *name);
+SCM pluginsBufferHandle(void);
+void pluginsBufferRelease(SCM buf);
+SCM pluginsBufferSnapshot(void);
+void pluginsSnapshotRetain(SCM buf);
+void pluginsSnapshotRelease(SCM buf);
 
 /** @} */
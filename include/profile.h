@@ -0,0 +1,39 @@
+/**
+ * @file profile.h
+ * @brief Call counts, latency histograms, and time budgets for plugin code.
+ * @defgroup profile Plugin profiler
+ * @ingroup core
+ * @{
+ */
+#pragma once
+
+#include <libguile.h>
+
+/** Histogram buckets; bucket i counts calls under 2^i microseconds, the last
+ * everything slower. */
+#define PROFILE_BUCKETS 24
+/** Time a plugin call may take before a warning, in milliseconds. */
+#define PROFILE_DEFAULT_BUDGET 100
+
+/** A call being timed; filled in by profileBegin(). */
+struct profileMark {
+  long long start;   /**< Monotonic clock at the start, in nanoseconds. */
+  int depth;         /**< Plugin calls already running on the main thread, or -1 on others. */
+  unsigned seq;      /**< Watchdog ticket of an outermost call, or 0. */
+  int aborted;       /**< Set when the call was stopped for running over budget. */
+  long long paused;  /**< Time spent waiting on the user before the call, in nanoseconds. */
+};
+
+void profileInit(void);
+void profileBegin(struct profileMark *m);
+void profileEnd(struct profileMark *m, const char *where, SCM proc);
+SCM profileCall(const char *where, SCM proc, int argc, SCM a, SCM b);
+int profileStopped(struct profileMark *m, SCM key);
+void profilePause(void);
+void profileResume(void);
+void profileSetBudget(int ms, int abort);
+SCM profileStats(void);
+void profileShow(void);
+int profileOnMainThread(void);
+
+/** @} */
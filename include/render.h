@@ -11,6 +11,8 @@
 #include "buffer.h"
 
 void editorScroll(void);
+void editorScrollWrappedLines(int lines);
+void editorSetSoftWrap(int on);
 void editorDrawRows(struct abuf *ab);
 void editorDrawStatusBar(struct abuf *ab);
 void editorDrawMessageBar(struct abuf *ab);
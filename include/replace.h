@@ -0,0 +1,16 @@
+/**
+ * @file replace.h
+ * @brief Search and replace over the buffer.
+ * @defgroup replace Replace
+ * @ingroup core
+ * @{
+ */
+#pragma once
+
+#include "ze.h"
+
+int editorReplaceAll(const char *query, const char *with, int regex, int *rows,
+                     const char **error);
+void editorQueryReplace(void);
+
+/** @} */
@@ -9,16 +9,32 @@
 
 #include "ze.h"
 
+int editorRowCharAt(erow *row, int cx, int rx, int *width, int *rlen);
 int editorRowCxToRx(erow *row, int cx);
 int editorRowRxToCx(erow *row, int rx);
+int editorRowCxToRenderIdx(erow *row, int cx);
+int editorRowChunkIndex(erow *row, int cx);
+echunk *editorRowChunk(erow *row, int k);
+void editorUpdateRowRange(erow *row, int at, int oldlen, int newlen);
 void editorUpdateRow(erow *row);
 void editorInsertRow(int at, char *s, size_t len);
+void editorInsertRows(int at, char *const *s, const size_t *len, int n);
 void editorFreeRow(erow *row);
+void editorRowDropChars(erow *row);
+void editorRowUnshare(erow *row);
+void editorRowsShare(void);
+void editorRowsRelease(void);
 void editorDelRow(int at);
+void editorDelRows(int at, int n);
 void editorRowInsertChar(erow *row, int at, int c);
 void editorRowAppendString(erow *row, char *s, size_t len);
 void editorRowDelChar(erow *row, int at);
 void editorDelRowAtChar(erow *row, int at);
+void editorRowSetText(erow *row, const char *s, size_t len);
+void editorBatchBegin(void);
+void editorBatchFlush(void);
+void editorBatchEnd(void);
+int editorBatchActive(void);
 
 /** @} */
 
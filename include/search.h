@@ -9,6 +9,19 @@
 
 #include "ze.h"
 
+/** A search hit: row index, byte offset in the row's @c chars, and length. */
+typedef struct ematch {
+  int row;
+  int cx;
+  int len;
+} ematch;
+
+int editorSearchRows(const char *query, int qlen, int from, int dir, int *cx);
+int editorSearchRowsRegex(const char *pattern, int from, int dir, int *cx, int *len,
+                          const char **error);
+int editorSearchRowMatches(int row, const ematch **matches);
+int editorSearchIndex(int *index, int *total, int *complete);
+int editorSearchActive(void);
 void editorFindCallback(char *query, int key);
 void editorFind(void);
 
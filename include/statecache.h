@@ -0,0 +1,16 @@
+/**
+ * @file statecache.h
+ * @brief Per-file state kept across sessions so unchanged files reopen fast.
+ * @defgroup statecache State cache
+ * @ingroup core
+ * @{
+ */
+#pragma once
+
+#include <sys/stat.h>
+
+void stateCacheSave(void);
+int stateCacheLoad(int fd, const struct stat *st);
+void stateCacheApply(void);
+
+/** @} */
@@ -9,8 +9,36 @@
 
 #include "ze.h"
 
+/** Highlighter state: quote character of an open string (0 if none). */
+#define HL_STATE_STRING 0xff
+/** Highlighter state: inside a multi-line comment. */
+#define HL_STATE_COMMENT (1 << 8)
+/** Highlighter state: inside a single-line comment. */
+#define HL_STATE_LINE (1 << 9)
+/** Highlighter state: the previous character was not a separator. */
+#define HL_STATE_NOSEP (1 << 10)
+/** Highlighter state: the previous character was part of a number. */
+#define HL_STATE_NUMBER (1 << 11)
+/** Highlighter state: the next character is escaped inside a string. */
+#define HL_STATE_ESCAPE (1 << 12)
+
+/**
+ * Chunks @c first..@c last of row @c row to re-highlight in
+ * editorUpdateSyntaxRows(); @c last is -1 when only the state entering the
+ * row may have changed, and may run past the row's last chunk.
+ */
+struct syntaxSpan {
+  int row;
+  int first;
+  int last;
+};
+
 int is_separator(int c);
+int editorSyntaxRun(const char *render, unsigned char *hl, int rsize, int state);
+void editorUpdateSyntaxFrom(erow *row, int first, int last);
 void editorUpdateSyntax(erow *row);
+void editorUpdateSyntaxRows(const struct syntaxSpan *rows, int n);
+void editorSyntaxAssume(const unsigned char *open, int n);
 int editorSyntaxToColor(int hl);
 void editorSelectSyntaxHighlight(void);
 
@@ -0,0 +1,42 @@
+/**
+ * @file textscan.h
+ * @brief One-pass detection of line endings, UTF-8 validity, and NUL bytes.
+ * @defgroup textscan Text format detection
+ * @ingroup core
+ * @{
+ */
+#pragma once
+
+#include <stddef.h>
+
+/** How the lines of a file end. */
+enum editorEol {
+  EOL_LF = 0,   /**< "\n"; also files with no line breaks. */
+  EOL_CRLF,     /**< "\r\n" everywhere. */
+  EOL_MIXED     /**< Both; each CRLF line keeps its '\r' in the row. */
+};
+
+/** Running totals over a file scanned a block at a time. */
+struct textScan {
+  long long lf;      /**< Newline bytes. */
+  long long crlf;    /**< Newlines preceded by '\r'. */
+  long long nul;     /**< NUL bytes. */
+  int utf8;          /**< Nonzero while everything so far is valid UTF-8. */
+  int need;          /**< Continuation bytes the current sequence still needs. */
+  unsigned char lo;  /**< Smallest allowed value of the next continuation byte. */
+  unsigned char hi;  /**< Largest allowed value of the next continuation byte. */
+  int cr;            /**< The last byte scanned was '\r'. */
+  int last;          /**< The last byte scanned, or -1 before any. */
+};
+
+/** UTF-8 encoding of U+FEFF, written at the start of some files. */
+#define TEXT_BOM "\xEF\xBB\xBF"
+/** Length of TEXT_BOM. */
+#define TEXT_BOM_LEN 3
+
+void textScanInit(struct textScan *t);
+void textScanBlock(struct textScan *t, const char *s, size_t len);
+int textScanEol(const struct textScan *t);
+int textScanValid(const struct textScan *t);
+
+/** @} */
@@ -0,0 +1,16 @@
+/**
+ * @file utf8.h
+ * @brief UTF-8 decoding and display width helpers.
+ * @defgroup utf8 UTF-8
+ * @ingroup core
+ * @{
+ */
+#pragma once
+
+/** True if @p c is a UTF-8 continuation byte (10xxxxxx). */
+#define UTF8_IS_CONT(c) (((unsigned char)(c) & 0xC0) == 0x80)
+
+int utf8Decode(const char *s, int len, unsigned int *cp);
+int utf8Width(unsigned int cp);
+
+/** @} */
@@ -11,6 +11,7 @@
 #define _GNU_SOURCE
 
 #include <stddef.h>
+#include <sys/types.h>
 #include <time.h>
 #include <termios.h>
 
@@ -18,6 +19,10 @@
 #define ZE_VERSION "1.0.0"
 /** Number of spaces used to render a tab character. */
 #define ZE_TAB_STOP 2
+/** Bytes of row text between cached display-column checkpoints. */
+#define ZE_COLUMN_STRIDE 128
+/** Target size in bytes of the chunks long rows are split into. */
+#define ZE_CHUNK_SIZE 4096
 /** Number of confirmations required to quit with unsaved changes. */
 #define ZE_QUIT_TIMES 1
 /** Convert an ASCII character to its Control-key equivalent. */
@@ -52,6 +57,16 @@ enum editorHighlight {
   HL_MATCH
 };
 
+/**
+ * How hard editorSave() pushes a saved file to stable storage before
+ * renaming it over the original.
+ */
+enum editorSaveSync {
+  SAVE_SYNC_NONE = 0,  /**< Leave flushing to the kernel. */
+  SAVE_SYNC_DATA,      /**< fdatasync() the new contents before the rename. */
+  SAVE_SYNC_FULL       /**< fsync() the file, then the directory after the rename. */
+};
+
 /** Enable number highlighting for a language. */
 #define HL_HIGHLIGHT_NUMBERS (1<<0)
 /** Enable string highlighting for a language. */
@@ -70,17 +85,64 @@ struct editorSyntax {
   int flags;
 };
 
+/**
+ * Cached position of a character boundary within a chunk: its byte offset in
+ * @c chars, its display column, and its byte offset in @c render, each
+ * relative to the start of the chunk.
+ */
+typedef struct ecolumn {
+  int cx;
+  int rx;
+  int ridx;
+} ecolumn;
+
+/**
+ * A slice of a row with its own rendered text and highlighting. Short rows
+ * consist of a single chunk; rows longer than twice @c ZE_CHUNK_SIZE are split
+ * so that edits and drawing only touch the chunks involved.
+ */
+typedef struct echunk {
+  int cx;              /**< Offset of the chunk's first byte in @c chars. */
+  int size;            /**< Bytes of @c chars covered by the chunk. */
+  int rx;              /**< Display column where the chunk starts. */
+  int width;           /**< Display columns covered by the chunk. */
+  int tabs;            /**< Number of tabs in the chunk. */
+  int phase;           /**< @c rx % ZE_TAB_STOP that @c width and @c render assume. */
+  int rsize;
+  char *render;        /**< Tab-expanded text; NULL until needed. */
+  unsigned char *hl;   /**< Highlight class per @c render byte; NULL until needed. */
+  int hl_in;           /**< Highlighter state entering the chunk. */
+  int hl_out;          /**< Highlighter state leaving the chunk. */
+  ecolumn *cols;       /**< Checkpoint every ZE_COLUMN_STRIDE bytes; NULL when stale. */
+  int ncols;           /**< Number of entries in @c cols. */
+} echunk;
+
+/**
+ * Start of one screen line of a soft-wrapped row: its byte offset in
+ * @c chars and its display column.
+ */
+typedef struct ewrap {
+  int cx;
+  int rx;
+} ewrap;
+
 /**
  * A single editable row of text and its rendered state.
  */
 typedef struct erow {
   int idx;
   int size;
-  int rsize;
   char *chars;
-  char *render;
-  unsigned char *hl;
   int hl_open_comment;
+  int shared;          /**< Nonzero while a save or hook snapshot may still read @c chars. */
+  echunk head;         /**< The row's only chunk while it has not been split. */
+  echunk *chunks;      /**< All chunks of a split row; NULL when @c head is used. */
+  int nchunks;         /**< Number of chunks (1 while @c chunks is NULL). */
+  int rxvalid;         /**< Leading chunks whose @c rx and @c width are current. */
+  ewrap *wraps;        /**< Screen line starts in soft-wrap mode; NULL until needed. */
+  int nwraps;          /**< Number of entries in @c wraps. */
+  int wrapcols;        /**< Screen width @c wraps was computed for. */
+  int wrapstale;       /**< Offset in @c chars from which @c wraps must be recomputed. */
 } erow;
 
 /**
@@ -91,11 +153,22 @@ struct editorConfig {
   int rx;
   int rowoff;
   int coloff;
+  int wrapoff;         /**< Screen line of row @c rowoff shown at the top in soft-wrap mode. */
+  int softwrap;        /**< Nonzero to wrap long rows instead of scrolling horizontally. */
   int screenrows;
   int screencols;
   int numrows;
   erow *row;
   int dirty;
+  unsigned long long gen; /**< Bumped by every change to the text and every file opened. */
+  int savesync;        /**< An @c editorSaveSync policy applied by editorSave(). */
+  int compress;        /**< @c editorCompress format the file was read in and is saved in. */
+  int compresslevel;   /**< Compression level for saves; 0 picks the format's default. */
+  off_t filesize;      /**< Size of @c filename on disk when it was last read or saved. */
+  int eol;             /**< @c editorEol line endings the file was read with and is saved with. */
+  int bom;             /**< Nonzero if the file starts with a UTF-8 byte order mark. */
+  int noeol;           /**< Nonzero if the file's last line has no line ending. */
+  off_t pagerlimit;    /**< Plain files at least this large open read-only in the pager; 0 never. */
   char *filename;
   char statusmsg[150];
   time_t statusmsg_time;
@@ -11,19 +11,11 @@
                          j))))))
     (if (< i 0) "" (substring s 0 (+ i 1)))))
 
+;; map-lines! walks the buffer in C and only rewrites lines rstrip changed
 (define (format-trailing-whitespace)
-  (let ((n (buffer-line-count))
-        (changed 0))
-    (let loop ((i 0) (chg 0))
-      (if (>= i n)
-          (begin
-            (set-editor-status (string-append "Trimmed trailing whitespace on " (number->string chg) " line(s)"))
-            chg)
-          (let* ((line (or (get-line i) ""))
-                 (trimmed (rstrip line)))
-            (if (not (string=? line trimmed))
-                (begin (set-line! i trimmed) (loop (+ i 1) (+ chg 1)))
-                (loop (+ i 1) chg)))))))
+  (let ((chg (map-lines! rstrip)))
+    (set-editor-status (string-append "Trimmed trailing whitespace on " (number->string chg) " line(s)"))
+    chg))
 
 ;; Bind to C-l (overrides built-in no-op for C-l)
 (bind-key "C-l" format-trailing-whitespace)
@@ -41,4 +41,49 @@ void abAppend(struct abuf *ab, const char *s, int len) {
  */
 void abFree(struct abuf *ab) { free(ab->b); }
 
+/**
+ * @brief Append an unsigned integer as a LEB128 varint.
+ * @ingroup buffer
+ *
+ * Seven bits per byte, least significant first, with the high bit set on
+ * every byte but the last; values under 128 take one byte. Used by the
+ * edit journal and the state cache for their on-disk records.
+ *
+ * @param[in,out] ab Append buffer to extend.
+ * @param[in] v Value to encode.
+ * @sa abGetVarint()
+ */
+void abPutVarint(struct abuf *ab, unsigned long long v) {
+  char b[10];
+  int n = 0;
+  do {
+    b[n] = (char)(v & 0x7f);
+    v >>= 7;
+    if (v) {
+      b[n] |= (char)0x80;
+    }
+    n++;
+  } while (v);
+  abAppend(ab, b, n);
+}
 
+/**
+ * @brief Decode a varint written by abPutVarint().
+ * @ingroup buffer
+ *
+ * @param[in,out] p Next byte to read; advanced past the varint.
+ * @param[in] end End of the data.
+ * @param[out] v Decoded value.
+ * @return 0 on success, -1 if the data ends mid-varint or it is too long.
+ */
+int abGetVarint(const unsigned char **p, const unsigned char *end, unsigned long long *v) {
+  *v = 0;
+  for (int shift = 0; *p < end && shift < 64; shift += 7) {
+    unsigned char c = *(*p)++;
+    *v |= (unsigned long long)(c & 0x7f) << shift;
+    if (!(c & 0x80)) {
+      return 0;
+    }
+  }
+  return -1;
+}
@@ -0,0 +1,71 @@
+/**
+ * @file bytesearch.c
+ * @brief Substring search implementation.
+ * @ingroup bytesearch
+ */
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "bytesearch.h"
+
+/**
+ * @brief Find the first occurrence of a byte string.
+ * @ingroup bytesearch
+ *
+ * Unlike strstr(), both strings are length-delimited and may contain NUL
+ * bytes. On SSE2 targets, 16 candidate positions are filtered at a time by
+ * comparing the needle's first and last bytes, and only positions where both
+ * match are verified with memcmp(). Other targets skip ahead with memchr() on
+ * the first byte.
+ *
+ * @param[in] hay Bytes to search.
+ * @param[in] hlen Length of @p hay.
+ * @param[in] needle Bytes to look for.
+ * @param[in] nlen Length of @p needle; an empty needle matches at @p hay.
+ * @return Pointer to the first match in @p hay, or NULL if there is none.
+ */
+const char *byteSearch(const char *hay, size_t hlen, const char *needle, size_t nlen) {
+  if (nlen == 0) {
+    return hay;
+  }
+  if (nlen > hlen) {
+    return NULL;
+  }
+  if (nlen == 1) {
+    return memchr(hay, needle[0], hlen);
+  }
+  size_t last = hlen - nlen;
+  size_t i = 0;
+#if defined(__SSE2__)
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i tail = _mm_set1_epi8(needle[nlen - 1]);
+  for (; i + 15 <= last; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(hay + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(hay + i + nlen - 1));
+    unsigned int mask = (unsigned int)_mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, tail)));
+    while (mask) {
+      int bit = __builtin_ctz(mask);
+      if (memcmp(hay + i + bit + 1, needle + 1, nlen - 2) == 0) {
+        return hay + i + bit;
+      }
+      mask &= mask - 1;
+    }
+  }
+#endif
+  while (i <= last) {
+    const char *p = memchr(hay + i, needle[0], last - i + 1);
+    if (p == NULL) {
+      return NULL;
+    }
+    i = (size_t)(p - hay);
+    if (p[nlen - 1] == needle[nlen - 1] && memcmp(p + 1, needle + 1, nlen - 2) == 0) {
+      return p;
+    }
+    i++;
+  }
+  return NULL;
+}
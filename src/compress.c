@@ -0,0 +1,488 @@
+/**
+ * @file compress.c
+ * @brief Compressed file stream implementation.
+ * @ingroup compress
+ *
+ * Readers sniff the first bytes of a file for the gzip or zstd magic number
+ * and otherwise pass data straight through, so callers load every file the
+ * same way. gzip goes through zlib; zstd through libzstd when ze is built
+ * with ZE_HAVE_ZSTD. Nothing is staged on disk in either direction.
+ */
+#include "ze.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef ZE_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "compress.h"
+
+/** Size of the buffer between the file and the (de)compressor. */
+#define ZE_CSTREAM_BUF (256 * 1024)
+
+struct cstream {
+  int fd;
+  int kind;
+  int writing;
+  unsigned char *buf;  /* Compressed bytes on their way in or out. */
+  size_t have;         /* Bytes in @c buf (reading, plain files only). */
+  size_t pos;          /* Next unread byte in @c buf (plain files only). */
+  int eof;             /* No more bytes can be read from @c fd. */
+  int done;            /* The compressed stream has ended. */
+  long long out;       /* Bytes written to @c fd. */
+  const char *error;   /* Description of a format error, or NULL. */
+  z_stream z;
+#ifdef ZE_HAVE_ZSTD
+  ZSTD_DStream *zd;
+  ZSTD_CStream *zc;
+  ZSTD_inBuffer zin;
+#endif
+};
+
+static const unsigned char gzip_magic[2] = {0x1f, 0x8b};
+static const unsigned char zstd_magic[4] = {0x28, 0xb5, 0x2f, 0xfd};
+
+static int endsWith(const char *s, const char *suffix) {
+  size_t n = strlen(s), m = strlen(suffix);
+  return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+/**
+ * @brief Pick a format from a file name's extension.
+ * @ingroup compress
+ *
+ * @param[in] path File name.
+ * @return COMPRESS_GZIP for ".gz", COMPRESS_ZSTD for ".zst" (if built in),
+ *         else COMPRESS_NONE.
+ */
+int compressForName(const char *path) {
+  if (endsWith(path, ".gz")) {
+    return COMPRESS_GZIP;
+  }
+#ifdef ZE_HAVE_ZSTD
+  if (endsWith(path, ".zst")) {
+    return COMPRESS_ZSTD;
+  }
+#endif
+  return COMPRESS_NONE;
+}
+
+/**
+ * @brief Highest compression level a format accepts.
+ * @ingroup compress
+ *
+ * @param[in] kind An @c editorCompress value; @c COMPRESS_NONE asks for the
+ *                 highest level any built-in format accepts.
+ * @return Maximum level; levels from 1 up to it are valid, 0 picks the default.
+ */
+int compressMaxLevel(int kind) {
+  if (kind == COMPRESS_GZIP) {
+    return 9;
+  }
+#ifdef ZE_HAVE_ZSTD
+  return 19;
+#else
+  return 9;
+#endif
+}
+
+/**
+ * @brief Short name of a format for messages.
+ * @ingroup compress
+ */
+const char *compressName(int kind) {
+  switch (kind) {
+  case COMPRESS_GZIP:
+    return "gzip";
+  case COMPRESS_ZSTD:
+    return "zstd";
+  default:
+    return "plain";
+  }
+}
+
+/* Read more of the file into @c buf after the @p keep bytes already there. */
+static ssize_t cstreamFill(struct cstream *c, size_t keep) {
+  for (;;) {
+    ssize_t n = read(c->fd, c->buf + keep, ZE_CSTREAM_BUF - keep);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n == 0) {
+      c->eof = 1;
+    }
+    return n;
+  }
+}
+
+static int writeAll(int fd, const unsigned char *s, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, s, len);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    s += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+/**
+ * @brief Start reading a file, detecting its format.
+ * @ingroup compress
+ *
+ * @param[in] fd File open for reading, positioned at its start. Not closed
+ *               by cstreamClose().
+ * @param[out] kind Format found, an @c editorCompress value.
+ * @return New stream, or NULL with errno set if the file cannot be read.
+ */
+struct cstream *cstreamOpenRead(int fd, int *kind) {
+  struct cstream *c = calloc(1, sizeof(struct cstream));
+  c->fd = fd;
+  c->buf = malloc(ZE_CSTREAM_BUF);
+  /* Enough bytes to recognise either magic number. */
+  while (c->have < sizeof(zstd_magic) && !c->eof) {
+    ssize_t n = cstreamFill(c, c->have);
+    if (n < 0) {
+      int saved = errno;
+      free(c->buf);
+      free(c);
+      errno = saved;
+      return NULL;
+    }
+    c->have += (size_t)n;
+  }
+  c->kind = COMPRESS_NONE;
+  if (c->have >= sizeof(gzip_magic) && memcmp(c->buf, gzip_magic, sizeof(gzip_magic)) == 0) {
+    if (inflateInit2(&c->z, 16 + MAX_WBITS) == Z_OK) {
+      c->kind = COMPRESS_GZIP;
+      c->z.next_in = c->buf;
+      c->z.avail_in = (uInt)c->have;
+    }
+  }
+#ifdef ZE_HAVE_ZSTD
+  if (c->have >= sizeof(zstd_magic) && memcmp(c->buf, zstd_magic, sizeof(zstd_magic)) == 0) {
+    c->zd = ZSTD_createDStream();
+    if (c->zd != NULL) {
+      ZSTD_initDStream(c->zd);
+      c->kind = COMPRESS_ZSTD;
+      c->zin.src = c->buf;
+      c->zin.size = c->have;
+      c->zin.pos = 0;
+    }
+  }
+#else
+  (void)zstd_magic;
+#endif
+  *kind = c->kind;
+  return c;
+}
+
+static ssize_t plainRead(struct cstream *c, char *out, size_t len) {
+  if (c->pos == c->have) {
+    if (c->eof) {
+      return 0;
+    }
+    ssize_t n = cstreamFill(c, 0);
+    if (n <= 0) {
+      return n;
+    }
+    c->have = (size_t)n;
+    c->pos = 0;
+  }
+  size_t n = c->have - c->pos;
+  if (n > len) {
+    n = len;
+  }
+  memcpy(out, c->buf + c->pos, n);
+  c->pos += n;
+  return (ssize_t)n;
+}
+
+static ssize_t gzipRead(struct cstream *c, char *out, size_t len) {
+  while (!c->done) {
+    if (c->z.avail_in == 0 && !c->eof) {
+      ssize_t n = cstreamFill(c, 0);
+      if (n < 0) {
+        return -1;
+      }
+      c->z.next_in = c->buf;
+      c->z.avail_in = (uInt)n;
+    }
+    c->z.next_out = (Bytef *)out;
+    c->z.avail_out = (uInt)len;
+    int ret = inflate(&c->z, Z_NO_FLUSH);
+    size_t got = len - c->z.avail_out;
+    if (ret == Z_STREAM_END) {
+      /* gzip files may hold several members back to back. */
+      if (c->z.avail_in == 0 && !c->eof) {
+        ssize_t n = cstreamFill(c, 0);
+        if (n < 0) {
+          return -1;
+        }
+        c->z.next_in = c->buf;
+        c->z.avail_in = (uInt)n;
+      }
+      if (c->z.avail_in > 0) {
+        inflateReset(&c->z);
+      } else {
+        c->done = 1;
+      }
+    } else if (ret == Z_BUF_ERROR) {
+      if (c->eof && c->z.avail_in == 0 && got == 0) {
+        c->error = "unexpected end of compressed data";
+        errno = EIO;
+        return -1;
+      }
+    } else if (ret != Z_OK) {
+      c->error = c->z.msg ? c->z.msg : "corrupt compressed data";
+      errno = EIO;
+      return -1;
+    }
+    if (got > 0) {
+      return (ssize_t)got;
+    }
+  }
+  return 0;
+}
+
+#ifdef ZE_HAVE_ZSTD
+static ssize_t zstdRead(struct cstream *c, char *out, size_t len) {
+  ZSTD_outBuffer o = { out, len, 0 };
+  for (;;) {
+    if (c->zin.pos == c->zin.size && !c->eof) {
+      ssize_t n = cstreamFill(c, 0);
+      if (n < 0) {
+        return -1;
+      }
+      c->zin.src = c->buf;
+      c->zin.size = (size_t)n;
+      c->zin.pos = 0;
+    }
+    size_t r = ZSTD_decompressStream(c->zd, &o, &c->zin);
+    if (ZSTD_isError(r)) {
+      c->error = ZSTD_getErrorName(r);
+      errno = EIO;
+      return -1;
+    }
+    if (o.pos > 0) {
+      return (ssize_t)o.pos;
+    }
+    if (c->zin.pos == c->zin.size && c->eof) {
+      if (r != 0) {
+        c->error = "unexpected end of compressed data";
+        errno = EIO;
+        return -1;
+      }
+      return 0;
+    }
+  }
+}
+#endif
+
+/**
+ * @brief Read decompressed bytes.
+ * @ingroup compress
+ *
+ * @param[in,out] c Stream from cstreamOpenRead().
+ * @param[out] buf Destination.
+ * @param[in] len Capacity of @p buf.
+ * @return Bytes read, 0 at the end of the data, or -1 with errno set (EIO
+ *         for corrupt data, described by cstreamError()).
+ */
+ssize_t cstreamRead(struct cstream *c, char *buf, size_t len) {
+  switch (c->kind) {
+  case COMPRESS_GZIP:
+    return gzipRead(c, buf, len);
+#ifdef ZE_HAVE_ZSTD
+  case COMPRESS_ZSTD:
+    return zstdRead(c, buf, len);
+#endif
+  default:
+    return plainRead(c, buf, len);
+  }
+}
+
+/**
+ * @brief Start writing a file in a given format.
+ * @ingroup compress
+ *
+ * @param[in] fd File open for writing. Not closed by cstreamClose().
+ * The encoder is never silently skipped: if it cannot be set up, nothing is
+ * written and the caller fails the save rather than writing plain bytes
+ * under a compressed name.
+ *
+ * @param[in] kind An @c editorCompress value.
+ * @param[in] level Compression level, or 0 for the format's default.
+ * @return New stream, or NULL with errno set to EINVAL if @p kind is not
+ *         built in, @p level is out of range, or the encoder fails to start.
+ */
+struct cstream *cstreamOpenWrite(int fd, int kind, int level) {
+  if (level < 0 || level > compressMaxLevel(kind)) {
+    errno = EINVAL;
+    return NULL;
+  }
+  struct cstream *c = calloc(1, sizeof(struct cstream));
+  c->fd = fd;
+  c->writing = 1;
+  c->kind = COMPRESS_NONE;
+  if (kind == COMPRESS_GZIP) {
+    c->buf = malloc(ZE_CSTREAM_BUF);
+    if (deflateInit2(&c->z, level > 0 ? level : Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                     16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK) {
+      c->kind = COMPRESS_GZIP;
+    }
+  }
+#ifdef ZE_HAVE_ZSTD
+  if (kind == COMPRESS_ZSTD) {
+    c->buf = malloc(ZE_CSTREAM_BUF);
+    c->zc = ZSTD_createCStream();
+    if (c->zc != NULL &&
+        ZSTD_isError(ZSTD_CCtx_setParameter(c->zc, ZSTD_c_compressionLevel,
+                                            level > 0 ? level : ZSTD_CLEVEL_DEFAULT))) {
+      ZSTD_freeCStream(c->zc);
+      c->zc = NULL;
+    }
+    if (c->zc != NULL) {
+      c->kind = COMPRESS_ZSTD;
+    }
+  }
+#endif
+  if (c->kind != kind) {
+    free(c->buf);
+    free(c);
+    errno = EINVAL;
+    return NULL;
+  }
+  return c;
+}
+
+/* Run deflate over the pending input, writing whatever it produces. */
+static int gzipPump(struct cstream *c, int flush) {
+  int ret;
+  do {
+    c->z.next_out = c->buf;
+    c->z.avail_out = ZE_CSTREAM_BUF;
+    ret = deflate(&c->z, flush);
+    if (ret == Z_STREAM_ERROR) {
+      errno = EIO;
+      return -1;
+    }
+    size_t n = ZE_CSTREAM_BUF - c->z.avail_out;
+    if (writeAll(c->fd, c->buf, n) == -1) {
+      return -1;
+    }
+    c->out += (long long)n;
+  } while (c->z.avail_out == 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+  return 0;
+}
+
+#ifdef ZE_HAVE_ZSTD
+/* Run the zstd compressor over @p in, writing whatever it produces. */
+static int zstdPump(struct cstream *c, ZSTD_inBuffer *in, ZSTD_EndDirective mode) {
+  for (;;) {
+    ZSTD_outBuffer o = { c->buf, ZE_CSTREAM_BUF, 0 };
+    size_t left = ZSTD_compressStream2(c->zc, &o, in, mode);
+    if (ZSTD_isError(left)) {
+      c->error = ZSTD_getErrorName(left);
+      errno = EIO;
+      return -1;
+    }
+    if (writeAll(c->fd, c->buf, o.pos) == -1) {
+      return -1;
+    }
+    c->out += (long long)o.pos;
+    if (mode == ZSTD_e_end ? left == 0 : in->pos == in->size) {
+      return 0;
+    }
+  }
+}
+#endif
+
+/**
+ * @brief Write bytes, compressing them if the stream has a format.
+ * @ingroup compress
+ *
+ * @return 0 on success, or -1 with errno set.
+ */
+int cstreamWrite(struct cstream *c, const char *buf, size_t len) {
+  switch (c->kind) {
+  case COMPRESS_GZIP:
+    c->z.next_in = (Bytef *)buf;
+    c->z.avail_in = (uInt)len;
+    return gzipPump(c, Z_NO_FLUSH);
+#ifdef ZE_HAVE_ZSTD
+  case COMPRESS_ZSTD: {
+    ZSTD_inBuffer in = { buf, len, 0 };
+    return zstdPump(c, &in, ZSTD_e_continue);
+  }
+#endif
+  default:
+    if (writeAll(c->fd, (const unsigned char *)buf, len) == -1) {
+      return -1;
+    }
+    c->out += (long long)len;
+    return 0;
+  }
+}
+
+/**
+ * @brief Description of the last format error, if any.
+ * @ingroup compress
+ *
+ * @return Message, or NULL if the last failure was an I/O error (see errno).
+ */
+const char *cstreamError(const struct cstream *c) {
+  return c->error;
+}
+
+/**
+ * @brief Finish and free a stream.
+ * @ingroup compress
+ *
+ * Writers flush the end of the compressed data. The file descriptor stays
+ * open.
+ *
+ * @param[in] c Stream to close.
+ * @param[out] written If not NULL, receives the bytes written to the file.
+ * @return 0 on success, or -1 with errno set.
+ */
+int cstreamClose(struct cstream *c, long long *written) {
+  int r = 0;
+  if (c->kind == COMPRESS_GZIP) {
+    if (c->writing) {
+      c->z.next_in = NULL;
+      c->z.avail_in = 0;
+      r = gzipPump(c, Z_FINISH);
+      deflateEnd(&c->z);
+    } else {
+      inflateEnd(&c->z);
+    }
+  }
+#ifdef ZE_HAVE_ZSTD
+  if (c->kind == COMPRESS_ZSTD) {
+    if (c->writing) {
+      ZSTD_inBuffer in = { NULL, 0, 0 };
+      r = zstdPump(c, &in, ZSTD_e_end);
+      ZSTD_freeCStream(c->zc);
+    } else {
+      ZSTD_freeDStream(c->zd);
+    }
+  }
+#endif
+  int saved = errno;
+  if (written != NULL) {
+    *written = c->out;
+  }
+  free(c->buf);
+  free(c);
+  errno = saved;
+  return r;
+}
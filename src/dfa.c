@@ -0,0 +1,1035 @@
+/**
+ * @file dfa.c
+ * @brief Regular expression compiler and lazy DFA matcher.
+ * @ingroup dfa
+ *
+ * Patterns are parsed into a syntax tree, compiled to two Thompson NFAs (one
+ * for the pattern and one for its reverse), and matched by DFAs whose states
+ * are built on demand and cached. Every input byte costs one table lookup
+ * once its transition has been built, so matching never backtracks.
+ *
+ * Each row is matched as the symbols BOL, its bytes, EOL, which lets @c ^
+ * and @c $ be ordinary symbols. A search runs the reverse DFA from the end
+ * of the row to find where the leftmost match starts, then the forward DFA
+ * from there to find where the longest match at that start ends.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "dfa.h"
+
+/* Input symbols: the 256 byte values plus start and end of line. */
+#define SYM_BOL 256
+#define SYM_EOL 257
+#define NSYMS 258
+#define SET_BYTES ((NSYMS + 7) / 8)
+
+/* Limits that keep a hostile pattern from exhausting memory. */
+#define DFA_MAX_AST 10000
+#define DFA_MAX_NFA 50000
+#define DFA_MAX_REPEAT 1000
+/* Cached DFA states per automaton before the cache is flushed. */
+#define DFA_MAX_STATES 2048
+/* Number of compiled patterns kept by dfaCached(). */
+#define DFA_CACHE 8
+
+static void setAdd(unsigned char *set, int c) {
+  set[c >> 3] |= (unsigned char)(1 << (c & 7));
+}
+
+static int setHas(const unsigned char *set, int c) {
+  return (set[c >> 3] >> (c & 7)) & 1;
+}
+
+static void setRange(unsigned char *set, int lo, int hi) {
+  for (int c = lo; c <= hi; c++) {
+    setAdd(set, c);
+  }
+}
+
+/* Complement the byte values of @p set; BOL and EOL are left out. */
+static void setNegate(unsigned char *set) {
+  for (int c = 0; c < 256; c++) {
+    if (setHas(set, c)) {
+      set[c >> 3] &= (unsigned char)~(1 << (c & 7));
+    } else {
+      setAdd(set, c);
+    }
+  }
+}
+
+// ===== Parsing =====
+
+enum astType { AST_SET, AST_EMPTY, AST_CAT, AST_ALT, AST_REPEAT };
+
+/** Syntax tree node. Children are indexes into the parser's node array. */
+struct ast {
+  int type;
+  int left;
+  int right;
+  int min;                        /**< AST_REPEAT lower bound. */
+  int max;                        /**< AST_REPEAT upper bound, -1 if none. */
+  unsigned char set[SET_BYTES];   /**< AST_SET symbols. */
+};
+
+struct parser {
+  const char *p;
+  struct ast *nodes;
+  int n;
+  const char *error;
+};
+
+static int astNew(struct parser *ps, int type, int left, int right) {
+  if (ps->n == DFA_MAX_AST) {
+    ps->error = "pattern too large";
+    return -1;
+  }
+  struct ast *t = &ps->nodes[ps->n];
+  memset(t, 0, sizeof(*t));
+  t->type = type;
+  t->left = left;
+  t->right = right;
+  return ps->n++;
+}
+
+/*
+ * Parse the escape after a backslash at ps->p into @p set. Returns 1 for a
+ * class escape such as \d, 0 for a single byte, and -1 on error.
+ */
+static int parseEscape(struct parser *ps, unsigned char *set, int *byte) {
+  int c = (unsigned char)*ps->p;
+  if (c == '\0') {
+    ps->error = "trailing backslash";
+    return -1;
+  }
+  ps->p++;
+  int negate = (c == 'D' || c == 'W' || c == 'S');
+  switch (c) {
+  case 'd': case 'D':
+    setRange(set, '0', '9');
+    break;
+  case 'w': case 'W':
+    setRange(set, 'a', 'z');
+    setRange(set, 'A', 'Z');
+    setRange(set, '0', '9');
+    setAdd(set, '_');
+    break;
+  case 's': case 'S':
+    setAdd(set, ' ');
+    setRange(set, '\t', '\r');
+    break;
+  case 't': *byte = '\t'; return 0;
+  case 'n': *byte = '\n'; return 0;
+  case 'r': *byte = '\r'; return 0;
+  case 'f': *byte = '\f'; return 0;
+  case 'v': *byte = '\v'; return 0;
+  default: *byte = c; return 0;
+  }
+  if (negate) {
+    setNegate(set);
+  }
+  return 1;
+}
+
+static int parseClass(struct parser *ps) {
+  int t = astNew(ps, AST_SET, -1, -1);
+  if (t < 0) {
+    return -1;
+  }
+  unsigned char *set = ps->nodes[t].set;
+  int negate = 0;
+  if (*ps->p == '^') {
+    negate = 1;
+    ps->p++;
+  }
+  int first = 1;
+  while (first || *ps->p != ']') {
+    first = 0;
+    if (*ps->p == '\0') {
+      ps->error = "missing ]";
+      return -1;
+    }
+    int lo = (unsigned char)*ps->p++;
+    if (lo == '\\') {
+      int kind = parseEscape(ps, set, &lo);
+      if (kind < 0) {
+        return -1;
+      } else if (kind == 1) {
+        continue;
+      }
+    }
+    int hi = lo;
+    if (ps->p[0] == '-' && ps->p[1] != '\0' && ps->p[1] != ']') {
+      hi = (unsigned char)ps->p[1];
+      ps->p += 2;
+      if (hi < lo) {
+        ps->error = "bad range in []";
+        return -1;
+      }
+    }
+    setRange(set, lo, hi);
+  }
+  ps->p++;
+  if (negate) {
+    setNegate(set);
+  }
+  return t;
+}
+
+static int parseAlt(struct parser *ps);
+
+static int parseAtom(struct parser *ps) {
+  int c = (unsigned char)*ps->p++;
+  int t;
+  switch (c) {
+  case '(':
+    t = parseAlt(ps);
+    if (t < 0) {
+      return -1;
+    }
+    if (*ps->p != ')') {
+      ps->error = "missing )";
+      return -1;
+    }
+    ps->p++;
+    return t;
+  case '[':
+    return parseClass(ps);
+  case '*': case '+': case '?': case '{':
+    ps->error = "nothing to repeat";
+    return -1;
+  }
+  t = astNew(ps, AST_SET, -1, -1);
+  if (t < 0) {
+    return -1;
+  }
+  unsigned char *set = ps->nodes[t].set;
+  if (c == '.') {
+    setRange(set, 0, 255);
+  } else if (c == '^') {
+    setAdd(set, SYM_BOL);
+  } else if (c == '$') {
+    setAdd(set, SYM_EOL);
+  } else if (c == '\\') {
+    int byte;
+    int kind = parseEscape(ps, set, &byte);
+    if (kind < 0) {
+      return -1;
+    } else if (kind == 0) {
+      setAdd(set, byte);
+    }
+  } else {
+    setAdd(set, c);
+  }
+  return t;
+}
+
+/* Parse a decimal repeat bound; returns -1 if there are no digits. */
+static int parseBound(struct parser *ps) {
+  if (*ps->p < '0' || *ps->p > '9') {
+    return -1;
+  }
+  int n = 0;
+  while (*ps->p >= '0' && *ps->p <= '9') {
+    if (n <= DFA_MAX_REPEAT) {
+      n = n * 10 + (*ps->p - '0');
+    }
+    ps->p++;
+  }
+  return n;
+}
+
+static int parseRepeat(struct parser *ps) {
+  int t = parseAtom(ps);
+  while (t >= 0) {
+    int min;
+    int max;
+    char c = *ps->p;
+    if (c == '*') {
+      min = 0;
+      max = -1;
+    } else if (c == '+') {
+      min = 1;
+      max = -1;
+    } else if (c == '?') {
+      min = 0;
+      max = 1;
+    } else if (c == '{') {
+      ps->p++;
+      min = parseBound(ps);
+      max = min;
+      if (*ps->p == ',') {
+        ps->p++;
+        max = parseBound(ps);
+      }
+      if (min < 0 || *ps->p != '}' || (max >= 0 && max < min)) {
+        ps->error = "bad repetition";
+        return -1;
+      }
+      if (min > DFA_MAX_REPEAT || max > DFA_MAX_REPEAT) {
+        ps->error = "repetition too large";
+        return -1;
+      }
+    } else {
+      break;
+    }
+    ps->p++;
+    t = astNew(ps, AST_REPEAT, t, -1);
+    if (t >= 0) {
+      ps->nodes[t].min = min;
+      ps->nodes[t].max = max;
+    }
+  }
+  return t;
+}
+
+static int parseCat(struct parser *ps) {
+  int left = -1;
+  while (*ps->p != '\0' && *ps->p != '|' && *ps->p != ')') {
+    int t = parseRepeat(ps);
+    if (t < 0) {
+      return -1;
+    }
+    left = (left < 0) ? t : astNew(ps, AST_CAT, left, t);
+    if (left < 0) {
+      return -1;
+    }
+  }
+  return (left < 0) ? astNew(ps, AST_EMPTY, -1, -1) : left;
+}
+
+static int parseAlt(struct parser *ps) {
+  int left = parseCat(ps);
+  while (left >= 0 && *ps->p == '|') {
+    ps->p++;
+    int right = parseCat(ps);
+    if (right < 0) {
+      return -1;
+    }
+    left = astNew(ps, AST_ALT, left, right);
+  }
+  return left;
+}
+
+/* True if node @p i can match without consuming a byte (anchors are free). */
+static int astNullable(const struct ast *nodes, int i) {
+  const struct ast *t = &nodes[i];
+  switch (t->type) {
+  case AST_SET:
+    for (int c = 0; c < 256; c++) {
+      if (setHas(t->set, c)) {
+        return 0;
+      }
+    }
+    return 1;
+  case AST_CAT:
+    return astNullable(nodes, t->left) && astNullable(nodes, t->right);
+  case AST_ALT:
+    return astNullable(nodes, t->left) || astNullable(nodes, t->right);
+  case AST_REPEAT:
+    return t->min == 0 || astNullable(nodes, t->left);
+  default:
+    return 1;
+  }
+}
+
+// ===== Thompson NFA =====
+
+enum nfaType { NFA_SET, NFA_SPLIT, NFA_EPS, NFA_MATCH };
+
+struct nfaNode {
+  int type;
+  int out;
+  int out1;
+  unsigned char set[SET_BYTES];
+};
+
+struct nfa {
+  struct nfaNode *nodes;
+  int n;
+  int cap;
+  int start;
+};
+
+static int nfaNew(struct nfa *m, int type) {
+  if (m->n == DFA_MAX_NFA) {
+    return -1;
+  }
+  if (m->n == m->cap) {
+    m->cap = m->cap ? m->cap * 2 : 64;
+    m->nodes = realloc(m->nodes, sizeof(struct nfaNode) * m->cap);
+  }
+  struct nfaNode *node = &m->nodes[m->n];
+  memset(node, 0, sizeof(*node));
+  node->type = type;
+  node->out = -1;
+  node->out1 = -1;
+  return m->n++;
+}
+
+/*
+ * Compile tree node @p i into a fragment from *start to *end, where *end is
+ * an epsilon node whose @c out is left for the caller to connect. With
+ * @p reverse set, concatenations are compiled back to front. Returns -1 if
+ * the NFA grows too large.
+ */
+static int nfaBuild(struct nfa *m, const struct ast *nodes, int i, int reverse,
+                    int *start, int *end) {
+  const struct ast *t = &nodes[i];
+  int s1, e1, s2, e2;
+  switch (t->type) {
+  case AST_SET:
+    if ((s1 = nfaNew(m, NFA_SET)) < 0 || (e1 = nfaNew(m, NFA_EPS)) < 0) {
+      return -1;
+    }
+    memcpy(m->nodes[s1].set, t->set, SET_BYTES);
+    m->nodes[s1].out = e1;
+    *start = s1;
+    *end = e1;
+    return 0;
+  case AST_EMPTY:
+    if ((e1 = nfaNew(m, NFA_EPS)) < 0) {
+      return -1;
+    }
+    *start = *end = e1;
+    return 0;
+  case AST_CAT: {
+    int first = reverse ? t->right : t->left;
+    int second = reverse ? t->left : t->right;
+    if (nfaBuild(m, nodes, first, reverse, &s1, &e1) < 0 ||
+        nfaBuild(m, nodes, second, reverse, &s2, &e2) < 0) {
+      return -1;
+    }
+    m->nodes[e1].out = s2;
+    *start = s1;
+    *end = e2;
+    return 0;
+  }
+  case AST_ALT: {
+    if (nfaBuild(m, nodes, t->left, reverse, &s1, &e1) < 0 ||
+        nfaBuild(m, nodes, t->right, reverse, &s2, &e2) < 0) {
+      return -1;
+    }
+    int split = nfaNew(m, NFA_SPLIT);
+    int join = nfaNew(m, NFA_EPS);
+    if (split < 0 || join < 0) {
+      return -1;
+    }
+    m->nodes[split].out = s1;
+    m->nodes[split].out1 = s2;
+    m->nodes[e1].out = join;
+    m->nodes[e2].out = join;
+    *start = split;
+    *end = join;
+    return 0;
+  }
+  default: {
+    /* AST_REPEAT: min copies, then a loop or (max - min) optional copies. */
+    int first = -1;
+    int last = -1;
+    int copies = (t->max < 0) ? t->min + 1 : t->max;
+    for (int k = 0; k < copies; k++) {
+      if (nfaBuild(m, nodes, t->left, reverse, &s1, &e1) < 0) {
+        return -1;
+      }
+      if (k >= t->min) {
+        int split = nfaNew(m, NFA_SPLIT);
+        int join = nfaNew(m, NFA_EPS);
+        if (split < 0 || join < 0) {
+          return -1;
+        }
+        m->nodes[split].out = s1;
+        m->nodes[split].out1 = join;
+        m->nodes[e1].out = (t->max < 0) ? split : join;
+        s1 = split;
+        e1 = join;
+      }
+      if (last < 0) {
+        first = s1;
+      } else {
+        m->nodes[last].out = s1;
+      }
+      last = e1;
+    }
+    if (last < 0) {
+      if ((last = nfaNew(m, NFA_EPS)) < 0) {
+        return -1;
+      }
+      first = last;
+    }
+    *start = first;
+    *end = last;
+    return 0;
+  }
+  }
+}
+
+// ===== Lazy DFA =====
+
+/** A DFA state: the set of NFA nodes it stands for. */
+struct dstate {
+  int *set;              /**< Sorted NFA_SET and NFA_MATCH nodes. */
+  int nset;
+  unsigned int hash;
+};
+
+/*
+ * Transitions live in one flat table with a row of DFA_ROW ints per state:
+ * the successor for each symbol, stored as the offset of its row (-1 until
+ * built), then the accept and dead flags. Scanning works on row offsets so
+ * each byte costs a single load.
+ */
+#define DFA_ROW (NSYMS + 2)
+#define ROW_ACCEPT NSYMS
+#define ROW_DEAD (NSYMS + 1)
+
+/** One NFA plus the DFA states built for it so far. */
+struct automaton {
+  struct nfa nfa;
+  int unanchored;        /**< Restart the NFA at every position. */
+  struct dstate *states;
+  int *trans;            /**< DFA_ROW ints per state, see above. */
+  int nstates;
+  int capstates;
+  int *table;            /**< Hash table of state ids + 1; 0 is empty. */
+  int start;             /**< Start state, or -1 until built. */
+  int *stack;            /**< Scratch space for closures. */
+  int *buf;
+  unsigned int *mark;
+  unsigned int gen;
+  unsigned int *seen;    /**< Per state, the last step of dfaSearchAll() to reach it. */
+  unsigned int seengen;
+  unsigned int flushes;  /**< Times the cache was flushed; state offsets die with it. */
+};
+
+#define DFA_TABLE_SIZE (DFA_MAX_STATES * 4)
+
+struct dfa {
+  struct automaton fwd;  /**< Pattern, anchored at the match start. */
+  struct automaton rev;  /**< Reversed pattern, unanchored. */
+};
+
+static int intCmp(const void *a, const void *b) {
+  int x = *(const int *)a;
+  int y = *(const int *)b;
+  return (x > y) - (x < y);
+}
+
+/*
+ * Epsilon closure of the @p nseeds nodes on a->stack, stored sorted in
+ * a->buf. Returns its size.
+ */
+static int closure(struct automaton *a, int nseeds) {
+  if (++a->gen == 0) {
+    memset(a->mark, 0, sizeof(unsigned int) * a->nfa.n);
+    a->gen = 1;
+  }
+  int sp = nseeds;
+  int n = 0;
+  while (sp > 0) {
+    int i = a->stack[--sp];
+    if (i < 0 || a->mark[i] == a->gen) {
+      continue;
+    }
+    a->mark[i] = a->gen;
+    struct nfaNode *node = &a->nfa.nodes[i];
+    switch (node->type) {
+    case NFA_SET:
+    case NFA_MATCH:
+      a->buf[n++] = i;
+      break;
+    case NFA_SPLIT:
+      a->stack[sp++] = node->out1;
+      a->stack[sp++] = node->out;
+      break;
+    default:
+      a->stack[sp++] = node->out;
+      break;
+    }
+  }
+  qsort(a->buf, n, sizeof(int), intCmp);
+  return n;
+}
+
+static void automatonFlush(struct automaton *a) {
+  for (int i = 0; i < a->nstates; i++) {
+    free(a->states[i].set);
+  }
+  a->flushes++;
+  a->nstates = 0;
+  a->start = -1;
+  memset(a->table, 0, sizeof(int) * DFA_TABLE_SIZE);
+}
+
+/* Row offset of the state for the @p n nodes in a->buf; -1 if the cache is full. */
+static int intern(struct automaton *a, int n) {
+  unsigned int h = 2166136261u;
+  for (int i = 0; i < n; i++) {
+    h = (h ^ (unsigned int)a->buf[i]) * 16777619u;
+  }
+  unsigned int slot = h & (DFA_TABLE_SIZE - 1);
+  while (a->table[slot]) {
+    struct dstate *d = &a->states[a->table[slot] - 1];
+    if (d->hash == h && d->nset == n && memcmp(d->set, a->buf, sizeof(int) * n) == 0) {
+      return (a->table[slot] - 1) * DFA_ROW;
+    }
+    slot = (slot + 1) & (DFA_TABLE_SIZE - 1);
+  }
+  if (a->nstates == DFA_MAX_STATES) {
+    return -1;
+  }
+  if (a->nstates == a->capstates) {
+    a->capstates = a->capstates ? a->capstates * 2 : 16;
+    a->states = realloc(a->states, sizeof(struct dstate) * a->capstates);
+    a->trans = realloc(a->trans, sizeof(int) * DFA_ROW * a->capstates);
+  }
+  struct dstate *d = &a->states[a->nstates];
+  d->set = malloc(sizeof(int) * (n ? n : 1));
+  memcpy(d->set, a->buf, sizeof(int) * n);
+  d->nset = n;
+  d->hash = h;
+  int *row = &a->trans[a->nstates * DFA_ROW];
+  memset(row, 0xff, sizeof(int) * NSYMS);
+  row[ROW_ACCEPT] = 0;
+  row[ROW_DEAD] = (n == 0);
+  for (int i = 0; i < n; i++) {
+    if (a->nfa.nodes[a->buf[i]].type == NFA_MATCH) {
+      row[ROW_ACCEPT] = 1;
+    }
+  }
+  a->table[slot] = a->nstates + 1;
+  return a->nstates++ * DFA_ROW;
+}
+
+static int automatonStart(struct automaton *a) {
+  if (a->start < 0) {
+    a->stack[0] = a->nfa.start;
+    int n = closure(a, 1);
+    a->start = intern(a, n);
+    if (a->start < 0) {
+      automatonFlush(a);
+      a->start = intern(a, n);
+    }
+  }
+  return a->start;
+}
+
+/* Build the transition from the state at row @p st on symbol @p c. */
+static int automatonStep(struct automaton *a, int st, int c) {
+  struct dstate *d = &a->states[st / DFA_ROW];
+  int nseeds = 0;
+  for (int i = 0; i < d->nset; i++) {
+    struct nfaNode *node = &a->nfa.nodes[d->set[i]];
+    if (node->type == NFA_SET && setHas(node->set, c)) {
+      a->stack[nseeds++] = node->out;
+    }
+  }
+  if (a->unanchored) {
+    a->stack[nseeds++] = a->nfa.start;
+  }
+  int n = closure(a, nseeds);
+  int next = intern(a, n);
+  if (next < 0) {
+    /* Cache full: start over with just the state we are moving to. */
+    automatonFlush(a);
+    return intern(a, n);
+  }
+  a->trans[st + c] = next;
+  return next;
+}
+
+/** Follow the transition on symbol @p c, building it if needed. */
+#define DFA_NEXT(a, st, c) \
+  ((a)->trans[(st) + (c)] >= 0 ? (a)->trans[(st) + (c)] : automatonStep((a), (st), (c)))
+
+static int automatonInit(struct automaton *a, const struct ast *nodes, int root,
+                         int reverse) {
+  memset(a, 0, sizeof(*a));
+  int start, end;
+  int match;
+  if (nfaBuild(&a->nfa, nodes, root, reverse, &start, &end) < 0 ||
+      (match = nfaNew(&a->nfa, NFA_MATCH)) < 0) {
+    return -1;
+  }
+  a->nfa.nodes[end].out = match;
+  a->nfa.start = start;
+  a->unanchored = reverse;
+  a->table = calloc(DFA_TABLE_SIZE, sizeof(int));
+  a->stack = malloc(sizeof(int) * (3 * a->nfa.n + 2));
+  a->buf = malloc(sizeof(int) * (a->nfa.n + 1));
+  a->mark = calloc(a->nfa.n, sizeof(unsigned int));
+  a->start = -1;
+  return 0;
+}
+
+static void automatonFree(struct automaton *a) {
+  if (a->table) {
+    automatonFlush(a);
+  }
+  free(a->states);
+  free(a->trans);
+  free(a->table);
+  free(a->stack);
+  free(a->buf);
+  free(a->mark);
+  free(a->seen);
+  free(a->nfa.nodes);
+}
+
+/**
+ * @brief Compile a regular expression.
+ * @ingroup dfa
+ *
+ * Supports POSIX extended syntax: literals, @c . , bracket expressions with
+ * ranges and negation, @c * @c + @c ? and @c {m,n} repetition, alternation,
+ * grouping, the @c ^ and @c $ anchors, and the escapes @c \\d @c \\w @c \\s
+ * (and their negations). Patterns that can match empty text are rejected,
+ * since they would match at every position.
+ *
+ * @param[in] pattern NUL-terminated pattern.
+ * @param[out] error Set to a static message when compilation fails.
+ * @return Compiled expression to release with dfaFree(), or NULL on error.
+ * @sa dfaCached(), dfaSearch()
+ */
+struct dfa *dfaCompile(const char *pattern, const char **error) {
+  struct parser ps = { pattern, malloc(sizeof(struct ast) * DFA_MAX_AST), 0, NULL };
+  int root = parseAlt(&ps);
+  if (root >= 0 && *ps.p == ')') {
+    ps.error = "unmatched )";
+  } else if (root >= 0 && astNullable(ps.nodes, root)) {
+    ps.error = "pattern matches empty text";
+  }
+  struct dfa *re = NULL;
+  if (root >= 0 && ps.error == NULL) {
+    re = malloc(sizeof(struct dfa));
+    if (automatonInit(&re->fwd, ps.nodes, root, 0) < 0 ||
+        automatonInit(&re->rev, ps.nodes, root, 1) < 0) {
+      ps.error = "pattern too large";
+      automatonFree(&re->fwd);
+      automatonFree(&re->rev);
+      free(re);
+      re = NULL;
+    }
+  }
+  free(ps.nodes);
+  *error = ps.error;
+  return re;
+}
+
+/**
+ * @brief Release a compiled expression.
+ * @ingroup dfa
+ *
+ * @param[in] re Expression from dfaCompile(); NULL is ignored. Must not be
+ *            one returned by dfaCached().
+ */
+void dfaFree(struct dfa *re) {
+  if (re == NULL) {
+    return;
+  }
+  automatonFree(&re->fwd);
+  automatonFree(&re->rev);
+  free(re);
+}
+
+/**
+ * @brief Compile a regular expression, reusing recent compilations.
+ * @ingroup dfa
+ *
+ * Keeps the last few patterns together with the DFA states already built
+ * for them, so retyping or re-running a search starts warm.
+ *
+ * @param[in] pattern NUL-terminated pattern.
+ * @param[out] error Set to a static message when compilation fails.
+ * @return Expression owned by the cache (valid until a few other patterns
+ *         have been compiled), or NULL on error.
+ * @sa dfaCompile()
+ */
+struct dfa *dfaCached(const char *pattern, const char **error) {
+  static struct {
+    char *pattern;
+    struct dfa *re;
+  } cache[DFA_CACHE];
+  int i = 0;
+  while (i < DFA_CACHE && cache[i].pattern && strcmp(cache[i].pattern, pattern) != 0) {
+    i++;
+  }
+  if (i == DFA_CACHE || cache[i].pattern == NULL) {
+    struct dfa *re = dfaCompile(pattern, error);
+    if (re == NULL) {
+      return NULL;
+    }
+    i = DFA_CACHE - 1;
+    free(cache[i].pattern);
+    dfaFree(cache[i].re);
+    size_t n = strlen(pattern) + 1;
+    cache[i].pattern = memcpy(malloc(n), pattern, n);
+    cache[i].re = re;
+  }
+  /* Move to the front so the least recently used entry is evicted. */
+  char *p = cache[i].pattern;
+  struct dfa *re = cache[i].re;
+  memmove(&cache[1], &cache[0], sizeof(cache[0]) * i);
+  cache[0].pattern = p;
+  cache[0].re = re;
+  *error = NULL;
+  return re;
+}
+
+/*
+ * Run the reverse DFA over the row from its end down to symbol position
+ * @p lo (0 is BOL, k is byte k - 1). Marks in @p starts, if given, every
+ * position where a match starts; returns the leftmost one, or -1.
+ */
+static int reverseScan(struct dfa *re, const char *s, int len, int lo, unsigned char *starts) {
+  struct automaton *a = &re->rev;
+  int best = -1;
+  int st = automatonStart(a);
+  st = DFA_NEXT(a, st, SYM_EOL);
+  const int *trans = a->trans;
+  for (int k = len; k >= 1 && k >= lo; k--) {
+    int c = (unsigned char)s[k - 1];
+    int next = trans[st + c];
+    if (next < 0) {
+      next = automatonStep(a, st, c);
+      trans = a->trans;
+    }
+    st = next;
+    if (trans[st + ROW_ACCEPT]) {
+      best = k;
+      if (starts) {
+        starts[k] = 1;
+      }
+    }
+  }
+  if (lo == 0) {
+    st = DFA_NEXT(a, st, SYM_BOL);
+    if (a->trans[st + ROW_ACCEPT]) {
+      best = 0;
+      if (starts) {
+        starts[0] = 1;
+      }
+    }
+  }
+  return best;
+}
+
+/*
+ * Run the forward DFA from symbol position @p k and return the position just
+ * past the longest match starting there, or -1.
+ */
+static int forwardLongest(struct dfa *re, const char *s, int len, int k) {
+  struct automaton *a = &re->fwd;
+  int end = -1;
+  int st = automatonStart(a);
+  for (; k <= len + 1; k++) {
+    int c = (k == 0) ? SYM_BOL : (k == len + 1) ? SYM_EOL : (unsigned char)s[k - 1];
+    st = DFA_NEXT(a, st, c);
+    if (a->trans[st + ROW_DEAD]) {
+      break;
+    }
+    if (a->trans[st + ROW_ACCEPT]) {
+      end = k + 1;
+    }
+  }
+  return end;
+}
+
+/* Convert symbol positions [k, end) to a byte offset and length. */
+static int toBytes(int k, int end, int len, int *mlen) {
+  int at = (k == 0) ? 0 : k - 1;
+  int stop = (end - 1 > len) ? len : end - 1;
+  *mlen = stop - at;
+  return at;
+}
+
+/**
+ * @brief Find the leftmost-longest match in a string.
+ * @ingroup dfa
+ *
+ * Runs in time linear in @p len: one reverse pass locates the leftmost match
+ * start at or after @p from, one forward pass its longest extent.
+ *
+ * @param[in] re Compiled expression.
+ * @param[in] s Bytes to search, treated as one line; may contain NULs.
+ * @param[in] len Length of @p s.
+ * @param[in] from Byte offset where matches may start.
+ * @param[out] mlen Length of the match in bytes (always at least 1).
+ * @return Byte offset of the match, or -1 if there is none.
+ * @sa dfaSearchAll()
+ */
+int dfaSearch(struct dfa *re, const char *s, int len, int from, int *mlen) {
+  if (from > len) {
+    return -1;
+  }
+  int k = reverseScan(re, s, len, from == 0 ? 0 : from + 1, NULL);
+  if (k < 0) {
+    return -1;
+  }
+  int end = forwardLongest(re, s, len, k);
+  if (end < 0) {
+    return -1;
+  }
+  return toBytes(k, end, len, mlen);
+}
+
+/* Report the match at symbol positions [k, end). */
+static void emitMatch(int k, int end, int len,
+                      void (*emit)(void *ctx, int at, int mlen), void *ctx) {
+  int mlen;
+  int at = toBytes(k, end, len, &mlen);
+  emit(ctx, at, mlen);
+}
+
+/*
+ * Report the matches from symbol position @p k on, extending each marked
+ * start in @p starts on its own. Text after a match may be scanned again for
+ * the next one; used only when the forward DFA's cache was flushed midway.
+ */
+static int forwardEach(struct dfa *re, const char *s, int len, const unsigned char *starts,
+                       int k, void (*emit)(void *ctx, int at, int mlen), void *ctx) {
+  int count = 0;
+  while (k <= len) {
+    int end = starts[k] ? forwardLongest(re, s, len, k) : -1;
+    if (end < 0) {
+      k++;
+      continue;
+    }
+    emitMatch(k, end, len, emit, ctx);
+    count++;
+    k = end;
+  }
+  return count;
+}
+
+/*
+ * A possible match in forwardAll(): where it starts, the end of its longest
+ * match so far (-1 before the first), and its forward DFA state (-1 once it
+ * can go no further).
+ */
+struct candidate {
+  int start;
+  int end;
+  int st;
+};
+
+/*
+ * Report the matches starting at the positions marked in @p starts in one
+ * forward pass. Besides the leftmost candidate, one more starts at the first
+ * marked position past each candidate's match so far, in case that match
+ * turns out to be final; an accept drops the candidates after it, since they
+ * start inside the longer match. All of them advance together, so no byte
+ * is scanned twice. A candidate that reaches the same DFA state as an
+ * earlier one stops: from there on it can only accept where the earlier one
+ * does, which would drop it, so at most one candidate per state is live.
+ * Only the live ones are stepped; stopped ones wait in order to be reported.
+ */
+static int forwardAll(struct dfa *re, const char *s, int len, const unsigned char *starts,
+                      void (*emit)(void *ctx, int at, int mlen), void *ctx) {
+  struct automaton *a = &re->fwd;
+  if (a->seen == NULL) {
+    a->seen = calloc(DFA_MAX_STATES, sizeof(unsigned int));
+  }
+  struct candidate *c = malloc(sizeof(struct candidate) * ((size_t)len + 2));
+  int *live = malloc(sizeof(int) * ((size_t)len + 2));
+  unsigned int flushes = a->flushes;
+  int head = 0;              /* First candidate not yet reported. */
+  int n = 0;                 /* Candidates in c. */
+  int nlive = 0;             /* Candidates still advancing, in order, in live. */
+  int done = 0;              /* End of the last match reported. */
+  int count = 0;
+  for (int k = 0; k <= len + 1; k++) {
+    int last = (n > head) ? c[n - 1].end : done;
+    if (k <= len && starts[k] && last >= 0 && k >= last) {
+      c[n].start = k;
+      c[n].end = -1;
+      c[n].st = automatonStart(a);
+      live[nlive++] = n++;
+      if (a->flushes != flushes) {
+        goto flushed;
+      }
+    }
+    if (nlive == 0) {
+      continue;
+    }
+    if (++a->seengen == 0) {
+      memset(a->seen, 0, sizeof(unsigned int) * DFA_MAX_STATES);
+      a->seengen = 1;
+    }
+    int sym = (k == 0) ? SYM_BOL : (k == len + 1) ? SYM_EOL : (unsigned char)s[k - 1];
+    int kept = 0;
+    for (int j = 0; j < nlive; j++) {
+      struct candidate *ci = &c[live[j]];
+      int st = DFA_NEXT(a, ci->st, sym);
+      if (a->flushes != flushes) {
+        goto flushed;
+      }
+      if (a->trans[st + ROW_DEAD] || a->seen[st / DFA_ROW] == a->seengen) {
+        ci->st = -1;
+        continue;
+      }
+      ci->st = st;
+      a->seen[st / DFA_ROW] = a->seengen;
+      live[kept++] = live[j];
+      if (a->trans[st + ROW_ACCEPT]) {
+        ci->end = k + 1;
+        n = live[j] + 1;
+        break;
+      }
+    }
+    nlive = kept;
+    while (head < n && c[head].st < 0) {
+      if (c[head].end >= 0) {
+        emitMatch(c[head].start, c[head].end, len, emit, ctx);
+        count++;
+        done = c[head].end;
+      }
+      head++;
+    }
+  }
+  /* Past the end of the line every candidate has stopped. */
+  for (; head < n; head++) {
+    if (c[head].end >= 0) {
+      emitMatch(c[head].start, c[head].end, len, emit, ctx);
+      count++;
+    }
+  }
+  free(live);
+  free(c);
+  return count;
+
+flushed:
+  /* The candidates' states went with the cache; carry on one start at a time. */
+  count += forwardEach(re, s, len, starts, head < n ? c[head].start : done, emit, ctx);
+  free(live);
+  free(c);
+  return count;
+}
+
+/**
+ * @brief Report every non-overlapping leftmost-longest match in a string.
+ * @ingroup dfa
+ *
+ * One reverse pass marks every position where a match starts; one forward
+ * pass then extends the marked starts that can still begin a match, all at
+ * once, so the time is linear in @p len for a given pattern.
+ *
+ * @param[in] re Compiled expression.
+ * @param[in] s Bytes to search, treated as one line.
+ * @param[in] len Length of @p s.
+ * @param[in] emit Called with @p ctx, the byte offset, and the length of
+ *            each match, in order.
+ * @param[in] ctx Passed to @p emit.
+ * @return Number of matches.
+ * @sa dfaSearch()
+ */
+int dfaSearchAll(struct dfa *re, const char *s, int len,
+                 void (*emit)(void *ctx, int at, int mlen), void *ctx) {
+  unsigned char *starts = calloc((size_t)len + 2, 1);
+  int count = 0;
+  if (reverseScan(re, s, len, 0, starts) >= 0) {
+    count = forwardAll(re, s, len, starts, emit, ctx);
+  }
+  free(starts);
+  return count;
+}
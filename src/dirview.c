@@ -0,0 +1,461 @@
+/**
+ * @file dirview.c
+ * @brief Directory browser implementation.
+ * @ingroup dirview
+ *
+ * Opening a directory reads one batch of entries and shows them at once;
+ * an idle task reads the rest. On Linux entries come straight from
+ * getdents64(), tens of kilobytes per call, without the per-entry
+ * allocation and sorting scandir() does up front. Each batch is sorted and
+ * merged into the entries seen so far, so the listing is always in order;
+ * until the directory has been read to the end only its first page is
+ * shown as rows, and the rest are added a slice at a time afterwards.
+ *
+ * Every row is "T SIZE MTIME  NAME". Type comes with the directory entry;
+ * size and modification time are filled in by lstat()ing entries in the
+ * background, the ones on screen first.
+ */
+#include "ze.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "fileio.h"
+#include "hooks.h"
+#include "idle.h"
+#include "init.h"
+#include "row.h"
+#include "search.h"
+#include "status.h"
+#include "dirview.h"
+
+extern struct editorConfig E;
+
+/** Bytes of directory entries requested per getdents64() call. */
+#define DIRVIEW_BUF (64 * 1024)
+/** Rows shown while the directory is still being read. */
+#define DIRVIEW_PAGE 256
+/** Time an idle slice may spend, in milliseconds. */
+#define DIRVIEW_SLICE_MS 8
+
+struct dirEntry {
+  char *name;
+  unsigned char type;  /* DT_* value from the directory. */
+  int statted;         /* Whether @c mode, @c size, and @c mtime are known. */
+  mode_t mode;
+  off_t size;
+  time_t mtime;
+};
+
+#ifdef __linux__
+/* Record layout returned by getdents64(). */
+struct linuxDirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+#endif
+
+static struct {
+  char *path;              /* Directory shown; NULL when not browsing. */
+  int fd;                  /* Open directory, for reading and fstatat(). */
+#ifndef __linux__
+  DIR *dir;
+#endif
+  char *buf;               /* getdents64() buffer. */
+  int reading;             /* Entries remain to be read. */
+  struct dirEntry *ents;   /* Entries read so far, sorted by name. */
+  int nents;
+  int cap;
+  struct dirEntry *run;    /* Batch being read, before it is merged. */
+  int nrun;
+  int runcap;
+  int built;               /* Rows [0, built) show ents [0, built). */
+  int statnext;            /* Next entry for the background lstat() sweep. */
+} D = { .fd = -1 };
+
+static long dirviewNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int entCmp(const void *a, const void *b) {
+  return strcmp(((const struct dirEntry *)a)->name, ((const struct dirEntry *)b)->name);
+}
+
+static void dirviewAdd(const char *name, unsigned char type) {
+  if (strcmp(name, ".") == 0) {
+    return;
+  }
+  if (D.nrun == D.runcap) {
+    D.runcap = D.runcap ? D.runcap * 2 : 1024;
+    D.run = realloc(D.run, sizeof(struct dirEntry) * D.runcap);
+  }
+  struct dirEntry *e = &D.run[D.nrun++];
+  memset(e, 0, sizeof(*e));
+  e->name = strdup(name);
+  e->type = type;
+}
+
+/*
+ * Read the next batch of entries into D.run. Returns 1 if more may follow,
+ * 0 at the end of the directory, or -1 with errno set.
+ */
+static int dirviewRead(void) {
+#ifdef __linux__
+  long n = syscall(SYS_getdents64, D.fd, D.buf, DIRVIEW_BUF);
+  if (n <= 0) {
+    return (int)n;
+  }
+  for (long off = 0; off < n;) {
+    struct linuxDirent64 *d = (struct linuxDirent64 *)(D.buf + off);
+    dirviewAdd(d->d_name, d->d_type);
+    off += d->d_reclen;
+  }
+  return 1;
+#else
+  for (int i = 0; i < 1024; i++) {
+    errno = 0;
+    struct dirent *d = readdir(D.dir);
+    if (d == NULL) {
+      return errno ? -1 : 0;
+    }
+    dirviewAdd(d->d_name, d->d_type);
+  }
+  return 1;
+#endif
+}
+
+/*
+ * Sort D.run and merge it into D.ents from the back, in place. Returns the
+ * index the smallest new entry landed at, so callers know how much of the
+ * sorted prefix moved.
+ */
+static int dirviewMerge(void) {
+  if (D.nrun == 0) {
+    return D.nents;
+  }
+  qsort(D.run, D.nrun, sizeof(struct dirEntry), entCmp);
+  if (D.nents + D.nrun > D.cap) {
+    while (D.nents + D.nrun > D.cap) {
+      D.cap = D.cap ? D.cap * 2 : 1024;
+    }
+    D.ents = realloc(D.ents, sizeof(struct dirEntry) * D.cap);
+  }
+  int i = D.nents - 1;
+  int j = D.nrun - 1;
+  int k = D.nents + D.nrun - 1;
+  while (j >= 0) {
+    if (i >= 0 && strcmp(D.ents[i].name, D.run[j].name) > 0) {
+      D.ents[k--] = D.ents[i--];
+    } else {
+      D.ents[k--] = D.run[j--];
+    }
+  }
+  D.nents += D.nrun;
+  D.nrun = 0;
+  return k + 1;
+}
+
+static char dirviewTypeChar(const struct dirEntry *e) {
+  if (e->statted) {
+    if (S_ISDIR(e->mode)) return 'd';
+    if (S_ISLNK(e->mode)) return 'l';
+    if (S_ISREG(e->mode)) return '-';
+    if (S_ISFIFO(e->mode)) return 'p';
+    if (S_ISSOCK(e->mode)) return 's';
+    if (S_ISCHR(e->mode)) return 'c';
+    if (S_ISBLK(e->mode)) return 'b';
+    return '?';
+  }
+  switch (e->type) {
+  case DT_DIR: return 'd';
+  case DT_LNK: return 'l';
+  case DT_REG: return '-';
+  case DT_FIFO: return 'p';
+  case DT_SOCK: return 's';
+  case DT_CHR: return 'c';
+  case DT_BLK: return 'b';
+  default: return '?';
+  }
+}
+
+/* Format a size in at most 7 columns: 512, 4.0K, 12M. */
+static void dirviewSize(off_t size, char *out, size_t cap) {
+  static const char units[] = "KMGTPE";
+  if (size < 1024) {
+    snprintf(out, cap, "%lld", (long long)size);
+    return;
+  }
+  double v = (double)size;
+  int u = -1;
+  while (v >= 1024 && u < 5) {
+    v /= 1024;
+    u++;
+  }
+  if (v < 10) {
+    snprintf(out, cap, "%.1f%c", v, units[u]);
+  } else {
+    snprintf(out, cap, "%.0f%c", v, units[u]);
+  }
+}
+
+/* Listing row for @p e; the name starts at DIRVIEW_NAME_COL. */
+static int dirviewFormat(const struct dirEntry *e, char *out, size_t cap) {
+  char size[16] = "";
+  char when[20] = "";
+  if (e->statted) {
+    dirviewSize(e->size, size, sizeof(size));
+    struct tm tm;
+    localtime_r(&e->mtime, &tm);
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M", &tm);
+  }
+  char type = dirviewTypeChar(e);
+  return snprintf(out, cap, "%c %7s %-16s  %s%s", type, size, when, e->name,
+                  type == 'd' ? "/" : "");
+}
+
+/* Show entry @p i as row @p i, adding the row if it is the next one. */
+static void dirviewSetRow(int i) {
+  char line[DIRVIEW_NAME_COL + 260];
+  int len = dirviewFormat(&D.ents[i], line, sizeof(line));
+  if (len >= (int)sizeof(line)) {
+    len = sizeof(line) - 1;
+  }
+  if (i < E.numrows) {
+    editorRowSetText(&E.row[i], line, (size_t)len);
+  } else {
+    editorInsertRow(i, line, (size_t)len);
+  }
+}
+
+/* Fetch the metadata of entry @p i and refresh its row if it has one. */
+static void dirviewStat(int i) {
+  struct dirEntry *e = &D.ents[i];
+  if (e->statted) {
+    return;
+  }
+  struct stat st;
+  if (fstatat(D.fd, e->name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+    e->type = DT_UNKNOWN;
+    return;
+  }
+  e->statted = 1;
+  e->mode = st.st_mode;
+  e->size = st.st_size;
+  e->mtime = st.st_mtime;
+  if (i < D.built && i < E.numrows) {
+    dirviewSetRow(i);
+  }
+}
+
+/* Rows are only replaced while no search thread could be reading them. */
+static int dirviewCanEdit(void) {
+  return !editorSearchActive();
+}
+
+/*
+ * Idle task: read and merge more entries, keep the rows in step with the
+ * sorted list, and fill in metadata, on-screen rows first.
+ */
+static int dirviewIdle(void *data) {
+  (void)data;
+  if (D.path == NULL) {
+    return 0;
+  }
+  long deadline = dirviewNow() + DIRVIEW_SLICE_MS;
+  int redraw = 0;
+  int dirty = E.dirty;
+  int edit = dirviewCanEdit();
+
+  if (D.reading) {
+    int lowest = D.nents;
+    int r = 1;
+    while (r == 1 && dirviewNow() < deadline) {
+      r = dirviewRead();
+      int at = dirviewMerge();
+      if (at < lowest) {
+        lowest = at;
+      }
+    }
+    if (r <= 0) {
+      D.reading = 0;
+      if (r < 0) {
+        editorSetStatusMessage("Error reading %s: %s", D.path, strerror(errno));
+      } else {
+        postDirOpenHook(D.nents);
+      }
+    } else {
+      editorSetStatusMessage("Reading %s: %d entries", D.path, D.nents);
+    }
+    redraw = 1;
+    /* Rows mirror a prefix of the list; redo the part new entries moved. */
+    if (edit) {
+      int page = D.nents < DIRVIEW_PAGE ? D.nents : DIRVIEW_PAGE;
+      if (page > D.built) {
+        D.built = page;
+      }
+      for (int i = lowest; i < D.built; i++) {
+        dirviewSetRow(i);
+      }
+    }
+  } else if (edit && D.built < D.nents) {
+    while (D.built < D.nents && dirviewNow() < deadline) {
+      dirviewSetRow(D.built++);
+    }
+    redraw = 1;
+  }
+
+  if (edit) {
+    int last = E.rowoff + E.screenrows;
+    for (int i = E.rowoff; i < last && i < D.built; i++) {
+      if (!D.ents[i].statted) {
+        dirviewStat(i);
+        redraw = 1;
+      }
+    }
+    if (!D.reading) {
+      while (D.statnext < D.nents && dirviewNow() < deadline) {
+        dirviewStat(D.statnext++);
+        redraw = 1;
+      }
+    }
+  }
+  /* A listing is not a document: refreshing it leaves nothing to save. */
+  E.dirty = dirty;
+
+  int pending = D.built < D.nents || D.statnext < D.nents;
+  if (!D.reading && !pending) {
+    editorIdleRemove(dirviewIdle, NULL);
+  }
+  /* Rows held back for a search wait for the next tick, not a busy loop. */
+  int more = D.reading || (edit && pending);
+  return (more ? IDLE_MORE : 0) | (redraw ? IDLE_REDRAW : 0);
+}
+
+/**
+ * @brief Show a directory listing in the buffer.
+ * @ingroup dirview
+ *
+ * Reads the first batch of entries right away and leaves the rest, the
+ * sorting, and the metadata to an idle task. postDirOpenHook() runs once
+ * every entry has been read.
+ *
+ * @param[in] path Directory to list.
+ * @sa dirviewEnter(), dirviewClose()
+ */
+void dirviewOpen(const char *path) {
+  dirviewClose();
+  D.fd = open(path, O_RDONLY | O_DIRECTORY);
+  if (D.fd == -1) {
+    editorSetStatusMessage("Error opening directory: %s", strerror(errno));
+    return;
+  }
+#ifdef __linux__
+  D.buf = malloc(DIRVIEW_BUF);
+#else
+  D.dir = fdopendir(dup(D.fd));
+#endif
+  D.path = strdup(path);
+  D.reading = 1;
+  int dirty = E.dirty;
+  editorIdleAdd(dirviewIdle, NULL);
+  dirviewIdle(NULL);
+  E.dirty = dirty;
+}
+
+/**
+ * @brief Stop browsing and free the listing.
+ * @ingroup dirview
+ *
+ * Leaves the rows in the buffer as they are.
+ */
+void dirviewClose(void) {
+  if (D.path == NULL) {
+    return;
+  }
+  editorIdleRemove(dirviewIdle, NULL);
+  for (int i = 0; i < D.nents; i++) {
+    free(D.ents[i].name);
+  }
+  for (int i = 0; i < D.nrun; i++) {
+    free(D.run[i].name);
+  }
+  free(D.ents);
+  free(D.run);
+  free(D.buf);
+#ifndef __linux__
+  if (D.dir != NULL) {
+    closedir(D.dir);
+  }
+#endif
+  close(D.fd);
+  free(D.path);
+  memset(&D, 0, sizeof(D));
+  D.fd = -1;
+}
+
+/**
+ * @brief Whether the buffer is showing a directory listing.
+ * @ingroup dirview
+ */
+int dirviewActive(void) {
+  return D.path != NULL;
+}
+
+/**
+ * @brief Open the entry under the cursor.
+ * @ingroup dirview
+ *
+ * Bound to Enter while browsing. The name is taken from the row text, so
+ * this works on any listing row; files and directories are opened in place
+ * of the listing, and ".." goes up a level.
+ */
+void dirviewEnter(void) {
+  if (E.cy >= E.numrows || E.row[E.cy].size <= DIRVIEW_NAME_COL) {
+    return;
+  }
+  erow *row = &E.row[E.cy];
+  int len = row->size - DIRVIEW_NAME_COL;
+  if (row->chars[DIRVIEW_NAME_COL + len - 1] == '/') {
+    len--;
+  }
+  size_t plen = strlen(D.path);
+  char *path = malloc(plen + len + 2);
+  memcpy(path, D.path, plen);
+  if (plen == 0 || path[plen - 1] != '/') {
+    path[plen++] = '/';
+  }
+  memcpy(path + plen, row->chars + DIRVIEW_NAME_COL, len);
+  path[plen + len] = '\0';
+  /* Keep ".." out of the buffer's name once it has been followed. */
+  char *real = realpath(path, NULL);
+  if (real != NULL) {
+    free(path);
+    path = real;
+  }
+
+  dirviewClose();
+  for (int i = 0; i < E.numrows; i++) {
+    editorFreeRow(&E.row[i]);
+  }
+  free(E.row);
+  free(E.filename);
+  initEditor();
+  editorOpen(path);
+  free(path);
+}
@@ -8,6 +8,7 @@
 
 #include "ze.h"
 #include "row.h"
+#include "journal.h"
 
 extern struct editorConfig E;
 
@@ -74,9 +75,12 @@ void editorInsertNewline(void) {
     erow *row = &E.row[E.cy];
     editorInsertRow(E.cy + 1, &row->chars[E.cx], row->size - E.cx);
     row = &E.row[E.cy];
+    int removed = row->size - E.cx;
+    journalTruncate(E.cy, E.cx);
+    editorRowUnshare(row);
     row->size = E.cx;
     row->chars[row->size] = '\0';
-    editorUpdateRow(row);
+    editorUpdateRowRange(row, E.cx, removed, 0);
   }
   E.cy++;
   E.cx = 0;
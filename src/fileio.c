@@ -11,15 +11,25 @@
 #include <string.h>
 #include <strings.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
-#include <dirent.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include "row.h"
 #include "status.h"
 #include "syntax.h"
+#include "compress.h"
+#include "dirview.h"
+#include "follow.h"
+#include "pager.h"
 #include "hooks.h"
+#include "idle.h"
+#include "journal.h"
+#include "statecache.h"
 #include "templates.h"
+#include "textscan.h"
 #include "input.h"
+#include "search.h"
 #include "init.h"
 
 extern struct editorConfig E;
@@ -76,11 +86,6 @@ void editorCloneTemplate(void) {
   E.dirty = 0;
 }
 
-static int _true_selector(const struct dirent *empty) {
-  (void)empty;
-  return 1;
-}
-
 static char *normalize_path(const char *in) {
   if (in == NULL) return NULL;
   // Trim leading/trailing whitespace
@@ -109,7 +114,94 @@ static char *normalize_path(const char *in) {
   return out;
 }
 
+/* Bytes of file data handled at a time when loading and compressing. */
+#define ZE_IO_BLOCK (256 * 1024)
+
+/*
+ * Append the lines in @p p up to @p end as rows, dropping @p strip bytes
+ * (the '\r' of a CRLF file) from the end of each. The first line's newline
+ * is searched for from @p from, since the bytes before it were already
+ * scanned. Returns the start of the unterminated last line.
+ */
+static char *editorLoadLines(char *p, char *from, char *end, size_t strip) {
+  char *nl;
+  while ((nl = memchr(from, '\n', (size_t)(end - from))) != NULL) {
+    editorInsertRow(E.numrows, p, (size_t)(nl - p) - strip);
+    p = from = nl + 1;
+  }
+  return p;
+}
+
+/*
+ * Append the lines read from @p c as rows. Lines are cut out of large
+ * blocks with memchr() rather than read one at a time; a line longer than
+ * a block grows the block, and only its newly read bytes are searched. Each block is scanned first (see textscan.c) so
+ * line endings are known before it is split: while every line so far ends
+ * in CRLF the '\r' is left out of the rows and added back on save;
+ * otherwise rows keep whatever '\r' the file had. A UTF-8 byte order mark
+ * is left out of the first row the same way. Stores the bytes read in
+ * @p loaded and what the scan found in @p t. Returns 0 on success, or -1
+ * with errno set.
+ */
+static int editorLoadRows(struct cstream *c, off_t *loaded, struct textScan *t) {
+  size_t cap = ZE_IO_BLOCK;
+  size_t have = 0;
+  size_t skip = 0;
+  size_t scanned = 0;       /* Leading bytes of buf known to hold no '\n'. */
+  int eol = EOL_LF;
+  char *buf = malloc(cap);
+  textScanInit(t);
+  for (;;) {
+    if (have == cap) {
+      cap *= 2;
+      buf = realloc(buf, cap);
+    }
+    ssize_t n = cstreamRead(c, buf + have, cap - have);
+    if (n < 0) {
+      int saved = errno;
+      free(buf);
+      errno = saved;
+      return -1;
+    }
+    if (n == 0) {
+      break;
+    }
+    textScanBlock(t, buf + have, (size_t)n);
+    if (*loaded == 0 && n >= TEXT_BOM_LEN && memcmp(buf, TEXT_BOM, TEXT_BOM_LEN) == 0) {
+      E.bom = 1;
+      skip = TEXT_BOM_LEN;
+    }
+    have += (size_t)n;
+    *loaded += n;
+    /* The first LF-only line after CRLF ones: put back the '\r's left out. */
+    if (eol == EOL_CRLF && textScanEol(t) == EOL_MIXED) {
+      for (int i = 0; i < E.numrows; i++) {
+        editorRowAppendString(&E.row[i], "\r", 1);
+      }
+    }
+    eol = textScanEol(t);
+    char *p = editorLoadLines(buf + skip, buf + (scanned > skip ? scanned : skip),
+                              buf + have, eol == EOL_CRLF);
+    skip = 0;
+    have = (size_t)(buf + have - p);
+    memmove(buf, p, have);
+    scanned = have;
+  }
+  if (have > 0) {
+    editorInsertRow(E.numrows, buf, have);
+  }
+  free(buf);
+  E.eol = eol;
+  E.noeol = t->last != -1 && t->last != '\n';
+  return 0;
+}
+
+/* Bumped whenever a file is loaded, so a finishing save can tell it apart. */
+static unsigned buffer_gen = 0;
+
 void editorOpen(char *filename) {
+  /* Remember where we were in the file being left. */
+  stateCacheSave();
   if (filename == NULL) {
     char *input = editorPrompt("Path to open: (ESC to cancel) %s", NULL);
     if (input == NULL) {
@@ -122,49 +214,73 @@ void editorOpen(char *filename) {
   } else if (E.filename != NULL) {
     free(E.filename);
   }
+  /* Rows loaded below are the file itself, not edits to journal. */
+  journalClose();
+  dirviewClose();
+  followStop();
+  pagerClose();
+  E.eol = EOL_LF;
+  E.bom = 0;
+  E.noeol = 0;
 
   // Persist normalized path in editor state
   E.filename = strdup(filename);
+  buffer_gen++;
+  E.gen++;
   editorSelectSyntaxHighlight();
 
-  FILE *fp = NULL;
-  char *line = NULL;
-  size_t linecap = 0;
-  ssize_t linelen;
   struct stat s;
 
   if (stat(E.filename, &s) == 0) {
     if (s.st_mode & S_IFDIR) {
       preDirOpenHook();
-      struct dirent **dits;
-      int num_files = scandir(E.filename, &dits, _true_selector, alphasort);
-      if (num_files >= 0) {
-        for (int count = 0; count < num_files; ++count) {
-          editorInsertRow(count, dits[count]->d_name, strlen(dits[count]->d_name));
-        }
-        for (int count = 0; count < num_files; ++count) {
-          free(dits[count]);
-        }
-        free(dits);
-      } else {
-        perror("Error opening directory");
-      }
-      postDirOpenHook(num_files);
+      /* Large directories fill in from an idle task; see dirview.c. */
+      dirviewOpen(E.filename);
+      bufferSwitchHook();
       return;
     } else if (s.st_mode & S_IFREG) {
       preFileOpenHook();
-      fp = fopen(filename, "r");
-      if (!fp) {
+      int fd = open(filename, O_RDONLY);
+      if (fd == -1) {
         editorSetStatusMessage("Error opening specified file");
         return;
       }
-      while ((linelen = getline(&line, &linecap, fp)) != -1) {
-        while (linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r')) {
-          linelen--;
-        }
-        editorInsertRow(E.numrows, line, (size_t)linelen);
+      /* gzip and zstd files are decompressed on the fly and saved back the same way. */
+      struct cstream *c = cstreamOpenRead(fd, &E.compress);
+      /* An unchanged file reopens where it was left, skipping work done before. */
+      stateCacheLoad(fd, &s);
+      /* Too big to load: page it from disk, read-only and unjournaled. */
+      if (c != NULL && E.compress == COMPRESS_NONE && E.pagerlimit > 0 &&
+          s.st_size >= E.pagerlimit) {
+        cstreamClose(c, NULL);
+        pagerOpen(fd, s.st_size);
+        E.filesize = s.st_size;
+        stateCacheApply();
+        postFileOpenHook();
+        bufferSwitchHook();
+        return;
+      }
+      char error[100] = "";
+      off_t loaded = 0;
+      struct textScan scan;
+      textScanInit(&scan);
+      if (c == NULL || editorLoadRows(c, &loaded, &scan) == -1) {
+        snprintf(error, sizeof(error), "%s", c && cstreamError(c) ? cstreamError(c) : strerror(errno));
+      }
+      if (c != NULL) {
+        cstreamClose(c, NULL);
       }
+      close(fd);
+      E.filesize = E.compress == COMPRESS_NONE ? loaded : s.st_size;
+      stateCacheApply();
       postFileOpenHook();
+      if (error[0]) {
+        editorSetStatusMessage("Error reading %s file: %s", compressName(E.compress), error);
+      } else if (!textScanValid(&scan)) {
+        editorSetStatusMessage("%s is not valid UTF-8; bytes are kept as they are", E.filename);
+      } else if (scan.nul > 0) {
+        editorSetStatusMessage("%s has %lld NUL byte%s", E.filename, scan.nul, scan.nul == 1 ? "" : "s");
+      }
     } else {
       editorSetStatusMessage("Unknown object at filepath");
       return;
@@ -174,9 +290,372 @@ void editorOpen(char *filename) {
     return;
   }
 
-  free(line);
-  fclose(fp);
   E.dirty = 0;
+  journalOpen(E.filename);
+  bufferSwitchHook();
+}
+
+/* Rows handed to each writev() call; two iovecs per row stay under IOV_MAX. */
+#define ZE_SAVE_BATCH 512
+
+/** A row's text as captured for a background save. */
+struct saveLine {
+  const char *chars;
+  int size;
+};
+
+/**
+ * A save in progress. The writer thread only reads @c path, @c lines, the
+ * format fields, and @c sync and fills in the result fields before setting @c done; everything
+ * else belongs to the main thread.
+ */
+struct saveJob {
+  char *path;               /* Resolved target path. */
+  struct saveLine *lines;   /* Snapshot of the rows; the text is shared. */
+  int nlines;
+  off_t len;                /* Bytes to write, before any compression. */
+  const char *eol;          /* Line terminator, "\n" or "\r\n". */
+  size_t eollen;
+  int bom;                  /* Write a UTF-8 byte order mark first. */
+  int noeol;                /* Leave the terminator off the last line. */
+  int sync;                 /* E.savesync when the save started. */
+  int compress;             /* editorCompress format to write. */
+  int level;                /* Compression level, 0 for the default. */
+  int dirty;                /* E.dirty when the snapshot was taken. */
+  unsigned gen;             /* buffer_gen when the snapshot was taken. */
+  off_t mark;               /* journalMark() when the snapshot was taken. */
+  pthread_t thread;
+  int threaded;             /* Whether @c thread was started. */
+  int err;                  /* 0, or errno of the failure. */
+  long ms;                  /* Time the writer took. */
+  long long written;        /* Bytes that reached the file. */
+  _Atomic int done;
+};
+
+static struct saveJob *saving = NULL;
+
+/*
+ * Write every snapshot line followed by the job's terminator to @p fd.
+ * Batched writev() calls point straight at the row buffers, so saving needs
+ * no copy of the file in memory. Returns 0 on success, or -1 with errno set.
+ */
+static int editorWriteRows(int fd, const struct saveJob *job) {
+  struct iovec iov[2 * ZE_SAVE_BATCH];
+  int line = 0;
+  int n = 0;
+  if (job->bom) {
+    iov[n].iov_base = (char *)TEXT_BOM;
+    iov[n].iov_len = TEXT_BOM_LEN;
+    n++;
+  }
+  while (line < job->nlines || n > 0) {
+    for (; line < job->nlines && n + 2 <= 2 * ZE_SAVE_BATCH; line++) {
+      if (job->lines[line].size > 0) {
+        iov[n].iov_base = (char *)job->lines[line].chars;
+        iov[n].iov_len = (size_t)job->lines[line].size;
+        n++;
+      }
+      iov[n].iov_base = (char *)job->eol;
+      iov[n].iov_len = job->eollen;
+      n++;
+    }
+    /* The last terminator is the last iovec of the last batch. */
+    if (line == job->nlines && job->noeol && job->nlines > 0) {
+      n--;
+    }
+    struct iovec *v = iov;
+    while (n > 0) {
+      ssize_t written = writev(fd, v, n);
+      if (written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return -1;
+      }
+      /* Skip what was written; a short write leaves part of one iovec. */
+      while (n > 0 && (size_t)written >= v->iov_len) {
+        written -= (ssize_t)v->iov_len;
+        v++;
+        n--;
+      }
+      if (n > 0) {
+        v->iov_base = (char *)v->iov_base + written;
+        v->iov_len -= (size_t)written;
+      }
+    }
+  }
+  return 0;
+}
+
+/*
+ * Compress every snapshot line into @p fd. Rows are gathered into large
+ * blocks first so the compressor is not called once per line. Returns 0 on
+ * success, or -1 with errno set.
+ */
+static int editorWriteCompressed(int fd, struct saveJob *job) {
+  struct cstream *c = cstreamOpenWrite(fd, job->compress, job->level);
+  if (c == NULL) {
+    return -1;
+  }
+  char *block = malloc(ZE_IO_BLOCK);
+  size_t n = 0;
+  int r = 0;
+  if (job->bom) {
+    memcpy(block, TEXT_BOM, TEXT_BOM_LEN);
+    n = TEXT_BOM_LEN;
+  }
+  for (int i = 0; i < job->nlines && r == 0; i++) {
+    const struct saveLine *line = &job->lines[i];
+    size_t need = (size_t)line->size + job->eollen;
+    if (n + need > ZE_IO_BLOCK && n > 0) {
+      r = cstreamWrite(c, block, n);
+      n = 0;
+    }
+    if (need > ZE_IO_BLOCK) {
+      if (r == 0) {
+        r = cstreamWrite(c, line->chars, (size_t)line->size);
+      }
+      if (r == 0 && !(job->noeol && i == job->nlines - 1)) {
+        r = cstreamWrite(c, job->eol, job->eollen);
+      }
+      continue;
+    }
+    memcpy(block + n, line->chars, (size_t)line->size);
+    n += (size_t)line->size;
+    memcpy(block + n, job->eol, job->eollen);
+    n += job->eollen;
+  }
+  /* Unless the last line went out on its own, its terminator ends the block. */
+  if (job->noeol && job->nlines > 0 &&
+      (size_t)job->lines[job->nlines - 1].size + job->eollen <= ZE_IO_BLOCK) {
+    n -= job->eollen;
+  }
+  if (r == 0 && n > 0) {
+    r = cstreamWrite(c, block, n);
+  }
+  int saved = errno;
+  if (cstreamClose(c, &job->written) == -1 && r == 0) {
+    r = -1;
+    saved = errno;
+  }
+  free(block);
+  errno = saved;
+  return r;
+}
+
+/* Write the snapshot to @p fd in the job's format. */
+static int editorWriteFile(int fd, struct saveJob *job) {
+  if (job->compress != COMPRESS_NONE) {
+    return editorWriteCompressed(fd, job);
+  }
+  job->written = (long long)job->len;
+  return editorWriteRows(fd, job);
+}
+
+/* Flush @p fd according to @p sync. Returns 0 on success, or -1. */
+static int editorSyncFile(int fd, int sync) {
+  switch (sync) {
+  case SAVE_SYNC_DATA:
+    return fdatasync(fd);
+  case SAVE_SYNC_FULL:
+    return fsync(fd);
+  default:
+    return 0;
+  }
+}
+
+/* Make a rename inside @p dir durable; only done for SAVE_SYNC_FULL. */
+static int editorSyncDir(const char *dir, int sync) {
+  if (sync != SAVE_SYNC_FULL) {
+    return 0;
+  }
+  int fd = open(dir, O_RDONLY | O_DIRECTORY);
+  if (fd == -1) {
+    return -1;
+  }
+  int r = fsync(fd);
+  close(fd);
+  return r;
+}
+
+/*
+ * Write the snapshot to a temporary file next to the target and rename it
+ * into place, so a crash leaves either the old or the new contents and
+ * never a truncated file. The original's mode and, where permitted, its
+ * owner carry over. Returns 0 on success, or -1 with errno set; errno is
+ * EACCES or EROFS if the directory cannot take a new file.
+ */
+static int editorSaveAtomic(struct saveJob *job) {
+  const char *path = job->path;
+  char *dir = strdup(path);
+  char *slash = strrchr(dir, '/');
+  const char *base = slash ? slash + 1 : path;
+  if (slash == NULL) {
+    strcpy(dir, ".");
+  } else if (slash == dir) {
+    dir[1] = '\0';
+  } else {
+    *slash = '\0';
+  }
+  size_t tmplen = strlen(dir) + strlen(base) + 16;
+  char *tmp = malloc(tmplen);
+  snprintf(tmp, tmplen, "%s/.%s.ze-XXXXXX", dir, base);
+
+  int fd = mkstemp(tmp);
+  if (fd == -1) {
+    free(tmp);
+    free(dir);
+    return -1;
+  }
+  struct stat st;
+  if (stat(path, &st) == 0) {
+    if (fchown(fd, st.st_uid, st.st_gid) == -1) {
+      /* Not the owner: the file becomes ours, but keep its mode. */
+    }
+    fchmod(fd, st.st_mode & 07777);
+  } else {
+    mode_t mask = umask(0);
+    umask(mask);
+    fchmod(fd, 0666 & ~mask);
+  }
+  /* Reserve the blocks up front so the writes below only copy data. */
+  if (job->compress == COMPRESS_NONE && job->len > 0 &&
+      fallocate(fd, 0, 0, job->len) == -1) {
+    /* Not every filesystem supports it; writing still works. */
+  }
+  int ok = editorWriteFile(fd, job) == 0 && editorSyncFile(fd, job->sync) == 0;
+  int saved = errno;
+  if (close(fd) == -1 && ok) {
+    ok = 0;
+    saved = errno;
+  }
+  if (ok && rename(tmp, path) == -1) {
+    ok = 0;
+    saved = errno;
+  }
+  if (ok) {
+    editorSyncDir(dir, job->sync);
+  } else {
+    unlink(tmp);
+  }
+  free(tmp);
+  free(dir);
+  errno = saved;
+  return ok ? 0 : -1;
+}
+
+/*
+ * Overwrite the target in place. Used only when its directory does not
+ * allow creating the temporary file that editorSaveAtomic() needs.
+ */
+static int editorSaveInPlace(struct saveJob *job) {
+  int fd = open(job->path, O_RDWR | O_CREAT, 0644);
+  if (fd == -1) {
+    return -1;
+  }
+  if (editorWriteFile(fd, job) == -1 || ftruncate(fd, (off_t)job->written) == -1 ||
+      editorSyncFile(fd, job->sync) == -1) {
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return -1;
+  }
+  return close(fd);
+}
+
+/* Writer thread: save the snapshot and record how it went. */
+static void *editorSaveThread(void *arg) {
+  struct saveJob *job = arg;
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  int r = editorSaveAtomic(job);
+  if (r == -1 && (errno == EACCES || errno == EROFS || errno == EPERM)) {
+    r = editorSaveInPlace(job);
+  }
+  job->err = r == 0 ? 0 : errno;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  job->ms = (t1.tv_sec - t0.tv_sec) * 1000 + (t1.tv_nsec - t0.tv_nsec) / 1000000;
+  job->done = 1;
+  return NULL;
+}
+
+/*
+ * Collect a finished save: release the snapshot, report the outcome, and
+ * clear the dirty count the save covered. Must only be called once the
+ * writer has set @c done or is about to.
+ */
+static void editorSaveFinish(void) {
+  struct saveJob *job = saving;
+  if (job->threaded) {
+    pthread_join(job->thread, NULL);
+  }
+  saving = NULL;
+  editorRowsRelease();
+  if (job->err == 0) {
+    /* Edits made while saving still count; a newly opened file is left alone. */
+    if (job->gen == buffer_gen) {
+      E.dirty = E.dirty > job->dirty ? E.dirty - job->dirty : 0;
+      E.filesize = (off_t)job->written;
+      journalRebase(job->mark, job->path);
+      followRestart();
+    }
+    if (job->compress != COMPRESS_NONE) {
+      editorSetStatusMessage("%lld bytes written to disk as %lld bytes of %s in %ld ms",
+                             (long long)job->len, job->written,
+                             compressName(job->compress), job->ms);
+    } else {
+      editorSetStatusMessage("%lld bytes written to disk in %ld ms",
+                             (long long)job->len, job->ms);
+    }
+    editorPostSaveHook();
+  } else if (job->err == EINVAL && job->compress != COMPRESS_NONE) {
+    editorSetStatusMessage("Can't save! %s compression failed to start at level %d",
+                           compressName(job->compress), job->level);
+  } else {
+    editorSetStatusMessage("Can't save! I/O error: %s", strerror(job->err));
+  }
+  free(job->lines);
+  free(job->path);
+  free(job);
+}
+
+/*
+ * Idle task: finish the save once the writer is done. Waits while the search
+ * prompt is open, since the post-save hooks may edit rows its workers read.
+ */
+static int editorSaveIdle(void *data) {
+  (void)data;
+  if (saving == NULL || !saving->done || editorSearchActive()) {
+    return 0;
+  }
+  editorIdleRemove(editorSaveIdle, NULL);
+  editorSaveFinish();
+  return IDLE_REDRAW;
+}
+
+/**
+ * @brief Block until a background save, if any, has finished.
+ * @ingroup fileio
+ *
+ * Reports the result and runs the post-save hook just as if the save had
+ * completed while idle. Used before quitting and by save-file!.
+ */
+void editorSaveWait(void) {
+  if (saving != NULL) {
+    editorIdleRemove(editorSaveIdle, NULL);
+    editorSaveFinish();
+  }
+}
+
+/**
+ * @brief Whether a background save has not been finished yet.
+ * @ingroup fileio
+ *
+ * While it runs the file on disk may be half written or about to be
+ * replaced.
+ */
+int editorSaveRunning(void) {
+  return saving != NULL;
 }
 
 void editorSave(void) {
@@ -188,25 +667,47 @@ void editorSave(void) {
     }
     editorSelectSyntaxHighlight();
   }
+  if (pagerActive()) {
+    editorSetStatusMessage("Can't save: the pager shows only part of the file");
+    return;
+  }
+  editorSaveWait();
   editorPreSaveHook();
-  int len;
-  char *buf = editorRowsToString(&len);
-  int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
-  if (fd != -1) {
-    if (ftruncate(fd, len) != -1) {
-      if (write(fd, buf, len) == len) {
-        close(fd);
-        free(buf);
-        E.dirty = 0;
-        editorSetStatusMessage("%d bytes written to disk", len);
-        editorPostSaveHook();
-        return;
-      }
-    }
-    close(fd);
+
+  struct saveJob *job = calloc(1, sizeof(struct saveJob));
+  /* Save through a symlink to its target rather than replacing the link. */
+  job->path = realpath(E.filename, NULL);
+  if (job->path == NULL) {
+    job->path = strdup(E.filename);
   }
-  free(buf);
-  editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+  job->lines = malloc(sizeof(struct saveLine) * (E.numrows ? E.numrows : 1));
+  job->nlines = E.numrows;
+  /* Mixed files keep their '\r's in the rows; only CRLF files add them. */
+  job->eol = E.eol == EOL_CRLF ? "\r\n" : "\n";
+  job->eollen = strlen(job->eol);
+  job->bom = E.bom;
+  job->noeol = E.noeol && E.numrows > 0;
+  for (int j = 0; j < E.numrows; j++) {
+    job->lines[j].chars = E.row[j].chars;
+    job->lines[j].size = E.row[j].size;
+    job->len += E.row[j].size + job->eollen;
+  }
+  editorRowsShare();
+  job->len += (job->bom ? TEXT_BOM_LEN : 0) - (job->noeol ? (off_t)job->eollen : 0);
+  job->sync = E.savesync;
+  job->compress = E.compress != COMPRESS_NONE ? E.compress : compressForName(job->path);
+  job->level = E.compresslevel;
+  job->dirty = E.dirty;
+  job->gen = buffer_gen;
+  job->mark = journalMark();
+  saving = job;
+  job->threaded = pthread_create(&job->thread, NULL, editorSaveThread, job) == 0;
+  if (!job->threaded) {
+    /* No thread to spare: write from here instead. */
+    editorSaveThread(job);
+    editorSaveFinish();
+    return;
+  }
+  editorIdleAdd(editorSaveIdle, NULL);
+  editorSetStatusMessage("Saving %lld bytes...", (long long)job->len);
 }
-
-
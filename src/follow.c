@@ -0,0 +1,336 @@
+/**
+ * @file follow.c
+ * @brief Follow mode implementation.
+ * @ingroup follow
+ *
+ * Like `tail -F`: the open file is kept open and, when it grows, only the
+ * bytes past the end already in the buffer are read and added as rows, so
+ * each update costs as much as what was appended. A file that shrinks
+ * (truncated in place) or whose name now points at a different file
+ * (rotated) is reloaded from the start.
+ *
+ * On Linux an inotify watch says when to look; elsewhere the file is
+ * checked with fstat() on every idle tick.
+ */
+#include "ze.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "compress.h"
+#include "dirview.h"
+#include "fileio.h"
+#include "idle.h"
+#include "journal.h"
+#include "pager.h"
+#include "row.h"
+#include "search.h"
+#include "status.h"
+#include "textscan.h"
+#include "follow.h"
+
+extern struct editorConfig E;
+
+/** Most bytes read from the file in one idle slice. */
+#define FOLLOW_SLICE (4 * 1024 * 1024)
+/** Bytes read per pread() call. */
+#define FOLLOW_BLOCK (64 * 1024)
+
+static struct {
+  char *path;      /* File followed; NULL when follow mode is off. */
+  int fd;          /* The file as opened, kept across renames. */
+  off_t offset;    /* Bytes of the file already in the buffer. */
+  int partial;     /* The last row has no newline in the file yet. */
+  int pin;         /* Keep the cursor on the last row while it is there. */
+  int moved;       /* The file was renamed or unlinked; watch its name. */
+  int check;       /* Look at the file on the next tick regardless. */
+  int ifd;         /* inotify instance, or -1 to check on every tick. */
+} F = { NULL, -1, 0, 0, 0, 0, 0, -1 };
+
+/*
+ * Add @p len bytes read from the file to the end of the buffer. Text up to
+ * the first newline finishes the last row if it was left partial. As when
+ * loading, the '\r' of a line is only left out of a CRLF file's rows.
+ */
+static void followAppend(const char *s, size_t len) {
+  const char *end = s + len;
+  int crlf = E.eol == EOL_CRLF;
+  while (s < end) {
+    const char *nl = memchr(s, '\n', (size_t)(end - s));
+    size_t n = (size_t)((nl ? nl : end) - s);
+    if (F.partial && E.numrows > 0) {
+      erow *row = &E.row[E.numrows - 1];
+      editorRowAppendString(row, (char *)s, n);
+      if (crlf && nl && row->size > 0 && row->chars[row->size - 1] == '\r') {
+        editorRowDelChar(row, row->size - 1);
+      }
+    } else {
+      size_t line = n;
+      if (crlf && nl && line > 0 && s[line - 1] == '\r') {
+        line--;
+      }
+      editorInsertRow(E.numrows, (char *)s, line);
+    }
+    F.partial = nl == NULL;
+    s += n + (nl ? 1 : 0);
+  }
+}
+
+/*
+ * Read from F.offset up to @p size, at most FOLLOW_SLICE bytes. Returns 1
+ * if more remains, 0 when caught up, or -1 on a read error.
+ */
+static int followTail(off_t size) {
+  static char buf[FOLLOW_BLOCK];
+  int atend = E.numrows == 0 || E.cy >= E.numrows - 1;
+  int dirty = E.dirty;
+  off_t limit = F.offset + FOLLOW_SLICE < size ? F.offset + FOLLOW_SLICE : size;
+  int r = 0;
+
+  journalSuspend();
+  while (F.offset < limit) {
+    size_t want = limit - F.offset < FOLLOW_BLOCK ? (size_t)(limit - F.offset) : FOLLOW_BLOCK;
+    ssize_t n = pread(F.fd, buf, want, F.offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      r = n < 0 ? -1 : 0;
+      break;
+    }
+    followAppend(buf, (size_t)n);
+    F.offset += n;
+  }
+  E.filesize = F.offset;
+  E.noeol = F.partial && E.numrows > 0;
+  journalResume(E.filename);
+  E.dirty = dirty;
+
+  if (F.pin && atend && E.numrows > 0) {
+    E.cy = E.numrows - 1;
+    E.cx = 0;
+  }
+  if (r == 0 && F.offset < size) {
+    r = 1;
+  }
+  return r;
+}
+
+/*
+ * Read the file again from the start after it was truncated or replaced.
+ * Unsaved edits are not thrown away: follow mode stops instead.
+ */
+static int followReload(const char *why) {
+  if (E.dirty) {
+    editorSetStatusMessage("%s was %s; follow stopped to keep unsaved changes", F.path, why);
+    followStop();
+    return IDLE_REDRAW;
+  }
+  int pin = F.pin;
+  int atend = E.numrows == 0 || E.cy >= E.numrows - 1;
+  char *path = strdup(F.path);
+  for (int i = 0; i < E.numrows; i++) {
+    editorFreeRow(&E.row[i]);
+  }
+  free(E.row);
+  E.row = NULL;
+  E.numrows = 0;
+  editorOpen(path);
+  if (E.cy > E.numrows || (pin && atend)) {
+    E.cy = E.numrows > 0 ? E.numrows - 1 : 0;
+  }
+  E.cx = 0;
+  if (followStart(pin)) {
+    editorSetStatusMessage("%s was %s; reloaded", path, why);
+  }
+  free(path);
+  return IDLE_REDRAW;
+}
+
+#ifdef __linux__
+/* Drain the inotify queue. Returns 1 if anything happened to the file. */
+static int followEvents(void) {
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  int changed = 0;
+  ssize_t n;
+  while ((n = read(F.ifd, buf, sizeof(buf))) > 0) {
+    for (char *p = buf; p < buf + n;) {
+      struct inotify_event *ev = (struct inotify_event *)p;
+      if (ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED)) {
+        F.moved = 1;
+      }
+      changed = 1;
+      p += sizeof(struct inotify_event) + ev->len;
+    }
+  }
+  return changed;
+}
+#endif
+
+/*
+ * Idle task: append what was written to the file since the last look, or
+ * reload it if it shrank or its name now belongs to another file.
+ */
+static int followIdle(void *data) {
+  (void)data;
+  if (F.path == NULL) {
+    return 0;
+  }
+  /* Rows stay put while search threads read them or a save replaces the file. */
+  if (editorSearchActive() || editorSaveRunning()) {
+    return 0;
+  }
+  int look = F.check || F.moved || F.ifd == -1;
+#ifdef __linux__
+  if (F.ifd != -1 && followEvents()) {
+    look = 1;
+  }
+#endif
+  if (!look) {
+    return 0;
+  }
+  F.check = 0;
+
+  struct stat st;
+  if (fstat(F.fd, &st) == -1) {
+    return 0;
+  }
+  if (st.st_size < F.offset) {
+    return followReload("truncated");
+  }
+  int flags = 0;
+  if (st.st_size > F.offset) {
+    int r = followTail(st.st_size);
+    if (r < 0) {
+      editorSetStatusMessage("Error reading %s: %s", F.path, strerror(errno));
+    } else if (r > 0) {
+      F.check = 1;
+      flags |= IDLE_MORE;
+    }
+    flags |= IDLE_REDRAW;
+  }
+  /* Once the old file is drained, switch to whatever took over its name. */
+  if (!(flags & IDLE_MORE) && (F.moved || F.ifd == -1)) {
+    struct stat now;
+    if (stat(F.path, &now) == 0 && (now.st_ino != st.st_ino || now.st_dev != st.st_dev)) {
+      return followReload("replaced");
+    }
+  }
+  return flags;
+}
+
+/* Open F.path and watch it, starting from the E.filesize bytes loaded. */
+static int followOpen(void) {
+  F.fd = open(F.path, O_RDONLY);
+  if (F.fd == -1) {
+    return -1;
+  }
+  F.offset = E.filesize;
+  F.moved = 0;
+  F.check = 1;
+  char last;
+  F.partial = F.offset > 0 && pread(F.fd, &last, 1, F.offset - 1) == 1 && last != '\n';
+#ifdef __linux__
+  F.ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (F.ifd != -1 &&
+      inotify_add_watch(F.ifd, F.path, IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF) == -1) {
+    close(F.ifd);
+    F.ifd = -1;
+  }
+#endif
+  return 0;
+}
+
+static void followShut(void) {
+  if (F.fd != -1) {
+    close(F.fd);
+    F.fd = -1;
+  }
+  if (F.ifd != -1) {
+    close(F.ifd);
+    F.ifd = -1;
+  }
+}
+
+/**
+ * @brief Start following the open file.
+ * @ingroup follow
+ *
+ * Lines appended to the file from now on are added to the end of the
+ * buffer without marking it modified, including any written since it was
+ * opened. Only plain files can be followed.
+ *
+ * @param[in] pin Nonzero to keep the cursor, and so the view, on the last
+ *                line while the cursor is there.
+ * @return 1 if the file is being followed, else 0 with a status message.
+ * @sa followStop()
+ */
+int followStart(int pin) {
+  followStop();
+  if (E.filename == NULL || dirviewActive() || pagerActive()) {
+    editorSetStatusMessage("Follow mode needs a file");
+    return 0;
+  }
+  if (E.compress != COMPRESS_NONE) {
+    editorSetStatusMessage("Can't follow a %s file", compressName(E.compress));
+    return 0;
+  }
+  F.path = strdup(E.filename);
+  F.pin = pin;
+  if (followOpen() == -1) {
+    editorSetStatusMessage("Can't follow %s: %s", F.path, strerror(errno));
+    free(F.path);
+    F.path = NULL;
+    return 0;
+  }
+  editorIdleAdd(followIdle, NULL);
+  editorSetStatusMessage("Following %s", F.path);
+  return 1;
+}
+
+/**
+ * @brief Stop following the open file.
+ * @ingroup follow
+ */
+void followStop(void) {
+  if (F.path == NULL) {
+    return;
+  }
+  editorIdleRemove(followIdle, NULL);
+  followShut();
+  free(F.path);
+  F.path = NULL;
+}
+
+/**
+ * @brief Pick the file up again after the buffer was saved over it.
+ * @ingroup follow
+ *
+ * A save may replace the file with a new one; following carries on from
+ * the end of what was written rather than treating that as a rotation.
+ */
+void followRestart(void) {
+  if (F.path == NULL) {
+    return;
+  }
+  followShut();
+  if (followOpen() == -1) {
+    editorSetStatusMessage("Can't follow %s: %s", F.path, strerror(errno));
+    followStop();
+  }
+}
+
+/**
+ * @brief Whether follow mode is on.
+ * @ingroup follow
+ */
+int followActive(void) {
+  return F.path != NULL;
+}
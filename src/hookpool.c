@@ -0,0 +1,292 @@
+/**
+ * @file hookpool.c
+ * @brief Async hook worker pool implementation.
+ * @ingroup hookpool
+ *
+ * Hooks added with @c add-async-hook! do not run on the main thread. Each
+ * call is queued with a snapshot of the buffer (see pluginsBufferSnapshot())
+ * and picked up by one of a few Guile threads. What the hook returns is
+ * converted to C on that thread and handed back to the main loop, which
+ * applies it from an idle task: status text is shown, and line edits are
+ * applied only if the buffer has not changed since the snapshot was taken.
+ */
+#include "ze.h"
+
+#include <libguile.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dirview.h"
+#include "fileio.h"
+#include "idle.h"
+#include "pager.h"
+#include "plugins.h"
+#include "profile.h"
+#include "row.h"
+#include "search.h"
+#include "status.h"
+#include "hookpool.h"
+
+extern struct editorConfig E;
+
+/** A line replacement returned by an async hook. */
+struct hookEdit {
+  int line;
+  char *text;
+  size_t len;
+};
+
+/** One async hook call, from being queued until its result is applied. */
+struct hookJob {
+  const char *where;        /* Event name, for the profiler. */
+  SCM proc;
+  SCM args[3];              /* Snapshot handle, then the event's arguments. */
+  int nargs;
+  unsigned long long gen;   /* E.gen when the snapshot was taken. */
+  char *status;             /* First string the hook returned, or NULL. */
+  struct hookEdit *edits;
+  int nedits;
+  struct hookJob *next;
+};
+
+/** Jobs waiting for a worker and jobs waiting for the main loop. */
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  struct hookJob *queued, *queuedtail;
+  struct hookJob *done, *donetail;
+  int workers;              /* Threads running, or -1 if none could start. */
+} P = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, NULL, NULL, 0};
+
+/* Append @p job to the list @p head / @p tail. Caller holds P.lock. */
+static void hookPoolPush(struct hookJob **head, struct hookJob **tail, struct hookJob *job) {
+  job->next = NULL;
+  if (*tail) {
+    (*tail)->next = job;
+  } else {
+    *head = job;
+  }
+  *tail = job;
+}
+
+static void hookPoolFreeEdits(struct hookJob *job) {
+  for (int i = 0; i < job->nedits; i++) {
+    free(job->edits[i].text);
+  }
+  free(job->edits);
+  job->edits = NULL;
+  job->nedits = 0;
+}
+
+/* Record one item of a hook's result: a status string or a (line . text) edit. */
+static void hookPoolKeep(struct hookJob *job, SCM item) {
+  if (scm_is_string(item)) {
+    if (job->status == NULL) {
+      job->status = scm_to_locale_string(item);
+    }
+    return;
+  }
+  if (scm_is_pair(item) && scm_is_integer(scm_car(item)) && scm_is_string(scm_cdr(item))) {
+    job->edits = realloc(job->edits, sizeof(*job->edits) * (job->nedits + 1));
+    struct hookEdit *e = &job->edits[job->nedits];
+    e->line = scm_to_int(scm_car(item));
+    e->text = scm_to_locale_stringn(scm_cdr(item), &e->len);
+    job->nedits++;
+  }
+}
+
+/* Catch body: call the hook and convert what it returns. */
+static SCM hookPoolCall(void *data) {
+  struct hookJob *job = data;
+  SCM r;
+  if (job->nargs == 1) {
+    r = scm_call_1(job->proc, job->args[0]);
+  } else if (job->nargs == 2) {
+    r = scm_call_2(job->proc, job->args[0], job->args[1]);
+  } else {
+    r = scm_call_3(job->proc, job->args[0], job->args[1], job->args[2]);
+  }
+  if (scm_is_pair(r) && scm_is_integer(scm_car(r))) {
+    hookPoolKeep(job, r);
+  } else {
+    for (; scm_is_pair(r); r = scm_cdr(r)) {
+      hookPoolKeep(job, scm_car(r));
+    }
+    hookPoolKeep(job, r);
+  }
+  return SCM_UNSPECIFIED;
+}
+
+/* Catch handler: report the error instead of half a result. */
+static SCM hookPoolError(void *data, SCM key, SCM args) {
+  struct hookJob *job = data;
+  (void)args;
+  char *name = scm_is_symbol(key) ? scm_to_locale_string(scm_symbol_to_string(key)) : NULL;
+  char msg[100];
+  snprintf(msg, sizeof(msg), "Async hook failed: %s", name ? name : "error");
+  free(name);
+  hookPoolFreeEdits(job);
+  free(job->status);
+  job->status = strdup(msg);
+  return SCM_BOOL_F;
+}
+
+/* Run @p job's hook and let go of the Scheme objects it held, except the
+ * snapshot, which only the main thread may release. */
+static void hookPoolRun(struct hookJob *job) {
+  struct profileMark m;
+  profileBegin(&m);
+  scm_c_catch(SCM_BOOL_T, hookPoolCall, job, hookPoolError, job, NULL, NULL);
+  profileEnd(&m, job->where, job->proc);
+  scm_gc_unprotect_object(job->proc);
+  for (int i = 1; i < job->nargs; i++) {
+    scm_gc_unprotect_object(job->args[i]);
+  }
+}
+
+/* Show or apply a finished job's result on the main thread, then free it. */
+static void hookPoolApply(struct hookJob *job) {
+  pluginsSnapshotRelease(job->args[0]);
+  scm_gc_unprotect_object(job->args[0]);
+  if (job->nedits > 0 && (job->gen != E.gen || pagerActive() || dirviewActive())) {
+    editorSetStatusMessage("Async hook edits dropped: the buffer changed");
+  } else {
+    for (int i = 0; i < job->nedits; i++) {
+      struct hookEdit *e = &job->edits[i];
+      if (e->line < 0 || e->line >= E.numrows) {
+        continue;
+      }
+      erow *row = &E.row[e->line];
+      if ((size_t)row->size != e->len || memcmp(row->chars, e->text, e->len) != 0) {
+        editorRowSetText(row, e->text, e->len);
+      }
+    }
+    if (job->status) {
+      editorSetStatusMessage("%s", job->status);
+    }
+  }
+  hookPoolFreeEdits(job);
+  free(job->status);
+  free(job);
+}
+
+/* Without Guile: block until a job is queued and take it. */
+static void *hookPoolWait(void *data) {
+  (void)data;
+  pthread_mutex_lock(&P.lock);
+  while (P.queued == NULL) {
+    pthread_cond_wait(&P.ready, &P.lock);
+  }
+  struct hookJob *job = P.queued;
+  P.queued = job->next;
+  if (P.queued == NULL) {
+    P.queuedtail = NULL;
+  }
+  pthread_mutex_unlock(&P.lock);
+  return job;
+}
+
+/* Worker loop, in Guile mode except while waiting. */
+static void *hookPoolWork(void *data) {
+  (void)data;
+  for (;;) {
+    struct hookJob *job = scm_without_guile(hookPoolWait, NULL);
+    hookPoolRun(job);
+    pthread_mutex_lock(&P.lock);
+    hookPoolPush(&P.done, &P.donetail, job);
+    pthread_mutex_unlock(&P.lock);
+  }
+  return NULL;
+}
+
+static void *hookPoolThread(void *data) {
+  return scm_with_guile(hookPoolWork, data);
+}
+
+/*
+ * Idle task: apply results the workers have finished. Waits while the
+ * search prompt is open or a save is being written, since edits would
+ * change rows their threads read.
+ */
+static int hookPoolCollect(void *data) {
+  (void)data;
+  if (editorSearchActive() || editorSaveRunning()) {
+    return 0;
+  }
+  pthread_mutex_lock(&P.lock);
+  struct hookJob *job = P.done;
+  P.done = P.donetail = NULL;
+  pthread_mutex_unlock(&P.lock);
+  if (job == NULL) {
+    return 0;
+  }
+  while (job) {
+    struct hookJob *next = job->next;
+    hookPoolApply(job);
+    job = next;
+  }
+  return IDLE_REDRAW;
+}
+
+/* Start the workers; with none, async hooks run where they are queued. */
+static void hookPoolStart(void) {
+  for (int i = 0; i < HOOK_POOL_THREADS; i++) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, hookPoolThread, NULL) == 0) {
+      pthread_detach(thread);
+      P.workers++;
+    }
+  }
+  if (P.workers == 0) {
+    P.workers = -1;
+    editorSetStatusMessage("No threads for async hooks; running them in line");
+    return;
+  }
+  editorIdleAdd(hookPoolCollect, NULL);
+}
+
+/**
+ * @brief Queue a call of an async hook.
+ * @ingroup hookpool
+ *
+ * @p proc is called on a worker thread as (proc snap [a [b]]). The first
+ * call starts the workers. The result is applied from an idle task on the
+ * main thread; edits are dropped if @c E.gen has moved on by then.
+ *
+ * @param[in] where Event name, a string that outlives the job.
+ * @param[in] proc Hook procedure.
+ * @param[in] snap Handle from pluginsBufferSnapshot(); a reference is taken.
+ * @param[in] argc Number of further arguments, 0 to 2.
+ * @param[in] a First further argument.
+ * @param[in] b Second further argument.
+ * @sa hooksAdd(), pluginsBufferSnapshot()
+ */
+void hookPoolSubmit(const char *where, SCM proc, SCM snap, int argc, SCM a, SCM b) {
+  if (P.workers == 0) {
+    hookPoolStart();
+  }
+  struct hookJob *job = calloc(1, sizeof(*job));
+  job->where = where;
+  job->proc = scm_gc_protect_object(proc);
+  pluginsSnapshotRetain(snap);
+  job->args[0] = scm_gc_protect_object(snap);
+  if (argc >= 1) {
+    job->args[1] = scm_gc_protect_object(a);
+  }
+  if (argc >= 2) {
+    job->args[2] = scm_gc_protect_object(b);
+  }
+  job->nargs = argc + 1;
+  job->gen = E.gen;
+  if (P.workers < 0) {
+    hookPoolRun(job);
+    hookPoolApply(job);
+    return;
+  }
+  pthread_mutex_lock(&P.lock);
+  hookPoolPush(&P.queued, &P.queuedtail, job);
+  pthread_cond_signal(&P.ready);
+  pthread_mutex_unlock(&P.lock);
+}
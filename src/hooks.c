@@ -3,143 +3,459 @@
  * @brief Scheme hook invocation implementations.
  * @ingroup hooks
  */
+#include "ze.h"
+
 #include <libguile.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
-#include "ze.h"
 #include "status.h"
 #include "fileio.h"
+#include "plugins.h"
+#include "idle.h"
+#include "hooks.h"
+#include "hookpool.h"
+#include "profile.h"
+#include "search.h"
 
 extern struct editorConfig E;
 
+/** A procedure subscribed to one event. */
+struct hookEntry {
+  SCM proc;      /**< Procedure, or for a legacy global the variable holding it. */
+  int legacy;    /**< Nonzero when @c proc is a variable to dereference. */
+  int priority;  /**< Higher runs first; ties run in the order added. */
+  int async;     /**< Run on a worker thread against a snapshot; see hookpool.c. */
+  int removed;   /**< Set by remove-hook! while a dispatch may still see it. */
+};
+
+/** Subscribers to one event, in the order they run. */
+struct hookList {
+  struct hookEntry **v;
+  int n;
+};
+
+/* Event names as plugins spell them, and the global each used to be. */
+static const char *hook_names[HOOK_EVENTS] = {
+  "pre-dir-open", "post-dir-open", "pre-file-open", "post-file-open",
+  "pre-save", "post-save", "pre-edit", "post-edit", "buffer-switch", "idle",
+};
+static const char *hook_globals[HOOK_EVENTS] = {
+  "preDirOpenHook", "postDirOpenHook", "preFileOpenHook", "postFileOpenHook",
+  "preSaveHook", "postSaveHook", NULL, NULL, NULL, NULL,
+};
+
+/* Events whose only argument is the buffer handle. */
+static const int hook_buffer[HOOK_EVENTS] = {
+  0, 0, 0, 1, 1, 1, 0, 0, 0, 0,
+};
+
+static struct hookList hooks[HOOK_EVENTS];
+
+/* Entries removed while a dispatch was running, freed once none is. */
+static struct hookEntry **hook_dead = NULL;
+static int hook_ndead = 0;
+static int hook_depth = 0;
+
+static long long idle_since = 0;
+static int idle_done = 0;
+
+/* Show a hook's returned string in the status bar. */
+static void hookShow(SCM results_scm) {
+  char *results = scm_to_locale_string(results_scm);
+  editorSetStatusMessage("%s", results);
+  free(results);
+}
+
+/* Free entries that were removed mid-dispatch. */
+static void hooksReap(void) {
+  for (int i = 0; i < hook_ndead; i++) {
+    scm_gc_unprotect_object(hook_dead[i]->proc);
+    free(hook_dead[i]);
+  }
+  free(hook_dead);
+  hook_dead = NULL;
+  hook_ndead = 0;
+}
+
+/* A dispatch in progress: the subscribers it runs, whatever they change. */
+struct hookRun {
+  struct hookEntry *local[8];
+  struct hookEntry **v;
+  SCM snap;  /* Snapshot shared by the async hooks, or #f before one runs. */
+};
+
+/* Unwind handler: also runs when a hook throws out of the dispatch. */
+static void hooksRunDone(void *data) {
+  struct hookRun *run = data;
+  if (run->v != run->local) {
+    free(run->v);
+  }
+  if (scm_is_true(run->snap)) {
+    pluginsSnapshotRelease(run->snap);
+  }
+  if (--hook_depth == 0 && hook_ndead > 0) {
+    hooksReap();
+  }
+}
+
+/*
+ * Call every subscriber to @p event with @p argc (0 to 2) arguments. The
+ * first string returned goes to the status bar; other results are ignored.
+ * The list is copied first so a hook may add or remove hooks, itself
+ * included, without disturbing this dispatch. Async hooks are queued
+ * instead, with one snapshot of the buffer shared between them.
+ */
+static void hooksRun(int event, int argc, SCM a, SCM b) {
+  struct hookList *l = &hooks[event];
+  struct hookRun run;
+  int n = l->n;
+  int shown = 0;
+  run.v = n <= 8 ? run.local : malloc(sizeof(*run.v) * n);
+  run.snap = SCM_BOOL_F;
+  memcpy(run.v, l->v, sizeof(*run.v) * n);
+  hook_depth++;
+  scm_dynwind_begin(0);
+  scm_dynwind_unwind_handler(hooksRunDone, &run, SCM_F_WIND_EXPLICITLY);
+  for (int i = 0; i < n; i++) {
+    struct hookEntry *e = run.v[i];
+    if (e->removed) {
+      continue;
+    }
+    if (e->async) {
+      if (scm_is_false(run.snap)) {
+        run.snap = pluginsBufferSnapshot();
+      }
+      hookPoolSubmit(hook_names[event], e->proc, run.snap, hook_buffer[event] ? 0 : argc, a, b);
+      continue;
+    }
+    SCM proc = e->legacy ? scm_variable_ref(e->proc) : e->proc;
+    SCM r = profileCall(hook_names[event], proc, argc, a, b);
+    if (!shown && scm_is_string(r)) {
+      hookShow(r);
+      shown = 1;
+    }
+  }
+  scm_dynwind_end();
+}
+
+/* Unwind handler: retire the handle hooksRunWithBuffer() gave out. */
+static void hooksBufferDone(void *data) {
+  pluginsBufferRelease(*(SCM *)data);
+}
+
+/*
+ * Call the subscribers to @p event with a handle on the buffer (see
+ * pluginsBufferHandle()). The handle stops working when they return, or
+ * when one throws out of the dispatch, so a hook cannot keep reading a
+ * buffer that has since changed.
+ */
+static void hooksRunWithBuffer(int event) {
+  if (hooks[event].n == 0) {
+    return;
+  }
+  SCM buf = pluginsBufferHandle();
+  scm_dynwind_begin(0);
+  scm_dynwind_unwind_handler(hooksBufferDone, &buf, SCM_F_WIND_EXPLICITLY);
+  hooksRun(event, 1, buf, SCM_UNDEFINED);
+  scm_dynwind_end();
+}
+
+/* Milliseconds on the monotonic clock. */
+static long long hookNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Idle task: run the idle hooks once per pause in typing. A pause spent in
+ * the search prompt is skipped; its workers read rows a hook could edit.
+ */
+static int hookIdleTask(void *data) {
+  (void)data;
+  if (idle_done || hookNow() - idle_since < HOOK_IDLE_DELAY) {
+    return 0;
+  }
+  idle_done = 1;
+  if (editorSearchActive()) {
+    return 0;
+  }
+  hooksRun(HOOK_IDLE, 0, SCM_UNDEFINED, SCM_UNDEFINED);
+  return IDLE_REDRAW;
+}
+
+/**
+ * @brief Look up an event by its Scheme name.
+ * @ingroup hooks
+ *
+ * @param[in] name Event name, e.g. "post-save".
+ * @return An @c hookEvent value, or -1 if @p name is not an event.
+ */
+int hooksEventByName(const char *name) {
+  for (int i = 0; i < HOOK_EVENTS; i++) {
+    if (strcmp(name, hook_names[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/* Subscribe @p proc (a variable when @p legacy) to @p event. */
+static void hooksInsert(int event, SCM proc, int legacy, int priority, int async) {
+  struct hookList *l = &hooks[event];
+  struct hookEntry *e = malloc(sizeof(*e));
+  e->proc = scm_gc_protect_object(proc);
+  e->legacy = legacy;
+  e->priority = priority;
+  e->async = async;
+  e->removed = 0;
+  int at = l->n;
+  while (at > 0 && l->v[at - 1]->priority < priority) {
+    at--;
+  }
+  l->v = realloc(l->v, sizeof(*l->v) * (l->n + 1));
+  memmove(&l->v[at + 1], &l->v[at], sizeof(*l->v) * (l->n - at));
+  l->v[at] = e;
+  l->n++;
+  if (event == HOOK_IDLE && l->n == 1) {
+    idleHookReset();
+    editorIdleAdd(hookIdleTask, NULL);
+  }
+}
+
+/**
+ * @brief Subscribe a procedure to an event.
+ * @ingroup hooks
+ *
+ * Subscribers run from the highest @p priority down, and in the order they
+ * were added when priorities tie. Adding a procedure that is already
+ * subscribed only changes its priority and whether it is async.
+ *
+ * An async hook runs on a worker thread (see hookPoolSubmit()) and is
+ * called with a snapshot of the buffer first, followed by the event's
+ * other arguments; for events that pass the buffer, the snapshot replaces
+ * it.
+ *
+ * @param[in] event An @c hookEvent value.
+ * @param[in] proc Procedure taking the event's arguments.
+ * @param[in] priority Ordering among the event's subscribers; 0 by default.
+ * @param[in] async Nonzero to run @p proc off the main thread.
+ * @return 1 on success, 0 if @p event is out of range.
+ * @sa hooksRemove()
+ */
+int hooksAdd(int event, SCM proc, int priority, int async) {
+  if (event < 0 || event >= HOOK_EVENTS) {
+    return 0;
+  }
+  hooksRemove(event, proc);
+  hooksInsert(event, proc, 0, priority, async);
+  return 1;
+}
+
+/**
+ * @brief Unsubscribe a procedure from an event.
+ * @ingroup hooks
+ *
+ * Safe to call from inside a hook, including the one being removed.
+ *
+ * @param[in] event An @c hookEvent value.
+ * @param[in] proc Procedure given to hooksAdd().
+ * @return 1 if @p proc was subscribed, else 0.
+ */
+int hooksRemove(int event, SCM proc) {
+  if (event < 0 || event >= HOOK_EVENTS) {
+    return 0;
+  }
+  struct hookList *l = &hooks[event];
+  for (int i = 0; i < l->n; i++) {
+    struct hookEntry *e = l->v[i];
+    if (e->legacy || !scm_is_eq(e->proc, proc)) {
+      continue;
+    }
+    memmove(&l->v[i], &l->v[i + 1], sizeof(*l->v) * (l->n - i - 1));
+    l->n--;
+    if (hook_depth > 0) {
+      e->removed = 1;
+      hook_dead = realloc(hook_dead, sizeof(*hook_dead) * (hook_ndead + 1));
+      hook_dead[hook_ndead++] = e;
+    } else {
+      scm_gc_unprotect_object(e->proc);
+      free(e);
+    }
+    if (event == HOOK_IDLE && l->n == 0) {
+      editorIdleRemove(hookIdleTask, NULL);
+    }
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Subscribe the hook procedures zerc.scm defines by name.
+ * @ingroup hooks
+ *
+ * Each of @c preDirOpenHook, @c postDirOpenHook, @c preFileOpenHook,
+ * @c postFileOpenHook, @c preSaveHook, and @c postSaveHook that is defined
+ * when this runs is subscribed at priority 0, after any plugin added at the
+ * same priority. The variable is resolved once; redefining the procedure
+ * later still takes effect.
+ *
+ * @pre Called once, after zerc.scm and the plugins have loaded.
+ */
+void hooksInit(void) {
+  SCM module = scm_current_module();
+  for (int i = 0; i < HOOK_EVENTS; i++) {
+    if (hook_globals[i] == NULL) {
+      continue;
+    }
+    SCM var = scm_module_variable(module, scm_from_utf8_symbol(hook_globals[i]));
+    if (scm_is_true(var)) {
+      hooksInsert(i, var, 1, 0, 0);
+    }
+  }
+}
+
 /**
- * @brief Invoke the Scheme @c preDirOpenHook with the directory path.
+ * @brief Run the 'pre-dir-open hooks with the directory path.
  * @ingroup hooks
  *
- * Calls the Guile function @c preDirOpenHook with @c E.filename as a Scheme
- * string and displays its returned message in the status bar.
+ * Passes @c E.filename as a Scheme string; the first string returned is
+ * displayed in the status bar.
  *
- * @post Status message is updated via editorSetStatusMessage().
+ * @post Status message may be updated via editorSetStatusMessage().
  * @sa postDirOpenHook(), preFileOpenHook(), editorOpen()
  */
 void preDirOpenHook(void) {
-  SCM preDirOpenHook;
-  SCM results_scm;
-  char* results;
-  preDirOpenHook = scm_variable_ref(scm_c_lookup("preDirOpenHook"));
-  results_scm = scm_call_1(preDirOpenHook, scm_from_locale_string(E.filename));
-  results = scm_to_locale_string(results_scm);
-  editorSetStatusMessage(results);
+  if (hooks[HOOK_PRE_DIR_OPEN].n == 0) {
+    return;
+  }
+  hooksRun(HOOK_PRE_DIR_OPEN, 1, scm_from_locale_string(E.filename), SCM_UNDEFINED);
 }
 
 /**
- * @brief Invoke the Scheme @c postDirOpenHook with the file count.
+ * @brief Run the 'post-dir-open hooks with the file count.
  * @ingroup hooks
  *
- * Calls @c postDirOpenHook with the number of directory entries scanned and
- * displays its returned message.
- *
  * @param[in] num_files Number of entries returned by scandir(). Must be >= 0.
- * @post Status message is updated.
+ * @post Status message may be updated.
  * @sa preDirOpenHook(), editorOpen()
  */
 void postDirOpenHook(int num_files) {
-  SCM postDirOpenHook;
-  SCM results_scm;
-  char *results;
-  postDirOpenHook = scm_variable_ref(scm_c_lookup("postDirOpenHook"));
-  results_scm = scm_call_1(postDirOpenHook, scm_from_int(num_files));
-  results = scm_to_locale_string(results_scm);
-  editorSetStatusMessage(results);
+  if (hooks[HOOK_POST_DIR_OPEN].n == 0) {
+    return;
+  }
+  hooksRun(HOOK_POST_DIR_OPEN, 1, scm_from_int(num_files), SCM_UNDEFINED);
 }
 
 /**
- * @brief Invoke the Scheme @c preFileOpenHook with the filename.
+ * @brief Run the 'pre-file-open hooks with the filename.
  * @ingroup hooks
  *
- * Calls @c preFileOpenHook with @c E.filename and displays the returned
- * message.
- *
- * @post Status message is updated.
+ * @post Status message may be updated.
  * @sa postFileOpenHook(), editorOpen()
  */
 void preFileOpenHook(void) {
-  SCM preFileOpenHook;
-  SCM results_scm;
-  char *results;
-  preFileOpenHook = scm_variable_ref(scm_c_lookup("preFileOpenHook"));
-  results_scm = scm_call_1(preFileOpenHook, scm_from_locale_string(E.filename));
-  results = scm_to_locale_string(results_scm);
-  editorSetStatusMessage(results);
+  if (hooks[HOOK_PRE_FILE_OPEN].n == 0) {
+    return;
+  }
+  hooksRun(HOOK_PRE_FILE_OPEN, 1, scm_from_locale_string(E.filename), SCM_UNDEFINED);
 }
 
 /**
- * @brief Invoke the Scheme @c postFileOpenHook with current buffer contents.
+ * @brief Run the 'post-file-open hooks with a handle on the buffer.
  * @ingroup hooks
  *
- * Serializes the buffer with editorRowsToString() and passes it to
- * @c postFileOpenHook. The returned Scheme string is shown in the status bar.
- *
- * Ownership: the temporary buffer from editorRowsToString() is freed in Guile
- * after conversion; no NUL terminator is guaranteed—length is respected.
+ * Passes a buffer handle rather than a copy of the text: a hook asks for
+ * the length, line count, or text through @c buffer-length,
+ * @c buffer-line-count, and @c buffer-text, and only text it asks for is
+ * converted.
  *
- * @post Status message is updated.
- * @sa preFileOpenHook(), editorRowsToString(), editorOpen()
+ * @post Status message may be updated.
+ * @sa preFileOpenHook(), pluginsBufferHandle(), editorOpen()
  */
 void postFileOpenHook(void) {
-  SCM postFileOpenHook;
-  SCM results_scm;
-  char* results;
-  int len;
-  char *contents = editorRowsToString(&len);
-  postFileOpenHook = scm_variable_ref(scm_c_lookup("postFileOpenHook"));
-  results_scm = scm_call_1(postFileOpenHook, scm_from_locale_string(contents));
-  results = scm_to_locale_string(results_scm);
-  editorSetStatusMessage(results);
+  hooksRunWithBuffer(HOOK_POST_FILE_OPEN);
 }
 
 /**
- * @brief Invoke the Scheme @c preSaveHook with current buffer contents.
+ * @brief Run the 'pre-save hooks with a handle on the buffer.
  * @ingroup hooks
  *
- * Serializes the buffer and passes it to @c preSaveHook, displaying the
- * returned message.
- *
- * @post Status message is updated.
- * @sa editorRowsToString(), editorSave(), editorPostSaveHook()
+ * @post Status message may be updated.
+ * @sa pluginsBufferHandle(), editorSave(), editorPostSaveHook()
  */
 void editorPreSaveHook(void) {
-  SCM preSaveHook;
-  SCM results_scm;
-  char* results;
-  int len;
-  char *contents = editorRowsToString(&len);
-  preSaveHook = scm_variable_ref(scm_c_lookup("preSaveHook"));
-  results_scm = scm_call_1(preSaveHook, scm_from_locale_string(contents));
-  results = scm_to_locale_string(results_scm);
-  editorSetStatusMessage(results);
+  hooksRunWithBuffer(HOOK_PRE_SAVE);
 }
 
 /**
- * @brief Invoke the Scheme @c postSaveHook with current buffer contents.
+ * @brief Run the 'post-save hooks with a handle on the buffer.
  * @ingroup hooks
  *
- * Serializes the buffer and passes it to @c postSaveHook, displaying the
- * returned message.
- *
- * @post Status message is updated.
- * @sa editorRowsToString(), editorSave(), editorPreSaveHook()
+ * @post Status message may be updated.
+ * @sa pluginsBufferHandle(), editorSave(), editorPreSaveHook()
  */
 void editorPostSaveHook(void) {
-  SCM postSaveHook;
-  SCM results_scm;
-  char* results;
-  int len;
-  char *contents = editorRowsToString(&len);
-  postSaveHook = scm_variable_ref(scm_c_lookup("postSaveHook"));
-  results_scm = scm_call_1(postSaveHook, scm_from_locale_string(contents));
-  results = scm_to_locale_string(results_scm);
-  editorSetStatusMessage(results);
+  hooksRunWithBuffer(HOOK_POST_SAVE);
+}
+
+/**
+ * @brief Run the 'pre-edit hooks before an editing key is applied.
+ * @ingroup hooks
+ *
+ * Called for every such key, so with no subscribers it costs one test.
+ *
+ * @param[in] key Key code about to be applied.
+ * @sa postEditHook(), editorProcessKeypress()
+ */
+void preEditHook(int key) {
+  if (hooks[HOOK_PRE_EDIT].n == 0) {
+    return;
+  }
+  hooksRun(HOOK_PRE_EDIT, 2, scm_from_int(key), scm_from_int(E.cy));
+}
+
+/**
+ * @brief Run the 'post-edit hooks after an editing key was applied.
+ * @ingroup hooks
+ *
+ * @param[in] key Key code that was applied.
+ * @sa preEditHook(), editorProcessKeypress()
+ */
+void postEditHook(int key) {
+  if (hooks[HOOK_POST_EDIT].n == 0) {
+    return;
+  }
+  hooksRun(HOOK_POST_EDIT, 2, scm_from_int(key), scm_from_int(E.cy));
 }
 
+/**
+ * @brief Run the 'buffer-switch hooks with the name of what is now shown.
+ * @ingroup hooks
+ *
+ * @sa editorOpen()
+ */
+void bufferSwitchHook(void) {
+  if (hooks[HOOK_BUFFER_SWITCH].n == 0) {
+    return;
+  }
+  SCM name = E.filename ? scm_from_locale_string(E.filename) : SCM_BOOL_F;
+  hooksRun(HOOK_BUFFER_SWITCH, 1, name, SCM_UNDEFINED);
+}
 
+/**
+ * @brief Note a keypress so the 'idle hooks wait for the next pause.
+ * @ingroup hooks
+ *
+ * The idle hooks run once when no key has arrived for HOOK_IDLE_DELAY
+ * milliseconds, and not again until after the next keypress.
+ */
+void idleHookReset(void) {
+  if (hooks[HOOK_IDLE].n == 0) {
+    return;
+  }
+  idle_since = hookNow();
+  idle_done = 0;
+}
@@ -0,0 +1,100 @@
+/**
+ * @file idle.c
+ * @brief Idle task scheduling implementation.
+ * @ingroup idle
+ */
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "ze.h"
+#include "render.h"
+#include "idle.h"
+
+extern struct editorConfig E;
+
+/** A registered idle task and its argument. */
+struct idleEntry {
+  editorIdleTask task;
+  void *data;
+};
+
+static struct idleEntry *tasks = NULL;
+static int ntasks = 0;
+
+/**
+ * @brief Register a task to run while the editor is waiting for input.
+ * @ingroup idle
+ *
+ * The task runs once every time input is polled without a key arriving
+ * (about every 100ms), and back to back while it returns IDLE_MORE and no
+ * key is pending.
+ *
+ * @param[in] task Function to call.
+ * @param[in] data Passed to @p task unchanged.
+ * @sa editorIdleRemove(), editorReadKey()
+ */
+void editorIdleAdd(editorIdleTask task, void *data) {
+  tasks = realloc(tasks, sizeof(struct idleEntry) * (ntasks + 1));
+  tasks[ntasks].task = task;
+  tasks[ntasks].data = data;
+  ntasks++;
+}
+
+/**
+ * @brief Unregister a task added with editorIdleAdd().
+ * @ingroup idle
+ *
+ * Safe to call from inside a running task, including the task itself.
+ *
+ * @param[in] task Function that was registered.
+ * @param[in] data Argument it was registered with.
+ */
+void editorIdleRemove(editorIdleTask task, void *data) {
+  for (int i = 0; i < ntasks; i++) {
+    if (tasks[i].task == task && tasks[i].data == data) {
+      tasks[i].task = NULL;
+    }
+  }
+}
+
+/**
+ * @brief Run one slice of every registered task.
+ * @ingroup idle
+ *
+ * Redraws the screen if any task reported IDLE_REDRAW.
+ *
+ * @return IDLE_MORE if any task has more work queued, else 0.
+ */
+int editorIdleRun(void) {
+  int flags = 0;
+  for (int i = 0; i < ntasks; i++) {
+    if (tasks[i].task) {
+      flags |= tasks[i].task(tasks[i].data);
+    }
+  }
+  int n = 0;
+  for (int i = 0; i < ntasks; i++) {
+    if (tasks[i].task) {
+      tasks[n++] = tasks[i];
+    }
+  }
+  ntasks = n;
+  if (flags & IDLE_REDRAW) {
+    editorRefreshScreen();
+  }
+  return flags & IDLE_MORE;
+}
+
+/**
+ * @brief Check whether a keypress is waiting to be read.
+ * @ingroup idle
+ *
+ * Long-running work polls this to give up early when the user types.
+ *
+ * @return 1 if input is available on stdin, else 0.
+ */
+int editorInputPending(void) {
+  struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+  return poll(&pfd, 1, 0) > 0;
+}
@@ -14,9 +14,16 @@
 #include "render.h"
 #include "edit.h"
 #include "fileio.h"
+#include "journal.h"
+#include "dirview.h"
+#include "pager.h"
 #include "search.h"
+#include "statecache.h"
+#include "replace.h"
 #include "row.h"
 #include "plugins.h"
+#include "hooks.h"
+#include "utf8.h"
 
 extern struct editorConfig E;
 
@@ -75,8 +82,9 @@ char* editorPrompt(char *prompt, void (*callback)(char *, int)) {
  *
  * Updates @c E.cx and @c E.cy according to @p key. When moving left from the
  * beginning of a line, moves to the end of the previous line. When moving right
- * past the end of a line, moves to the start of the next line. Ensures @c E.cx
- * is not beyond the line length.
+ * past the end of a line, moves to the start of the next line. Steps over whole
+ * UTF-8 sequences and ensures @c E.cx is not beyond the line length or inside
+ * a multi-byte character.
  *
  * @param[in] key One of ARROW_LEFT, ARROW_RIGHT, ARROW_UP, ARROW_DOWN.
  * @post Cursor position is updated; no modifications to buffer contents.
@@ -88,6 +96,7 @@ void editorMoveCursor(char key) {
   case ARROW_LEFT:
     if (E.cx != 0) {
       E.cx--;
+      while (E.cx > 0 && UTF8_IS_CONT(row->chars[E.cx])) { E.cx--; }
     } else if (E.cy > 0) {
       E.cy--;
       E.cx = E.row[E.cy].size;
@@ -96,6 +105,7 @@ void editorMoveCursor(char key) {
   case ARROW_RIGHT:
     if (row && E.cx < row->size) {
       E.cx++;
+      while (E.cx < row->size && UTF8_IS_CONT(row->chars[E.cx])) { E.cx++; }
     } else if (row && E.cx == row->size) {
       E.cy++;
       E.cx = 0;
@@ -111,6 +121,58 @@ void editorMoveCursor(char key) {
   row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
   int rowlen = row ? row->size : 0;
   if (E.cx > rowlen) { E.cx = rowlen; }
+  while (row && E.cx > 0 && E.cx < rowlen && UTF8_IS_CONT(row->chars[E.cx])) { E.cx--; }
+}
+
+/* Whether key @p c changes the buffer or the file. */
+static int editorKeyEdits(int c) {
+  switch (c) {
+  case '\r':
+  case CTRL_KEY('t'):
+  case CTRL_KEY('i'):
+  case CTRL_KEY('w'):
+  case CTRL_KEY('r'):
+  case CTRL_KEY('d'):
+  case CTRL_KEY('k'):
+  case BACKSPACE:
+  case CTRL_KEY('h'):
+    return 1;
+  case HOME_KEY:
+  case END_KEY:
+  case PAGE_UP:
+  case PAGE_DOWN:
+  case ARROW_UP:
+  case ARROW_DOWN:
+  case ARROW_LEFT:
+  case ARROW_RIGHT:
+  case CTRL_KEY('l'):
+  case '\x1b':
+    return 0;
+  default:
+    return !iscntrl(c);
+  }
+}
+
+/* Prompt for a line number and move the cursor there. */
+static void editorGotoLine(void) {
+  char *input = editorPrompt("Go to line: %s (ESC to cancel)", NULL);
+  if (input == NULL) {
+    return;
+  }
+  char *end;
+  long long line = strtoll(input, &end, 10);
+  int bad = end == input || *end != '\0' || line < 1;
+  free(input);
+  if (bad) {
+    editorSetStatusMessage("Not a line number");
+    return;
+  }
+  if (pagerActive()) {
+    pagerGoto(line - 1, 0);
+    return;
+  }
+  E.cy = line - 1 < E.numrows ? (int)(line - 1) : (E.numrows > 0 ? E.numrows - 1 : 0);
+  E.cx = 0;
 }
 
 /**
@@ -127,20 +189,39 @@ void editorMoveCursor(char key) {
 void editorProcessKeypress(void) {
   static int quit_times = ZE_QUIT_TIMES;
   char c = editorReadKey();
+  idleHookReset();
+  /* Checked before plugin bindings too, which could otherwise edit the window. */
+  if (pagerActive() && editorKeyEdits((unsigned char)c)) {
+    editorSetStatusMessage("Read-only: this file is too large to edit");
+    return;
+  }
   if (pluginsHandleKey((unsigned char)c)) {
     quit_times = ZE_QUIT_TIMES;
     return;
   }
+  /* Saving and opening from a listing change no text; the rest are edits. */
+  int edit = editorKeyEdits((unsigned char)c) && c != CTRL_KEY('w') && !dirviewActive();
+  if (edit) {
+    preEditHook((unsigned char)c);
+  }
   switch (c) {
   case '\r':
-    editorInsertNewline();
+    if (dirviewActive()) {
+      dirviewEnter();
+    } else {
+      editorInsertNewline();
+    }
     break;
   case CTRL_KEY('q'):
+    /* Never abandon a save halfway; its result also settles E.dirty. */
+    editorSaveWait();
     if (E.dirty && quit_times > 0) {
       editorSetStatusMessage("WARNING!! File has unsaved changes. Press C-q %d more time to quit.", quit_times);
       quit_times--;
       return;
     }
+    journalDiscard();
+    stateCacheSave();
     write(STDOUT_FILENO, "\x1b[2J", 4);
     write(STDOUT_FILENO, "\x1b[H", 3);
     exit(0);
@@ -167,11 +248,25 @@ void editorProcessKeypress(void) {
     if (E.cy < E.numrows) { E.cx = E.row[E.cy].size; }
     break;
   case CTRL_KEY('s'):
-    editorFind();
+    if (pagerActive()) {
+      pagerFind();
+    } else {
+      editorFind();
+    }
+    break;
+  case CTRL_KEY('j'):
+    editorGotoLine();
+    break;
+  case CTRL_KEY('r'):
+    editorQueryReplace();
     break;
   case CTRL_KEY('d'):
     editorDelRow(E.cy);
     break;
+  case CTRL_KEY('u'):
+    editorSetSoftWrap(!E.softwrap);
+    editorSetStatusMessage("Soft wrap %s", E.softwrap ? "on" : "off");
+    break;
   case CTRL_KEY('k'):
     editorDelRowAtChar(&E.row[E.cy], E.cx);
     break;
@@ -181,6 +276,10 @@ void editorProcessKeypress(void) {
     break;
   case PAGE_UP:
   case PAGE_DOWN: {
+    if (E.softwrap) {
+      editorScrollWrappedLines(c == PAGE_UP ? -E.screenrows : E.screenrows);
+      break;
+    }
     if (c == PAGE_UP) { E.cy = E.rowoff; }
     else if (c == PAGE_DOWN) {
       E.cy = E.rowoff + E.screenrows - 1;
@@ -202,6 +301,9 @@ void editorProcessKeypress(void) {
     editorInsertChar(c);
     break;
   }
+  if (edit) {
+    postEditHook((unsigned char)c);
+  }
   quit_times = ZE_QUIT_TIMES;
 }
 
@@ -0,0 +1,593 @@
+/**
+ * @file journal.c
+ * @brief Edit journal implementation.
+ * @ingroup journal
+ *
+ * While a file is open, every change the row primitives make is appended to
+ * a journal beside it (".name.zej") as a compact record: an opcode followed
+ * by LEB128 integers and any inserted bytes. Records collect in memory and
+ * are written out about once a second while idle, so the cost of an edit is
+ * the size of the edit, not of the file.
+ *
+ * The journal starts with the size and modification time of the file it
+ * applies to. Opening a file whose journal names exactly that version
+ * replays the records on top of it; saving rewrites the journal against the
+ * new file, keeping only the edits made since the save's snapshot. Quitting
+ * through C-q removes it, so a journal left behind means a session died.
+ */
+#include "ze.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "buffer.h"
+#include "idle.h"
+#include "row.h"
+#include "status.h"
+#include "journal.h"
+
+extern struct editorConfig E;
+
+/** Longest time a record waits in memory before it is written out. */
+#define ZE_JOURNAL_FLUSH_MS 1000
+/** Pending bytes that trigger a write without waiting for the timer. */
+#define ZE_JOURNAL_FLUSH_BYTES (64 * 1024)
+
+/** Bytes each header field takes, so the header can be restamped in place. */
+#define ZE_JOURNAL_STAMP_BYTES 10
+
+static const char journal_magic[4] = {'Z', 'E', 'J', '1'};
+
+/** Journal record opcodes. */
+enum journalOp {
+  J_INSERT_ROW = 1,  /* at, len, bytes */
+  J_DELETE_ROW,      /* at */
+  J_INSERT_CHAR,     /* row, at, c */
+  J_APPEND,          /* row, len, bytes */
+  J_DELETE_CHAR,     /* row, at */
+  J_TRUNCATE,        /* row, at */
+  J_SET_ROW          /* row, len, bytes */
+};
+
+static struct {
+  int fd;              /* Open journal, or -1 when edits are not recorded. */
+  char *path;          /* Journal file name. */
+  off_t size;          /* Bytes written to the journal so far. */
+  off_t base;          /* Size of the header, where records start. */
+  struct abuf pending; /* Records not yet written. */
+  long first;          /* Time the oldest pending record was added, in ms. */
+  int suspended;       /* Nonzero while changes are not the user's edits. */
+} J = { -1, NULL, 0, 0, ABUF_INIT, 0, 0 };
+
+static long journalNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Journal file name for @p path: ".name.zej" in the same directory. */
+static char *journalPathFor(const char *path) {
+  const char *slash = strrchr(path, '/');
+  int dirlen = slash ? (int)(slash - path + 1) : 0;
+  size_t len = strlen(path) + 6;
+  char *out = malloc(len);
+  snprintf(out, len, "%.*s.%s.zej", dirlen, path, path + dirlen);
+  return out;
+}
+
+/* Like abPutVarint(), padded with continuation bytes to ZE_JOURNAL_STAMP_BYTES. */
+static void putVarintWide(struct abuf *ab, unsigned long long v) {
+  char b[ZE_JOURNAL_STAMP_BYTES];
+  for (int n = 0; n < ZE_JOURNAL_STAMP_BYTES; n++) {
+    b[n] = (char)(v & 0x7f);
+    if (n < ZE_JOURNAL_STAMP_BYTES - 1) {
+      b[n] |= (char)0x80;
+    }
+    v >>= 7;
+  }
+  abAppend(ab, b, ZE_JOURNAL_STAMP_BYTES);
+}
+
+/* Header recording which version of the file the records apply to. Its
+ * length does not depend on @p st; see journalStamp(). */
+static void journalHeader(struct abuf *ab, const struct stat *st) {
+  abAppend(ab, journal_magic, sizeof(journal_magic));
+  putVarintWide(ab, (unsigned long long)st->st_size);
+  putVarintWide(ab, (unsigned long long)st->st_mtim.tv_sec);
+  putVarintWide(ab, (unsigned long long)st->st_mtim.tv_nsec);
+}
+
+/*
+ * Check the header at the start of @p data against @p st. Returns its
+ * length, or 0 if it names another version of the file. Headers written
+ * with unpadded fields by older versions are accepted too.
+ */
+static off_t journalHeaderMatches(const unsigned char *data, off_t len,
+                                  const struct stat *st) {
+  const unsigned char *p = data + sizeof(journal_magic);
+  const unsigned char *end = data + len;
+  unsigned long long size, sec, nsec;
+  if (len < (off_t)sizeof(journal_magic) ||
+      memcmp(data, journal_magic, sizeof(journal_magic)) != 0 ||
+      abGetVarint(&p, end, &size) == -1 || abGetVarint(&p, end, &sec) == -1 ||
+      abGetVarint(&p, end, &nsec) == -1) {
+    return 0;
+  }
+  if (size != (unsigned long long)st->st_size ||
+      sec != (unsigned long long)st->st_mtim.tv_sec ||
+      nsec != (unsigned long long)st->st_mtim.tv_nsec) {
+    return 0;
+  }
+  return (off_t)(p - data);
+}
+
+static int writeAll(int fd, const char *s, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, s, len);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    s += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+/* Stop journaling after a write error; the journal may be incomplete. */
+static void journalFail(void) {
+  close(J.fd);
+  J.fd = -1;
+  editorSetStatusMessage("Journal disabled: %s", strerror(errno));
+}
+
+static void journalFlush(void) {
+  if (J.fd == -1 || J.pending.len == 0) {
+    return;
+  }
+  if (writeAll(J.fd, J.pending.b, (size_t)J.pending.len) == -1) {
+    journalFail();
+  } else {
+    J.size += J.pending.len;
+  }
+  J.pending.len = 0;
+}
+
+/* Idle task: write out records that have waited long enough. */
+static int journalIdle(void *data) {
+  (void)data;
+  if (J.pending.len > 0 && journalNow() - J.first >= ZE_JOURNAL_FLUSH_MS) {
+    journalFlush();
+  }
+  return 0;
+}
+
+/* Start a record. Returns 0 if edits are not being journaled. */
+static int journalBegin(int op) {
+  if (J.fd == -1 || J.suspended) {
+    return 0;
+  }
+  if (J.pending.len == 0) {
+    J.first = journalNow();
+  }
+  char c = (char)op;
+  abAppend(&J.pending, &c, 1);
+  return 1;
+}
+
+static void journalEnd(void) {
+  if (J.pending.len >= ZE_JOURNAL_FLUSH_BYTES) {
+    journalFlush();
+  }
+}
+
+static void journalRecord(int op, int a, int b, int c) {
+  if (!journalBegin(op)) {
+    return;
+  }
+  abPutVarint(&J.pending, (unsigned)a);
+  if (b >= 0) {
+    abPutVarint(&J.pending, (unsigned)b);
+  }
+  if (c >= 0) {
+    abPutVarint(&J.pending, (unsigned)c);
+  }
+  journalEnd();
+}
+
+static void journalRecordText(int op, int a, const char *s, size_t len) {
+  if (!journalBegin(op)) {
+    return;
+  }
+  abPutVarint(&J.pending, (unsigned)a);
+  abPutVarint(&J.pending, len);
+  abAppend(&J.pending, s, (int)len);
+  journalEnd();
+}
+
+/** @brief Record editorInsertRow(). @ingroup journal */
+void journalInsertRow(int at, const char *s, size_t len) {
+  journalRecordText(J_INSERT_ROW, at, s, len);
+}
+
+/** @brief Record editorDelRow(). @ingroup journal */
+void journalDeleteRow(int at) {
+  journalRecord(J_DELETE_ROW, at, -1, -1);
+}
+
+/** @brief Record editorRowInsertChar(). @ingroup journal */
+void journalInsertChar(int row, int at, int c) {
+  journalRecord(J_INSERT_CHAR, row, at, c & 0xff);
+}
+
+/** @brief Record editorRowAppendString(). @ingroup journal */
+void journalAppend(int row, const char *s, size_t len) {
+  journalRecordText(J_APPEND, row, s, len);
+}
+
+/** @brief Record editorRowDelChar(). @ingroup journal */
+void journalDeleteChar(int row, int at) {
+  journalRecord(J_DELETE_CHAR, row, at, -1);
+}
+
+/** @brief Record a row cut short at byte @p at. @ingroup journal */
+void journalTruncate(int row, int at) {
+  journalRecord(J_TRUNCATE, row, at, -1);
+}
+
+/** @brief Record a row's text being replaced wholesale. @ingroup journal */
+void journalSetRow(int row, const char *s, size_t len) {
+  journalRecordText(J_SET_ROW, row, s, len);
+}
+
+/*
+ * Apply the records from *@p pp up to @p end to the buffer, advancing *@p pp
+ * past each one applied. Stops at the first record that is cut short or
+ * does not fit the buffer, as the tail of a journal whose writer died.
+ * Returns the number of records applied.
+ */
+static int journalReplay(const unsigned char **pp, const unsigned char *end) {
+  int applied = 0;
+  const unsigned char *p = *pp;
+  while (p < end) {
+    int op = *p++;
+    unsigned long long a, b = 0, c = 0;
+    const char *text = NULL;
+    if (abGetVarint(&p, end, &a) == -1 || a > (unsigned)E.numrows) {
+      break;
+    }
+    switch (op) {
+    case J_INSERT_ROW:
+    case J_APPEND:
+    case J_SET_ROW:
+      if (abGetVarint(&p, end, &b) == -1 || b > (unsigned long long)(end - p)) {
+        return applied;
+      }
+      text = (const char *)p;
+      p += b;
+      break;
+    case J_INSERT_CHAR:
+      if (abGetVarint(&p, end, &b) == -1 || abGetVarint(&p, end, &c) == -1) {
+        return applied;
+      }
+      break;
+    case J_DELETE_CHAR:
+    case J_TRUNCATE:
+      if (abGetVarint(&p, end, &b) == -1) {
+        return applied;
+      }
+      break;
+    case J_DELETE_ROW:
+      break;
+    default:
+      return applied;
+    }
+    int at = (int)a;
+    if (op != J_INSERT_ROW && at >= E.numrows) {
+      break;
+    }
+    erow *row = op == J_INSERT_ROW ? NULL : &E.row[at];
+    switch (op) {
+    case J_INSERT_ROW:
+      editorInsertRow(at, (char *)text, (size_t)b);
+      break;
+    case J_DELETE_ROW:
+      editorDelRow(at);
+      break;
+    case J_INSERT_CHAR:
+      if (b > (unsigned)row->size) {
+        return applied;
+      }
+      editorRowInsertChar(row, (int)b, (int)c);
+      break;
+    case J_APPEND:
+      editorRowAppendString(row, (char *)text, (size_t)b);
+      break;
+    case J_DELETE_CHAR:
+      if (b >= (unsigned)row->size) {
+        return applied;
+      }
+      editorRowDelChar(row, (int)b);
+      break;
+    case J_TRUNCATE:
+      editorDelRowAtChar(row, (int)b);
+      break;
+    case J_SET_ROW:
+      editorRowSetText(row, text, (size_t)b);
+      break;
+    }
+    applied++;
+    *pp = p;
+  }
+  return applied;
+}
+
+/*
+ * Replay the journal at J.path if it was recorded against the file as @p st
+ * describes, leaving it open in J.fd. Returns the length of the journal up
+ * to the end of its last usable record if it applies (and so can be
+ * appended to after cutting it to that length), or 0 if a fresh journal is
+ * needed. Only a regular file of ours that no one else can read or write is
+ * trusted: the directory may be shared, and anyone can read the file's stat.
+ */
+static off_t journalRecover(const struct stat *st) {
+  int fd = open(J.path, O_RDWR | O_NOFOLLOW);
+  if (fd == -1) {
+    return 0;
+  }
+  struct stat js;
+  char *data = NULL;
+  off_t len = 0;
+  if (fstat(fd, &js) == 0 && S_ISREG(js.st_mode) && js.st_uid == geteuid() &&
+      (js.st_mode & 0777) == 0600 && js.st_size > 0) {
+    data = malloc((size_t)js.st_size);
+    while (len < js.st_size) {
+      ssize_t n = read(fd, data + len, (size_t)(js.st_size - len));
+      if (n <= 0) {
+        break;
+      }
+      len += n;
+    }
+  }
+
+  off_t base = data ? journalHeaderMatches((const unsigned char *)data, len, st) : 0;
+  if (base == 0) {
+    close(fd);
+    free(data);
+    return 0;
+  }
+  const unsigned char *p = (const unsigned char *)data + base;
+  const unsigned char *end = (const unsigned char *)data + len;
+  J.base = base;
+  int applied = journalReplay(&p, end);
+  len = (off_t)(p - (const unsigned char *)data);
+  free(data);
+  J.fd = fd;
+  if (applied > 0) {
+    E.dirty = applied;
+    editorSetStatusMessage("Recovered %d unsaved edits from %s", applied, J.path);
+  }
+  return len;
+}
+
+/*
+ * Create a journal at J.path holding only a header for @p st, replacing any
+ * old one. The new file is made afresh rather than truncated, so a link
+ * someone else left at J.path is never written through.
+ */
+static int journalCreate(const struct stat *st) {
+  struct abuf head = ABUF_INIT;
+  journalHeader(&head, st);
+  unlink(J.path);
+  J.fd = open(J.path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW, 0600);
+  if (J.fd == -1 || fchmod(J.fd, 0600) == -1 ||
+      writeAll(J.fd, head.b, (size_t)head.len) == -1) {
+    if (J.fd != -1) {
+      close(J.fd);
+      J.fd = -1;
+    }
+    abFree(&head);
+    return -1;
+  }
+  J.size = J.base = head.len;
+  abFree(&head);
+  return 0;
+}
+
+/**
+ * @brief Start journaling edits to a file that was just loaded.
+ * @ingroup journal
+ *
+ * If a journal from an earlier session was recorded against this exact
+ * version of the file, its edits are replayed into the buffer first and
+ * journaling continues in the same file. Otherwise any old journal is
+ * replaced. Edits are not journaled if the journal cannot be written.
+ *
+ * @param[in] path File whose contents the buffer holds.
+ * @sa journalClose(), journalRebase()
+ */
+void journalOpen(const char *path) {
+  journalClose();
+  struct stat st;
+  if (stat(path, &st) == -1 || !S_ISREG(st.st_mode)) {
+    return;
+  }
+  J.path = journalPathFor(path);
+  off_t len = journalRecover(&st);
+  if (len > 0) {
+    /* Not O_APPEND: journalStamp() rewrites the header with pwrite(). */
+    if (ftruncate(J.fd, len) == -1 || lseek(J.fd, len, SEEK_SET) == -1) {
+      close(J.fd);
+      J.fd = -1;
+    }
+    J.size = len;
+  } else {
+    journalCreate(&st);
+  }
+  if (J.fd == -1) {
+    free(J.path);
+    J.path = NULL;
+    return;
+  }
+  editorIdleAdd(journalIdle, NULL);
+}
+
+/**
+ * @brief Stop journaling, writing out pending records.
+ * @ingroup journal
+ *
+ * A journal that holds no records is removed; one with records is left for
+ * the next open of the file to recover.
+ */
+void journalClose(void) {
+  if (J.fd == -1) {
+    return;
+  }
+  journalFlush();
+  editorIdleRemove(journalIdle, NULL);
+  if (J.fd != -1) {
+    close(J.fd);
+    J.fd = -1;
+    if (J.size == J.base) {
+      unlink(J.path);
+    }
+  }
+  free(J.path);
+  J.path = NULL;
+}
+
+/**
+ * @brief Stop journaling and delete the journal.
+ * @ingroup journal
+ *
+ * Used when the user quits, keeping or throwing away their changes.
+ */
+void journalDiscard(void) {
+  if (J.fd == -1) {
+    return;
+  }
+  J.pending.len = 0;
+  J.size = J.base;
+  journalClose();
+}
+
+/**
+ * @brief Note the end of the journal at the moment a save snapshot is taken.
+ * @ingroup journal
+ *
+ * @return Offset of the next record, to pass to journalRebase() once the
+ *         save has succeeded; -1 if edits are not being journaled.
+ */
+off_t journalMark(void) {
+  journalFlush();
+  return J.fd == -1 ? -1 : J.size;
+}
+
+/**
+ * @brief Restart the journal against a freshly saved file.
+ * @ingroup journal
+ *
+ * The new journal's header describes @p path as it is now on disk and it
+ * keeps the records from @p mark on, which are the edits made while the
+ * save was running. Only those are copied. A journal for a different path,
+ * after a save under a new name, is removed.
+ *
+ * @param[in] mark Value journalMark() returned when the save started.
+ * @param[in] path File that was saved.
+ */
+void journalRebase(off_t mark, const char *path) {
+  struct stat st;
+  if (stat(path, &st) == -1) {
+    return;
+  }
+  journalFlush();
+  char *tail = NULL;
+  off_t taillen = 0;
+  if (J.fd != -1 && mark >= J.base && mark < J.size) {
+    taillen = J.size - mark;
+    tail = malloc((size_t)taillen);
+    if (pread(J.fd, tail, (size_t)taillen, mark) != taillen) {
+      taillen = 0;
+    }
+  }
+  if (J.fd != -1) {
+    editorIdleRemove(journalIdle, NULL);
+    close(J.fd);
+    J.fd = -1;
+    unlink(J.path);
+    free(J.path);
+  }
+  J.path = journalPathFor(path);
+  if (journalCreate(&st) == -1 ||
+      (taillen > 0 && writeAll(J.fd, tail, (size_t)taillen) == -1)) {
+    if (J.fd != -1) {
+      journalFail();
+    }
+    free(J.path);
+    J.path = NULL;
+  } else {
+    J.size += taillen;
+    editorIdleAdd(journalIdle, NULL);
+  }
+  free(tail);
+}
+
+/*
+ * Rewrite the header in place to describe the file as @p st does, keeping
+ * every record. Returns -1 if the header has another length, as one from
+ * an older version does, and has to be rebuilt instead.
+ */
+static int journalStamp(const struct stat *st) {
+  struct abuf head = ABUF_INIT;
+  journalHeader(&head, st);
+  int r = -1;
+  if (head.len == J.base) {
+    r = 0;
+    if (pwrite(J.fd, head.b, (size_t)head.len, 0) != head.len) {
+      journalFail();
+    }
+  }
+  abFree(&head);
+  return r;
+}
+
+/**
+ * @brief Stop recording changes until journalResume().
+ * @ingroup journal
+ *
+ * For rows that come from the file itself rather than from editing, such
+ * as lines follow mode appends as the file grows.
+ */
+void journalSuspend(void) {
+  J.suspended = 1;
+}
+
+/**
+ * @brief Record edits again after journalSuspend().
+ * @ingroup journal
+ *
+ * The journal's header is restamped in place against @p path as it is
+ * now, keeping every record. That is only sound when the file changed by
+ * growing at the end, where the rows added meanwhile went: the records
+ * still apply to the unchanged lines before them.
+ *
+ * @param[in] path File whose contents the buffer holds.
+ */
+void journalResume(const char *path) {
+  J.suspended = 0;
+  struct stat st;
+  if (J.fd == -1 || stat(path, &st) == -1) {
+    return;
+  }
+  if (journalStamp(&st) == -1) {
+    journalRebase(J.base, path);
+  }
+}
@@ -13,9 +13,14 @@
 #include "plugins.h"
 #include "search.h"
 #include "fileio.h"
+#include "compress.h"
 #include "init.h"
 #include "templates.h"
 #include "input.h"
+#include "hooks.h"
+#include "profile.h"
+#include "pager.h"
+#include "textscan.h"
 
 struct editorConfig E;
 
@@ -38,9 +43,15 @@ void initEditor(void) {
   E.rx = 0;
   E.rowoff = 0;
   E.coloff = 0;
+  E.wrapoff = 0;
   E.numrows = 0;
   E.row = NULL;
   E.dirty = 0;
+  E.compress = COMPRESS_NONE;
+  E.filesize = 0;
+  E.eol = EOL_LF;
+  E.bom = 0;
+  E.noeol = 0;
   E.filename = NULL;
   E.statusmsg[0] = '\0';
   E.statusmsg_time = 0;
@@ -66,8 +77,13 @@ void initEditor(void) {
 int main(int argc, char *argv[]) {
   enableRawMode();
   initEditor();
+  /* Kept out of initEditor(), which also runs for every C-o. */
+  E.savesync = SAVE_SYNC_DATA;
+  E.softwrap = 0;
+  E.pagerlimit = pagerDefaultLimit();
   editorSetStatusMessage("HELP: C-o = open a file | C-t = clone a template | C-w = write to disk | C-s = search | C-x guile | C-q = quit");
   scm_init_guile();
+  profileInit();
   initKeyBindings();
   SCM init_func;
   SCM notes_template_scm;
@@ -78,7 +94,9 @@ int main(int argc, char *argv[]) {
   scm_c_define_gsubr("set-editor-status", 1, 0, 0, (scm_t_subr)&scmEditorSetStatusMessage);
   scm_c_define_gsubr("bind-key", 2, 0, 0, (scm_t_subr)&scmBindKey);
   scm_c_define_gsubr("buffer->string", 0, 0, 0, (scm_t_subr)&scmBufferToString);
-  scm_c_define_gsubr("buffer-line-count", 0, 0, 0, (scm_t_subr)&scmBufferLineCount);
+  scm_c_define_gsubr("buffer-line-count", 0, 1, 0, (scm_t_subr)&scmBufferLineCount);
+  scm_c_define_gsubr("buffer-length", 0, 1, 0, (scm_t_subr)&scmBufferLength);
+  scm_c_define_gsubr("buffer-text", 1, 2, 0, (scm_t_subr)&scmBufferText);
   scm_c_define_gsubr("get-line", 1, 0, 0, (scm_t_subr)&scmGetLine);
   scm_c_define_gsubr("set-line!", 2, 0, 0, (scm_t_subr)&scmSetLine);
   scm_c_define_gsubr("insert-line!", 2, 0, 0, (scm_t_subr)&scmInsertLine);
@@ -88,25 +106,45 @@ int main(int argc, char *argv[]) {
   scm_c_define_gsubr("insert-char!", 1, 0, 0, (scm_t_subr)&scmInsertChar);
   scm_c_define_gsubr("insert-newline!", 0, 0, 0, (scm_t_subr)&scmInsertNewline);
   scm_c_define_gsubr("delete-char!", 0, 0, 0, (scm_t_subr)&scmDeleteChar);
+  scm_c_define_gsubr("call-with-edit-batch", 1, 0, 0, (scm_t_subr)&scmCallWithEditBatch);
+  scm_c_define_gsubr("get-lines", 0, 2, 0, (scm_t_subr)&scmGetLines);
+  scm_c_define_gsubr("set-lines!", 3, 0, 0, (scm_t_subr)&scmSetLines);
+  scm_c_define_gsubr("map-lines!", 1, 2, 0, (scm_t_subr)&scmMapLines);
+  scm_c_eval_string("(define-syntax-rule (with-buffer-batch body ...)"
+                    " (call-with-edit-batch (lambda () body ...)))");
   scm_c_define_gsubr("get-cursor", 0, 0, 0, (scm_t_subr)&scmGetCursor);
   scm_c_define_gsubr("set-cursor!", 2, 0, 0, (scm_t_subr)&scmSetCursor);
   scm_c_define_gsubr("move-cursor!", 1, 0, 0, (scm_t_subr)&scmMoveCursor);
   scm_c_define_gsubr("screen-size", 0, 0, 0, (scm_t_subr)&scmScreenSize);
   scm_c_define_gsubr("open-file!", 1, 0, 0, (scm_t_subr)&scmOpenFile);
+  scm_c_define_gsubr("follow-file!", 1, 1, 0, (scm_t_subr)&scmFollowFile);
   scm_c_define_gsubr("save-file!", 0, 0, 0, (scm_t_subr)&scmSaveFile);
+  scm_c_define_gsubr("set-save-durability!", 1, 0, 0, (scm_t_subr)&scmSetSaveDurability);
+  scm_c_define_gsubr("set-compression-level!", 1, 0, 0, (scm_t_subr)&scmSetCompressionLevel);
+  scm_c_define_gsubr("set-pager-threshold!", 1, 0, 0, (scm_t_subr)&scmSetPagerThreshold);
   scm_c_define_gsubr("get-filename", 0, 0, 0, (scm_t_subr)&scmGetFilename);
   scm_c_define_gsubr("set-filename!", 1, 0, 0, (scm_t_subr)&scmSetFilename);
   scm_c_define_gsubr("prompt", 1, 0, 0, (scm_t_subr)&scmPrompt);
   scm_c_define_gsubr("refresh-screen!", 0, 0, 0, (scm_t_subr)&scmRefreshScreen);
   scm_c_define_gsubr("search-forward!", 1, 0, 0, (scm_t_subr)&scmSearchForward);
+  scm_c_define_gsubr("search-regex!", 1, 0, 0, (scm_t_subr)&scmSearchRegex);
+  scm_c_define_gsubr("replace-all!", 2, 1, 0, (scm_t_subr)&scmReplaceAll);
   scm_c_define_gsubr("select-syntax-for-filename!", 1, 0, 0, (scm_t_subr)&scmSelectSyntaxForFilename);
   scm_c_define_gsubr("get-filetype", 0, 0, 0, (scm_t_subr)&scmGetFiletype);
   scm_c_define_gsubr("unbind-key", 1, 0, 0, (scm_t_subr)&scmUnbindKey);
   scm_c_define_gsubr("list-bindings", 0, 0, 0, (scm_t_subr)&scmListBindings);
   scm_c_define_gsubr("buffer-dirty?", 0, 0, 0, (scm_t_subr)&scmBufferDirty);
   scm_c_define_gsubr("set-buffer-dirty!", 1, 0, 0, (scm_t_subr)&scmSetBufferDirty);
+  scm_c_define_gsubr("set-soft-wrap!", 1, 0, 0, (scm_t_subr)&scmSetSoftWrap);
   scm_c_define_gsubr("clone-template!", 0, 0, 0, (scm_t_subr)&scmCloneTemplate);
+  scm_c_define_gsubr("add-hook!", 2, 1, 0, (scm_t_subr)&scmAddHook);
+  scm_c_define_gsubr("remove-hook!", 2, 0, 0, (scm_t_subr)&scmRemoveHook);
+  scm_c_define_gsubr("add-async-hook!", 2, 1, 0, (scm_t_subr)&scmAddAsyncHook);
+  scm_c_define_gsubr("plugin-stats", 0, 0, 0, (scm_t_subr)&scmPluginStats);
+  scm_c_define_gsubr("show-plugin-stats!", 0, 0, 0, (scm_t_subr)&scmShowPluginStats);
+  scm_c_define_gsubr("set-plugin-budget!", 1, 1, 0, (scm_t_subr)&scmSetPluginBudget);
   loadPlugins();
+  hooksInit();
   notes_template_scm = scm_variable_ref(scm_c_lookup("notes_template"));
   notes_template = scm_to_locale_string(notes_template_scm);
   readme_template_scm = scm_variable_ref(scm_c_lookup("readme_template"));
@@ -0,0 +1,629 @@
+/**
+ * @file pager.c
+ * @brief Pager implementation.
+ * @ingroup pager
+ *
+ * A file at least @c E.pagerlimit bytes long is not loaded. Only the lines
+ * around the cursor are rows: E.row holds up to PAGER_WINDOW consecutive
+ * blocks of PAGER_STRIDE lines, the cursor's block and its neighbours, and
+ * E.cy and E.rowoff count from the first of them. When the cursor moves
+ * into another block the window slides, keeping the blocks it still needs
+ * and reading the new one with pread().
+ *
+ * To find a block the pager keeps the offset of every PAGER_STRIDE-th line.
+ * An idle task builds this index from the start of the file, and reaching
+ * past its end scans just as far as needed; either way memory grows with
+ * the number of lines divided by PAGER_STRIDE, not with the file. Search
+ * reads the file a chunk at a time and never materializes it either.
+ */
+#include "ze.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bytesearch.h"
+#include "idle.h"
+#include "input.h"
+#include "row.h"
+#include "status.h"
+#include "syntax.h"
+#include "pager.h"
+
+extern struct editorConfig E;
+
+/** Lines per block; the start of every block is indexed. */
+#define PAGER_STRIDE 1024
+/** Blocks held as rows around the cursor. */
+#define PAGER_WINDOW 3
+/** Longest line shown; the rest of a longer line is cut off. */
+#define PAGER_LINE_MAX (32 * 1024)
+/** Bytes per pread() when scanning or reading blocks. */
+#define PAGER_CHUNK (1024 * 1024)
+/** Time an idle indexing slice may spend, in milliseconds. */
+#define PAGER_SLICE_MS 8
+
+static struct {
+  int fd;               /* File shown, or -1 when the pager is off. */
+  off_t size;           /* Its size when it was opened. */
+  off_t *idx;           /* idx[k] is the offset of line k * PAGER_STRIDE. */
+  long long nidx;
+  long long capidx;
+  off_t scanned;        /* Bytes of the file counted into the index. */
+  long long newlines;   /* Newlines in the first @c scanned bytes. */
+  int complete;         /* The whole file has been counted. */
+  int tail;             /* The last line has no newline; set once complete. */
+  long long first;      /* Block shown as row 0. */
+  int nblocks;          /* Blocks in E.row. */
+  int count[PAGER_WINDOW]; /* Rows of each of them. */
+  char *buf;            /* PAGER_CHUNK bytes for pread(). */
+  char *query;          /* Last search, for repeating it. */
+  long redrawn;         /* When indexing last asked for a redraw, in ms. */
+} P = { .fd = -1 };
+
+static long pagerNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void pagerIndexPush(off_t off) {
+  if (P.nidx == P.capidx) {
+    P.capidx = P.capidx ? P.capidx * 2 : 1024;
+    P.idx = realloc(P.idx, sizeof(off_t) * P.capidx);
+  }
+  P.idx[P.nidx++] = off;
+}
+
+/*
+ * Count one more chunk of the file into the index. Returns 0, or -1 with
+ * errno set.
+ */
+static int pagerScanChunk(void) {
+  if (P.complete) {
+    return 0;
+  }
+  size_t want = P.size - P.scanned < PAGER_CHUNK ? (size_t)(P.size - P.scanned) : PAGER_CHUNK;
+  ssize_t n = want ? pread(P.fd, P.buf, want, P.scanned) : 0;
+  if (n < 0) {
+    return errno == EINTR ? 0 : -1;
+  }
+  const char *p = P.buf;
+  const char *end = P.buf + n;
+  const char *nl;
+  while ((nl = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+    P.newlines++;
+    off_t next = P.scanned + (nl - P.buf) + 1;
+    if (P.newlines % PAGER_STRIDE == 0 && next < P.size) {
+      pagerIndexPush(next);
+    }
+    p = nl + 1;
+  }
+  P.scanned += n;
+  /* The file may have shrunk under us; what was counted is all there is. */
+  if (n == 0 || P.scanned >= P.size) {
+    P.size = P.scanned;
+    P.complete = 1;
+    P.tail = n > 0 && P.buf[n - 1] != '\n';
+  }
+  return 0;
+}
+
+/*
+ * Index the file until block @p b is known. With @p interruptible set, give
+ * up when a key is pressed. Returns 1 if the block exists, 0 if the file
+ * ends first, or -1 if interrupted.
+ */
+static int pagerReach(long long b, int interruptible) {
+  while (b >= P.nidx && !P.complete) {
+    if (pagerScanChunk() == -1) {
+      editorSetStatusMessage("Error reading file: %s", strerror(errno));
+      return 0;
+    }
+    if (interruptible && editorInputPending()) {
+      return -1;
+    }
+  }
+  return b < P.nidx;
+}
+
+/* Read block @p b and append its lines as rows. Returns the rows added. */
+static int pagerReadBlock(long long b) {
+  off_t off = P.idx[b];
+  int rows = 0;
+  char *line = NULL;
+  size_t have = 0;
+  int cut = 0;
+  while (rows < PAGER_STRIDE && off < P.size) {
+    size_t want = P.size - off < PAGER_CHUNK ? (size_t)(P.size - off) : PAGER_CHUNK;
+    ssize_t n = pread(P.fd, P.buf, want, off);
+    if (n <= 0) {
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    const char *p = P.buf;
+    const char *end = P.buf + n;
+    while (rows < PAGER_STRIDE && p < end) {
+      const char *nl = memchr(p, '\n', (size_t)(end - p));
+      size_t len = (size_t)((nl ? nl : end) - p);
+      if (!cut) {
+        size_t take = have + len > PAGER_LINE_MAX ? PAGER_LINE_MAX - have : len;
+        if (nl && have == 0 && take == len) {
+          /* The common case: the whole line is in this chunk. */
+          line = NULL;
+        } else {
+          if (line == NULL) {
+            line = malloc(PAGER_LINE_MAX);
+          }
+          memcpy(line + have, p, take);
+          have += take;
+          cut = have == PAGER_LINE_MAX;
+        }
+      }
+      if (nl) {
+        const char *s = line ? line : p;
+        size_t slen = line ? have : len;
+        while (slen > 0 && s[slen - 1] == '\r') {
+          slen--;
+        }
+        editorInsertRow(E.numrows, (char *)s, slen);
+        rows++;
+        have = 0;
+        cut = 0;
+        free(line);
+        line = NULL;
+      }
+      p += len + (nl ? 1 : 0);
+    }
+    off += p - P.buf;
+  }
+  /* A last line without a newline. */
+  if (rows < PAGER_STRIDE && off >= P.size && (have > 0 || line != NULL)) {
+    editorInsertRow(E.numrows, line ? line : "", have);
+    rows++;
+  }
+  free(line);
+  return rows;
+}
+
+/*
+ * Show blocks @p first onwards. Blocks already in the window keep their
+ * rows; only the others are read.
+ */
+static void pagerWindow(long long first) {
+  int dirty = E.dirty;
+  int oldstart[PAGER_WINDOW];
+  for (int i = 0, pos = 0; i < P.nblocks; i++) {
+    oldstart[i] = pos;
+    pos += P.count[i];
+  }
+  int keep[PAGER_WINDOW] = {0};
+  int pos[PAGER_WINDOW], cnt[PAGER_WINDOW];
+  int n = 0, total = 0;
+  for (; n < PAGER_WINDOW; n++) {
+    long long b = first + n;
+    if (pagerReach(b, 0) != 1) {
+      break;
+    }
+    if (b >= P.first && b < P.first + P.nblocks) {
+      int i = (int)(b - P.first);
+      keep[i] = 1;
+      pos[n] = oldstart[i];
+      cnt[n] = P.count[i];
+    } else {
+      /* New blocks go after the old rows until the window is rebuilt. */
+      pos[n] = E.numrows;
+      cnt[n] = pagerReadBlock(b);
+    }
+    total += cnt[n];
+  }
+
+  erow *rows = malloc(sizeof(erow) * (total ? total : 1));
+  for (int i = 0, at = 0; i < n; i++) {
+    memcpy(&rows[at], &E.row[pos[i]], sizeof(erow) * cnt[i]);
+    at += cnt[i];
+  }
+  for (int i = 0; i < P.nblocks; i++) {
+    if (!keep[i]) {
+      for (int j = 0; j < P.count[i]; j++) {
+        editorFreeRow(&E.row[oldstart[i] + j]);
+      }
+    }
+  }
+  free(E.row);
+  E.row = rows;
+  E.numrows = total;
+  for (int j = 0; j < total; j++) {
+    E.row[j].idx = j;
+  }
+  P.first = first;
+  P.nblocks = n;
+  for (int i = 0, at = 0; i < n; i++) {
+    P.count[i] = cnt[i];
+    /* A block's first row may follow a different row than before. */
+    if (cnt[i] > 0) {
+      editorUpdateSyntax(&E.row[at]);
+    }
+    at += cnt[i];
+  }
+  E.dirty = dirty;
+}
+
+/* Idle task: extend the line index, redrawing now and then for the count. */
+static int pagerIdle(void *data) {
+  (void)data;
+  if (P.fd == -1) {
+    return 0;
+  }
+  long start = pagerNow();
+  while (!P.complete && pagerNow() - start < PAGER_SLICE_MS) {
+    if (pagerScanChunk() == -1) {
+      P.complete = 1;
+    }
+  }
+  if (P.complete) {
+    editorIdleRemove(pagerIdle, NULL);
+    return IDLE_REDRAW;
+  }
+  int redraw = 0;
+  if (start - P.redrawn >= 250) {
+    P.redrawn = start;
+    redraw = IDLE_REDRAW;
+  }
+  return IDLE_MORE | redraw;
+}
+
+/**
+ * @brief Pick the size from which files open in the pager.
+ * @ingroup pager
+ *
+ * A quarter of physical memory: loaded rows take several times the size of
+ * the file.
+ *
+ * @return Size in bytes, or 0 if memory size is unknown.
+ */
+off_t pagerDefaultLimit(void) {
+  long pages = sysconf(_SC_PHYS_PAGES);
+  long pagesize = sysconf(_SC_PAGESIZE);
+  if (pages <= 0 || pagesize <= 0) {
+    return 0;
+  }
+  return (off_t)pages * pagesize / 4;
+}
+
+/**
+ * @brief Show a file read-only without loading it.
+ * @ingroup pager
+ *
+ * Shows the start of the file and starts indexing the rest in the
+ * background. The buffer stays in the pager until another file is opened.
+ *
+ * @param[in] fd Open file; the pager owns it from now on.
+ * @param[in] size Size of the file.
+ * @sa pagerClose()
+ */
+void pagerOpen(int fd, off_t size) {
+  pagerClose();
+  /* Every row belongs to the window. */
+  for (int i = 0; i < E.numrows; i++) {
+    editorFreeRow(&E.row[i]);
+  }
+  free(E.row);
+  E.row = NULL;
+  E.numrows = 0;
+  P.fd = fd;
+  P.size = size;
+  P.buf = malloc(PAGER_CHUNK);
+  if (size > 0) {
+    pagerIndexPush(0);
+  } else {
+    P.complete = 1;
+  }
+  pagerWindow(0);
+  E.dirty = 0;
+  if (!P.complete) {
+    editorIdleAdd(pagerIdle, NULL);
+  }
+  editorSetStatusMessage("Large file: showing it read-only");
+}
+
+/**
+ * @brief Leave the pager, closing the file.
+ * @ingroup pager
+ *
+ * Leaves the rows in the buffer as they are.
+ */
+void pagerClose(void) {
+  if (P.fd == -1) {
+    return;
+  }
+  editorIdleRemove(pagerIdle, NULL);
+  close(P.fd);
+  free(P.idx);
+  free(P.buf);
+  free(P.query);
+  memset(&P, 0, sizeof(P));
+  P.fd = -1;
+}
+
+/**
+ * @brief Whether the buffer is a pager window onto a large file.
+ * @ingroup pager
+ */
+int pagerActive(void) {
+  return P.fd != -1;
+}
+
+/**
+ * @brief Slide the window so the cursor's block has neighbours on screen.
+ * @ingroup pager
+ *
+ * Called before every redraw. Keeps the cursor and viewport on the same
+ * file lines while their row numbers change.
+ */
+void pagerSync(void) {
+  if (P.fd == -1) {
+    return;
+  }
+  long long base = P.first * PAGER_STRIDE;
+  long long b = (base + E.cy) / PAGER_STRIDE;
+  long long want = b > 0 ? b - 1 : 0;
+  if (want == P.first) {
+    return;
+  }
+  pagerWindow(want);
+  int delta = (int)(base - P.first * PAGER_STRIDE);
+  E.cy += delta;
+  E.rowoff += delta;
+  if (E.cy < 0) E.cy = 0;
+  if (E.cy > E.numrows) E.cy = E.numrows;
+  if (E.rowoff < 0) E.rowoff = 0;
+  if (E.rowoff > E.cy) E.rowoff = E.cy;
+}
+
+/**
+ * @brief Line of the file shown by a row.
+ * @ingroup pager
+ *
+ * @param[in] row Index into E.row.
+ * @return Zero-based line number; @p row itself outside the pager.
+ */
+long long pagerLineOf(int row) {
+  return P.fd == -1 ? row : P.first * PAGER_STRIDE + row;
+}
+
+/**
+ * @brief Lines in the file, as far as it has been counted.
+ * @ingroup pager
+ *
+ * @param[out] complete Set to whether the whole file has been counted.
+ */
+long long pagerLineCount(int *complete) {
+  *complete = P.complete;
+  return P.newlines + P.tail;
+}
+
+/**
+ * @brief Move the cursor to a line and column of the file.
+ * @ingroup pager
+ *
+ * Indexes as far as the line if needed; pressing a key meanwhile cancels.
+ * Lines past the end go to the last line.
+ *
+ * @param[in] line Zero-based line number.
+ * @param[in] col Byte offset in the line.
+ */
+void pagerGoto(long long line, int col) {
+  if (line < 0) {
+    line = 0;
+  }
+  /* Reaching the next block too tells whether the line is past the end. */
+  if (pagerReach(line / PAGER_STRIDE + 1, 1) == -1) {
+    editorSetStatusMessage("Interrupted");
+    return;
+  }
+  int complete;
+  long long lines = pagerLineCount(&complete);
+  if (complete && line >= lines) {
+    line = lines > 0 ? lines - 1 : 0;
+  }
+  long long b = line / PAGER_STRIDE;
+  pagerWindow(b > 0 ? b - 1 : 0);
+  long long cy = line - P.first * PAGER_STRIDE;
+  E.cy = cy < E.numrows ? (int)cy : E.numrows;
+  E.cx = 0;
+  if (E.cy < E.numrows) {
+    E.cx = col < E.row[E.cy].size ? col : E.row[E.cy].size;
+  }
+  E.rowoff = E.cy > E.screenrows / 2 ? E.cy - E.screenrows / 2 : 0;
+}
+
+/**
+ * @brief Line index built so far for the paged file.
+ * @ingroup pager
+ *
+ * @param[out] out Filled in; @c idx stays valid until the pager changes.
+ * @return 1, or 0 when the pager is off.
+ * @sa pagerIndexSet()
+ */
+int pagerIndexGet(struct pagerIndex *out) {
+  if (P.fd == -1) {
+    return 0;
+  }
+  out->idx = P.idx;
+  out->nidx = P.nidx;
+  out->scanned = P.scanned;
+  out->newlines = P.newlines;
+  out->complete = P.complete;
+  out->tail = P.tail;
+  return 1;
+}
+
+/**
+ * @brief Adopt a line index built for the same file before.
+ * @ingroup pager
+ *
+ * Replaces the index only if it covers more of the file than the pager has
+ * counted; indexing carries on from where it ends. An index that does not
+ * fit the file is ignored.
+ *
+ * @param[in] in Index as returned by pagerIndexGet(); copied.
+ */
+void pagerIndexSet(const struct pagerIndex *in) {
+  if (P.fd == -1 || in->nidx < 1 || in->idx[0] != 0 || in->scanned > P.size ||
+      in->scanned <= P.scanned || (in->complete && in->scanned != P.size)) {
+    return;
+  }
+  for (long long k = 1; k < in->nidx; k++) {
+    if (in->idx[k] <= in->idx[k - 1] || in->idx[k] > in->scanned) {
+      return;
+    }
+  }
+  P.nidx = 0;
+  for (long long k = 0; k < in->nidx; k++) {
+    pagerIndexPush(in->idx[k]);
+  }
+  P.scanned = in->scanned;
+  P.newlines = in->newlines;
+  P.complete = in->complete;
+  P.tail = in->tail;
+  if (P.complete) {
+    editorIdleRemove(pagerIdle, NULL);
+  }
+}
+
+/* Offset where @p line starts; the line's block must be indexed. */
+static off_t pagerLineStart(long long line) {
+  long long b = line / PAGER_STRIDE;
+  long long skip = line - b * PAGER_STRIDE;
+  off_t at = P.idx[b];
+  while (skip > 0 && at < P.size) {
+    size_t want = P.size - at < PAGER_CHUNK ? (size_t)(P.size - at) : PAGER_CHUNK;
+    ssize_t n = pread(P.fd, P.buf, want, at);
+    if (n <= 0) {
+      break;
+    }
+    const char *p = P.buf, *end = P.buf + n, *nl;
+    while (skip > 0 && (nl = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+      skip--;
+      p = nl + 1;
+    }
+    at += skip > 0 ? n : p - P.buf;
+  }
+  return at;
+}
+
+/* Line and column of byte @p off, from the index and a count of newlines. */
+static int pagerLocate(off_t off, long long *line, int *col) {
+  while (!P.complete && P.scanned <= off) {
+    if (pagerScanChunk() == -1) {
+      return -1;
+    }
+  }
+  long long lo = 0, hi = P.nidx - 1;
+  while (lo < hi) {
+    long long mid = (lo + hi + 1) / 2;
+    if (P.idx[mid] <= off) lo = mid;
+    else hi = mid - 1;
+  }
+  *line = lo * PAGER_STRIDE;
+  off_t start = P.idx[lo];
+  for (off_t at = P.idx[lo]; at < off;) {
+    size_t want = off - at < PAGER_CHUNK ? (size_t)(off - at) : PAGER_CHUNK;
+    ssize_t n = pread(P.fd, P.buf, want, at);
+    if (n <= 0) {
+      return -1;
+    }
+    const char *p = P.buf, *end = P.buf + n, *nl;
+    while ((nl = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+      (*line)++;
+      start = at + (nl - P.buf) + 1;
+      p = nl + 1;
+    }
+    at += n;
+  }
+  *col = off - start < PAGER_LINE_MAX ? (int)(off - start) : PAGER_LINE_MAX;
+  return 0;
+}
+
+/*
+ * Find @p q in [from, to). Chunks overlap by the query length so matches
+ * across chunk boundaries are found. Returns the offset, -1 if there is
+ * none, or -2 if a key was pressed.
+ */
+static off_t pagerScanFor(const char *q, size_t qlen, off_t from, off_t to) {
+  off_t at = from;
+  while (at < to) {
+    size_t want = to - at < PAGER_CHUNK ? (size_t)(to - at) : PAGER_CHUNK;
+    ssize_t n = pread(P.fd, P.buf, want, at);
+    if (n <= 0) {
+      return -1;
+    }
+    const char *hit = byteSearch(P.buf, (size_t)n, q, qlen);
+    if (hit != NULL) {
+      return at + (hit - P.buf);
+    }
+    if ((size_t)n < qlen || at + n >= to) {
+      break;
+    }
+    at += n - (off_t)(qlen - 1);
+    if (editorInputPending()) {
+      return -2;
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief Search the whole file for text, forward from the cursor.
+ * @ingroup pager
+ *
+ * Prompts for the text; an empty answer repeats the last search. The search
+ * wraps around at the end of the file. Pressing a key cancels it.
+ */
+void pagerFind(void) {
+  char *q = editorPrompt("Search file: %s (ESC to cancel, Enter to repeat)", NULL);
+  if (q == NULL) {
+    return;
+  }
+  if (q[0] == '\0' && P.query != NULL) {
+    free(q);
+    q = strdup(P.query);
+  }
+  if (q[0] == '\0') {
+    free(q);
+    return;
+  }
+  free(P.query);
+  P.query = q;
+  size_t qlen = strlen(q);
+
+  /* Start just after the cursor. */
+  off_t from = 0;
+  long long line = pagerLineOf(E.cy);
+  if (line / PAGER_STRIDE < P.nidx && E.cy < E.numrows) {
+    from = pagerLineStart(line) + E.cx + 1;
+  }
+  off_t hit = pagerScanFor(q, qlen, from, P.size);
+  if (hit == -1 && from > 0) {
+    hit = pagerScanFor(q, qlen, 0, from + (off_t)qlen - 1 < P.size ? from + (off_t)qlen - 1 : P.size);
+  }
+  if (hit == -2) {
+    editorSetStatusMessage("Search interrupted");
+    return;
+  }
+  if (hit < 0) {
+    editorSetStatusMessage("Not found: %s", q);
+    return;
+  }
+  int col;
+  if (pagerLocate(hit, &line, &col) == -1) {
+    editorSetStatusMessage("Error reading file: %s", strerror(errno));
+    return;
+  }
+  pagerGoto(line, col);
+}
@@ -18,41 +18,19 @@
 #include "row.h"
 #include "edit.h"
 #include "fileio.h"
+#include "compress.h"
 #include "render.h"
 #include "syntax.h"
+#include "search.h"
+#include "replace.h"
+#include "follow.h"
+#include "pager.h"
+#include "hooks.h"
+#include "profile.h"
 
 static SCM key_bindings[256];
 static char *key_specs[256];
 
-// Hook registry (optional; falls back to global Scheme names if not set)
-static SCM hook_preDirOpen = SCM_BOOL_F;
-static SCM hook_postDirOpen = SCM_BOOL_F;
-static SCM hook_preFileOpen = SCM_BOOL_F;
-static SCM hook_postFileOpen = SCM_BOOL_F;
-static SCM hook_preSave = SCM_BOOL_F;
-static SCM hook_postSave = SCM_BOOL_F;
-
-/**
- * @brief Fetch a registered hook by name.
- * @ingroup plugins
- *
- * Recognized names: "preDirOpenHook", "postDirOpenHook",
- * "preFileOpenHook", "postFileOpenHook", "preSaveHook", "postSaveHook".
- *
- * @param name C string name of the hook.
- * @return Scheme object for the hook or \c SCM_BOOL_F if unset/unknown.
- */
-SCM pluginsGetHook(const char *name) {
-  if (name == NULL) return SCM_BOOL_F;
-  if (strcmp(name, "preDirOpenHook") == 0) return hook_preDirOpen;
-  if (strcmp(name, "postDirOpenHook") == 0) return hook_postDirOpen;
-  if (strcmp(name, "preFileOpenHook") == 0) return hook_preFileOpen;
-  if (strcmp(name, "postFileOpenHook") == 0) return hook_postFileOpen;
-  if (strcmp(name, "preSaveHook") == 0) return hook_preSave;
-  if (strcmp(name, "postSaveHook") == 0) return hook_postSave;
-  return SCM_BOOL_F;
-}
-
 static int parse_keyspec(const char *spec, unsigned char *out_code) {
   if (spec == NULL || out_code == NULL) return 0;
   size_t len = strlen(spec);
@@ -78,7 +56,7 @@ static int parse_keyspec(const char *spec, unsigned char *out_code) {
 int pluginsHandleKey(unsigned char code) {
   SCM proc = key_bindings[code];
   if (scm_is_true(proc) && scm_is_true(scm_procedure_p(proc))) {
-    scm_call_0(proc);
+    profileCall(key_specs[code], proc, 0, SCM_UNDEFINED, SCM_UNDEFINED);
     return 1;
   }
   return 0;
@@ -126,6 +104,22 @@ void loadPlugins(void) {
   free(entries);
 }
 
+/**
+ * @brief Raise an error unless called on the main thread.
+ * @ingroup plugins
+ *
+ * Bindings that read or change the editor state call this first, so an
+ * async hook that strays from its buffer handle fails cleanly instead of
+ * racing the main loop.
+ *
+ * @param[in] who Scheme name of the binding, for the error message.
+ */
+void pluginsMainThreadOnly(const char *who) {
+  if (!profileOnMainThread()) {
+    scm_misc_error(who, "not available to async hooks; use the buffer handle instead", SCM_EOL);
+  }
+}
+
 /**
  * @brief Bind a key specification to a Scheme procedure.
  * @ingroup plugins
@@ -135,6 +129,7 @@ void loadPlugins(void) {
  * @return \c SCM_BOOL_T on success, \c SCM_BOOL_F on failure.
  */
 SCM scmBindKey(SCM keySpec, SCM proc) {
+  pluginsMainThreadOnly("bind-key");
   char *spec = scm_to_locale_string(keySpec);
   unsigned char code = 0;
   if (!parse_keyspec(spec, &code)) {
@@ -156,6 +151,112 @@ SCM scmBindKey(SCM keySpec, SCM proc) {
   return SCM_BOOL_T;
 }
 
+/* Event named by symbol @p event_scm, or -1. */
+static int hookEventOf(SCM event_scm) {
+  if (!scm_is_symbol(event_scm)) return -1;
+  char *name = scm_to_locale_string(scm_symbol_to_string(event_scm));
+  int event = hooksEventByName(name);
+  free(name);
+  return event;
+}
+
+/* Shared by add-hook! and add-async-hook!. */
+static SCM hookAdd(SCM event_scm, SCM proc, SCM priority_scm, int async) {
+  int event = hookEventOf(event_scm);
+  if (event < 0 || !scm_is_true(scm_procedure_p(proc))) {
+    return SCM_BOOL_F;
+  }
+  int priority = 0;
+  if (!SCM_UNBNDP(priority_scm)) {
+    if (!scm_is_integer(priority_scm)) return SCM_BOOL_F;
+    priority = scm_to_int(priority_scm);
+  }
+  return scm_from_bool(hooksAdd(event, proc, priority, async));
+}
+
+/**
+ * @brief Scheme: (add-hook! event proc [priority]) subscribe to an event.
+ * @ingroup plugins
+ *
+ * @p event is a symbol such as @c 'post-save; see hooks.h for the list and
+ * the arguments each passes. Higher priorities run first.
+ *
+ * @return #t on success, #f for an unknown event or a non-procedure.
+ * @sa hooksAdd(), scmRemoveHook()
+ */
+SCM scmAddHook(SCM event_scm, SCM proc, SCM priority_scm) {
+  pluginsMainThreadOnly("add-hook!");
+  return hookAdd(event_scm, proc, priority_scm, 0);
+}
+
+/**
+ * @brief Scheme: (add-async-hook! event proc [priority]) subscribe off the main thread.
+ * @ingroup plugins
+ *
+ * @p proc runs on a worker thread with a snapshot of the buffer, so it must
+ * only read the buffer through that handle. It may return a status string,
+ * or a list of status strings and @c (line . text) pairs to replace lines;
+ * the edits are applied only if the buffer has not changed since.
+ *
+ * @return #t on success, #f for an unknown event or a non-procedure.
+ * @sa hookPoolSubmit(), scmAddHook()
+ */
+SCM scmAddAsyncHook(SCM event_scm, SCM proc, SCM priority_scm) {
+  pluginsMainThreadOnly("add-async-hook!");
+  return hookAdd(event_scm, proc, priority_scm, 1);
+}
+
+/**
+ * @brief Scheme: (remove-hook! event proc) unsubscribe from an event.
+ * @ingroup plugins
+ *
+ * @return #t if @p proc was subscribed to @p event, else #f.
+ * @sa hooksRemove(), scmAddHook()
+ */
+SCM scmRemoveHook(SCM event_scm, SCM proc) {
+  pluginsMainThreadOnly("remove-hook!");
+  int event = hookEventOf(event_scm);
+  if (event < 0) return SCM_BOOL_F;
+  return scm_from_bool(hooksRemove(event, proc));
+}
+
+/**
+ * @brief Scheme: (plugin-stats) time spent in each plugin procedure.
+ * @ingroup plugins
+ * @return List of association lists; see profileStats().
+ */
+SCM scmPluginStats(void) {
+  return profileStats();
+}
+
+/**
+ * @brief Scheme: (show-plugin-stats!) show the slowest procedures in the status bar.
+ * @ingroup plugins
+ */
+SCM scmShowPluginStats(void) {
+  pluginsMainThreadOnly("show-plugin-stats!");
+  profileShow();
+  return SCM_UNSPECIFIED;
+}
+
+/**
+ * @brief Scheme: (set-plugin-budget! ms [abort]) time allowed per plugin call.
+ * @ingroup plugins
+ *
+ * Calls on the main thread that take longer than @p ms milliseconds leave
+ * a warning in the status bar; with @p abort true they are also stopped.
+ * 0 turns the budget off.
+ *
+ * @return #t, or #f if @p ms is not an integer.
+ */
+SCM scmSetPluginBudget(SCM ms_scm, SCM abort_scm) {
+  pluginsMainThreadOnly("set-plugin-budget!");
+  if (!scm_is_integer(ms_scm)) return SCM_BOOL_F;
+  int abort = !SCM_UNBNDP(abort_scm) && scm_is_true(abort_scm);
+  profileSetBudget(scm_to_int(ms_scm), abort);
+  return SCM_BOOL_T;
+}
+
 // Utility: convert any Scheme object to a freshly-allocated C string using display semantics
 static char *scm_to_display_c_string(SCM obj) {
   SCM port = scm_open_output_string();
@@ -172,9 +273,11 @@ static SCM eval_body(void *data) {
 }
 
 // Catch handler to turn exceptions into a human-readable string result
+// (data is the evaluation's profileMark, so a budget stop is reported as one)
 static SCM eval_handler(void *data, SCM tag, SCM throw_args) {
-  (void)data;
-  (void)tag;
+  if (profileStopped((struct profileMark *)data, tag)) {
+    return SCM_UNSPECIFIED;
+  }
   SCM port = scm_open_output_string();
   scm_display(scm_from_locale_string("Error: "), port);
   scm_display(throw_args, port);
@@ -195,28 +298,32 @@ void editorExec(void) {
     return;
   }
   // Evaluate with error handling
+  struct profileMark mark;
+  profileBegin(&mark);
   result_scm = scm_c_catch(SCM_BOOL_T, eval_body, (void *)command,
-                           eval_handler, NULL, NULL, NULL);
-  // Convert result to display string and show it
-  results = scm_to_display_c_string(result_scm);
-  editorSetStatusMessage(results);
-  free(results);
+                           eval_handler, &mark, NULL, NULL);
+  // Convert result to display string and show it; profileEnd reports a stop
+  if (!mark.aborted) {
+    results = scm_to_display_c_string(result_scm);
+    editorSetStatusMessage(results);
+    free(results);
+  }
   free(command);
+  profileEnd(&mark, "eval", SCM_BOOL_F);
 }
 
 // ===== Buffer inspection and mutation =====
 
 extern struct editorConfig E;
 
+/* The pager's rows are a window on a file too large to edit; leave them be. */
+static int bufferReadOnly(void) {
+  return pagerActive();
+}
+
 static void replace_row_text(erow *row, const char *text, size_t len) {
   if (row == NULL) return;
-  free(row->chars);
-  row->chars = malloc(len + 1);
-  memcpy(row->chars, text, len);
-  row->chars[len] = '\0';
-  row->size = (int)len;
-  editorUpdateRow(row);
-  E.dirty++;
+  editorRowSetText(row, text, len);
 }
 
 /**
@@ -226,6 +333,7 @@ static void replace_row_text(erow *row, const char *text, size_t len) {
  * @return Scheme string containing the full buffer contents.
  */
 SCM scmBufferToString(void) {
+  pluginsMainThreadOnly("buffer->string");
   int len = 0;
   char *buf = editorRowsToString(&len);
   if (!buf) return scm_from_locale_string("");
@@ -234,14 +342,213 @@ SCM scmBufferToString(void) {
   return s;
 }
 
+// ===== Buffer handles passed to hooks =====
+
+/* Foreign object type of buffer handles; created on first use. */
+static SCM buffer_type = SCM_BOOL_F;
+
+/* The rows as they were when async hooks were queued. The text is shared
+ * with the buffer (see editorRowsShare()) and never changes. */
+struct bufferSnapshot {
+  const char **chars;
+  int *size;
+  int nrows;
+  size_t len;       /* Bytes, one newline per row included. */
+  int refs;         /* Jobs not yet applied, plus the dispatcher. */
+};
+
+/* What a handle points at: whether it may still be used, and a snapshot
+ * for handles given to async hooks (NULL for the live buffer). */
+struct bufferHandle {
+  int live;
+  struct bufferSnapshot *snap;
+};
+
+static void bufferHandleFinalize(SCM obj) {
+  free(scm_foreign_object_ref(obj, 0));
+}
+
+static SCM bufferMakeHandle(struct bufferSnapshot *snap) {
+  if (scm_is_false(buffer_type)) {
+    buffer_type = scm_make_foreign_object_type(scm_from_utf8_symbol("buffer"),
+                                               scm_list_1(scm_from_utf8_symbol("state")),
+                                               bufferHandleFinalize);
+    scm_permanent_object(buffer_type);
+  }
+  struct bufferHandle *h = malloc(sizeof(*h));
+  h->live = 1;
+  h->snap = snap;
+  return scm_make_foreign_object_1(buffer_type, h);
+}
+
+/**
+ * @brief Make a handle on the current buffer for a hook.
+ * @ingroup plugins
+ *
+ * The handle copies nothing: @c buffer-length, @c buffer-line-count, and
+ * @c buffer-text read the rows when called. Release it with
+ * pluginsBufferRelease() when the hook returns.
+ *
+ * @return New Scheme buffer handle.
+ */
+SCM pluginsBufferHandle(void) {
+  return bufferMakeHandle(NULL);
+}
+
+/**
+ * @brief Make a handle unusable; later accessor calls with it raise an error.
+ * @ingroup plugins
+ */
+void pluginsBufferRelease(SCM buf) {
+  struct bufferHandle *h = scm_foreign_object_ref(buf, 0);
+  h->live = 0;
+}
+
+/**
+ * @brief Make a handle on a snapshot of the buffer for hooks on other threads.
+ * @ingroup plugins
+ *
+ * No text is copied: the snapshot keeps each row's @c chars, which edits
+ * leave alone until the snapshot is released (see editorRowsShare()), so
+ * the handle reads the same text however the buffer changes afterwards.
+ * The caller holds one reference; take one more per job with
+ * pluginsSnapshotRetain().
+ *
+ * @return New Scheme buffer handle.
+ * @sa pluginsSnapshotRelease(), hookPoolSubmit()
+ */
+SCM pluginsBufferSnapshot(void) {
+  struct bufferSnapshot *snap = malloc(sizeof(*snap));
+  size_t n = E.numrows ? (size_t)E.numrows : 1;
+  snap->chars = malloc(sizeof(*snap->chars) * n);
+  snap->size = malloc(sizeof(*snap->size) * n);
+  snap->nrows = E.numrows;
+  snap->len = 0;
+  for (int i = 0; i < E.numrows; i++) {
+    snap->chars[i] = E.row[i].chars;
+    snap->size[i] = E.row[i].size;
+    snap->len += (size_t)E.row[i].size + 1;
+  }
+  snap->refs = 1;
+  editorRowsShare();
+  return bufferMakeHandle(snap);
+}
+
+/**
+ * @brief Take another reference on a snapshot handle.
+ * @ingroup plugins
+ */
+void pluginsSnapshotRetain(SCM buf) {
+  struct bufferHandle *h = scm_foreign_object_ref(buf, 0);
+  h->snap->refs++;
+}
+
+/**
+ * @brief Drop a reference on a snapshot handle; main thread only.
+ * @ingroup plugins
+ *
+ * The last one gives the rows back to the buffer and makes the handle
+ * unusable.
+ */
+void pluginsSnapshotRelease(SCM buf) {
+  struct bufferHandle *h = scm_foreign_object_ref(buf, 0);
+  struct bufferSnapshot *snap = h->snap;
+  if (--snap->refs > 0) {
+    return;
+  }
+  h->live = 0;
+  h->snap = NULL;
+  free(snap->chars);
+  free(snap->size);
+  free(snap);
+  editorRowsRelease();
+}
+
+/* Check that @p buf, if given, is a handle still in use. Returns its
+ * snapshot, or NULL when it reads the live buffer; only the main thread
+ * may do that. */
+static struct bufferSnapshot *bufferCheck(const char *who, SCM buf) {
+  if (SCM_UNBNDP(buf)) {
+    pluginsMainThreadOnly(who);
+    return NULL;
+  }
+  if (scm_is_false(buffer_type)) {
+    scm_wrong_type_arg(who, 1, buf);
+  }
+  scm_assert_foreign_object_type(buffer_type, buf);
+  struct bufferHandle *h = scm_foreign_object_ref(buf, 0);
+  if (!h->live) {
+    scm_misc_error(who, "buffer handle used after its hook returned", SCM_EOL);
+  }
+  if (h->snap == NULL) {
+    pluginsMainThreadOnly(who);
+  }
+  return h->snap;
+}
+
+/**
+ * @brief Length of the buffer in bytes, one newline per line included.
+ * @ingroup plugins
+ * @note Scheme procedure: buffer-length [buffer]
+ * @param buf_scm Optional handle passed to a hook.
+ * @return Scheme integer; the same as the length of buffer->string in bytes.
+ */
+SCM scmBufferLength(SCM buf_scm) {
+  struct bufferSnapshot *snap = bufferCheck("buffer-length", buf_scm);
+  if (snap) {
+    return scm_from_int64((int64_t)snap->len);
+  }
+  long long len = 0;
+  for (int i = 0; i < E.numrows; i++) {
+    len += E.row[i].size + 1;
+  }
+  return scm_from_int64(len);
+}
+
 /**
  * @brief Get the number of lines in the current buffer.
  * @ingroup plugins
- * @note Scheme procedure: buffer-line-count
+ * @note Scheme procedure: buffer-line-count [buffer]
+ * @param buf_scm Optional handle passed to a hook.
  * @return Scheme integer line count.
  */
-SCM scmBufferLineCount(void) {
-  return scm_from_int(E.numrows);
+SCM scmBufferLineCount(SCM buf_scm) {
+  struct bufferSnapshot *snap = bufferCheck("buffer-line-count", buf_scm);
+  return scm_from_int(snap ? snap->nrows : E.numrows);
+}
+
+/**
+ * @brief Text of a range of lines, each followed by a newline.
+ * @ingroup plugins
+ * @note Scheme procedure: buffer-text buffer [start [end]]
+ * @param buf_scm Handle passed to a hook.
+ * @param start_scm First line (0-based); defaults to 0.
+ * @param end_scm Line after the last; defaults to the line count.
+ * @return Scheme string; only the lines asked for are converted.
+ */
+SCM scmBufferText(SCM buf_scm, SCM start_scm, SCM end_scm) {
+  struct bufferSnapshot *snap = bufferCheck("buffer-text", buf_scm);
+  int nrows = snap ? snap->nrows : E.numrows;
+  int start = SCM_UNBNDP(start_scm) ? 0 : scm_to_int(start_scm);
+  int end = SCM_UNBNDP(end_scm) ? nrows : scm_to_int(end_scm);
+  if (start < 0) start = 0;
+  if (end > nrows) end = nrows;
+  if (end <= start) return scm_from_locale_string("");
+  size_t len = 0;
+  for (int i = start; i < end; i++) {
+    len += (size_t)(snap ? snap->size[i] : E.row[i].size) + 1;
+  }
+  char *buf = malloc(len);
+  char *p = buf;
+  for (int i = start; i < end; i++) {
+    int size = snap ? snap->size[i] : E.row[i].size;
+    memcpy(p, snap ? snap->chars[i] : E.row[i].chars, size);
+    p += size;
+    *p++ = '\n';
+  }
+  SCM s = scm_from_locale_stringn(buf, len);
+  free(buf);
+  return s;
 }
 
 /**
@@ -252,6 +559,7 @@ SCM scmBufferLineCount(void) {
  * @return Scheme string for the line, or \c SCM_BOOL_F if out of range.
  */
 SCM scmGetLine(SCM idx_scm) {
+  pluginsMainThreadOnly("get-line");
   int idx = scm_to_int(idx_scm);
   if (idx < 0 || idx >= E.numrows) return SCM_BOOL_F;
   erow *row = &E.row[idx];
@@ -264,9 +572,12 @@ SCM scmGetLine(SCM idx_scm) {
  * @note Scheme procedure: set-line! idx text
  * @param idx_scm Scheme integer line index (0-based).
  * @param str_scm Scheme string new contents.
- * @return \c SCM_BOOL_T on success, \c SCM_BOOL_F if index is out of range.
+ * @return \c SCM_BOOL_T on success, \c SCM_BOOL_F if index is out of range
+ *         or the pager shows a read-only file.
  */
 SCM scmSetLine(SCM idx_scm, SCM str_scm) {
+  pluginsMainThreadOnly("set-line!");
+  if (bufferReadOnly()) return SCM_BOOL_F;
   int idx = scm_to_int(idx_scm);
   if (idx < 0 || idx >= E.numrows) return SCM_BOOL_F;
   char *text = scm_to_locale_string(str_scm);
@@ -281,9 +592,11 @@ SCM scmSetLine(SCM idx_scm, SCM str_scm) {
  * @note Scheme procedure: insert-line! idx text
  * @param idx_scm Scheme integer index (clamped to [0, line-count]).
  * @param str_scm Scheme string new line text (without trailing newline).
- * @return \c SCM_BOOL_T.
+ * @return \c SCM_BOOL_T, or \c SCM_BOOL_F while the pager shows a read-only file.
  */
 SCM scmInsertLine(SCM idx_scm, SCM str_scm) {
+  pluginsMainThreadOnly("insert-line!");
+  if (bufferReadOnly()) return SCM_BOOL_F;
   int idx = scm_to_int(idx_scm);
   if (idx < 0) idx = 0;
   if (idx > E.numrows) idx = E.numrows;
@@ -298,9 +611,11 @@ SCM scmInsertLine(SCM idx_scm, SCM str_scm) {
  * @ingroup plugins
  * @note Scheme procedure: append-line! text
  * @param str_scm Scheme string new line text.
- * @return \c SCM_BOOL_T.
+ * @return \c SCM_BOOL_T, or \c SCM_BOOL_F while the pager shows a read-only file.
  */
 SCM scmAppendLine(SCM str_scm) {
+  pluginsMainThreadOnly("append-line!");
+  if (bufferReadOnly()) return SCM_BOOL_F;
   char *text = scm_to_locale_string(str_scm);
   editorInsertRow(E.numrows, text, strlen(text));
   free(text);
@@ -312,9 +627,12 @@ SCM scmAppendLine(SCM str_scm) {
  * @ingroup plugins
  * @note Scheme procedure: delete-line! idx
  * @param idx_scm Scheme integer line index (0-based).
- * @return \c SCM_BOOL_T on success, \c SCM_BOOL_F if out of range.
+ * @return \c SCM_BOOL_T on success, \c SCM_BOOL_F if out of range or the
+ *         pager shows a read-only file.
  */
 SCM scmDeleteLine(SCM idx_scm) {
+  pluginsMainThreadOnly("delete-line!");
+  if (bufferReadOnly()) return SCM_BOOL_F;
   int idx = scm_to_int(idx_scm);
   if (idx < 0 || idx >= E.numrows) return SCM_BOOL_F;
   editorDelRow(idx);
@@ -326,9 +644,11 @@ SCM scmDeleteLine(SCM idx_scm) {
  * @ingroup plugins
  * @note Scheme procedure: insert-text! text
  * @param str_scm Scheme string text (may contain newlines).
- * @return \c SCM_BOOL_T.
+ * @return \c SCM_BOOL_T, or \c SCM_BOOL_F while the pager shows a read-only file.
  */
 SCM scmInsertText(SCM str_scm) {
+  pluginsMainThreadOnly("insert-text!");
+  if (bufferReadOnly()) return SCM_BOOL_F;
   char *text = scm_to_locale_string(str_scm);
   for (size_t i = 0; text[i] != '\0'; i++) {
     if (text[i] == '\n') editorInsertNewline();
@@ -343,9 +663,11 @@ SCM scmInsertText(SCM str_scm) {
  * @ingroup plugins
  * @note Scheme procedure: insert-char! ch
  * @param ch_scm Either a Scheme integer char code or a one-char string.
- * @return \c SCM_BOOL_T.
+ * @return \c SCM_BOOL_T, or \c SCM_BOOL_F while the pager shows a read-only file.
  */
 SCM scmInsertChar(SCM ch_scm) {
+  pluginsMainThreadOnly("insert-char!");
+  if (bufferReadOnly()) return SCM_BOOL_F;
   if (scm_is_integer(ch_scm)) {
     int c = scm_to_int(ch_scm);
     editorInsertChar(c);
@@ -361,9 +683,11 @@ SCM scmInsertChar(SCM ch_scm) {
  * @brief Insert a newline at the cursor position.
  * @ingroup plugins
  * @note Scheme procedure: insert-newline!
- * @return \c SCM_BOOL_T.
+ * @return \c SCM_BOOL_T, or \c SCM_BOOL_F while the pager shows a read-only file.
  */
 SCM scmInsertNewline(void) {
+  pluginsMainThreadOnly("insert-newline!");
+  if (bufferReadOnly()) return SCM_BOOL_F;
   editorInsertNewline();
   return SCM_BOOL_T;
 }
@@ -372,13 +696,204 @@ SCM scmInsertNewline(void) {
  * @brief Delete the character to the left of the cursor (backspace).
  * @ingroup plugins
  * @note Scheme procedure: delete-char!
- * @return \c SCM_BOOL_T.
+ * @return \c SCM_BOOL_T, or \c SCM_BOOL_F while the pager shows a read-only file.
  */
 SCM scmDeleteChar(void) {
+  pluginsMainThreadOnly("delete-char!");
+  if (bufferReadOnly()) return SCM_BOOL_F;
   editorDelChar();
   return SCM_BOOL_T;
 }
 
+/* Set by refresh-screen! inside a batch; the batch's end redraws instead. */
+static int batch_refresh = 0;
+
+static void batchUnwind(void *data) {
+  (void)data;
+  editorBatchEnd();
+  if (!editorBatchActive() && batch_refresh) {
+    batch_refresh = 0;
+    editorRefreshScreen();
+  }
+}
+
+/**
+ * @brief Call a thunk with row edits batched.
+ * @ingroup plugins
+ * @note Scheme procedure: call-with-edit-batch thunk
+ *
+ * Edits made by @p thunk update the text at once but defer syntax
+ * highlighting to the end of the call, when every edited line is highlighted
+ * in a single pass; @c refresh-screen! is likewise put off until then. The
+ * batch ends however @p thunk exits. @c with-buffer-batch wraps a body in a
+ * thunk for this.
+ *
+ * @param thunk Procedure of no arguments.
+ * @return What @p thunk returns, or \c SCM_BOOL_F if it is not a procedure.
+ * @sa editorBatchBegin()
+ */
+SCM scmCallWithEditBatch(SCM thunk) {
+  pluginsMainThreadOnly("call-with-edit-batch");
+  if (scm_is_false(scm_procedure_p(thunk))) return SCM_BOOL_F;
+  scm_dynwind_begin(0);
+  editorBatchBegin();
+  scm_dynwind_unwind_handler(batchUnwind, NULL, SCM_F_WIND_EXPLICITLY);
+  SCM result = scm_call_0(thunk);
+  scm_dynwind_end();
+  return result;
+}
+
+// ===== Bulk line access =====
+
+/* Clip an optional [start, end) line range to the buffer; 0 if a bound is not an integer. */
+static int lineRange(SCM start_scm, SCM end_scm, int *start, int *end) {
+  if ((!SCM_UNBNDP(start_scm) && !scm_is_integer(start_scm)) ||
+      (!SCM_UNBNDP(end_scm) && !scm_is_integer(end_scm))) {
+    return 0;
+  }
+  *start = SCM_UNBNDP(start_scm) ? 0 : scm_to_int(start_scm);
+  *end = SCM_UNBNDP(end_scm) ? E.numrows : scm_to_int(end_scm);
+  if (*start < 0) *start = 0;
+  if (*start > E.numrows) *start = E.numrows;
+  if (*end > E.numrows) *end = E.numrows;
+  if (*end < *start) *end = *start;
+  return 1;
+}
+
+/* Keep the cursor inside the buffer after lines were removed or shortened. */
+static void clampCursor(void) {
+  if (E.cy > E.numrows) E.cy = E.numrows;
+  int rowlen = (E.cy >= E.numrows) ? 0 : E.row[E.cy].size;
+  if (E.cx > rowlen) E.cx = rowlen;
+}
+
+/**
+ * @brief Get a range of lines as a vector of strings.
+ * @ingroup plugins
+ * @note Scheme procedure: get-lines [start [end]]
+ * @param start_scm First line (0-based); defaults to 0.
+ * @param end_scm Line after the last; defaults to the line count.
+ * @return Scheme vector with one string per line, without newlines, or
+ *         \c SCM_BOOL_F if a bound is not an integer.
+ */
+SCM scmGetLines(SCM start_scm, SCM end_scm) {
+  pluginsMainThreadOnly("get-lines");
+  int start, end;
+  if (!lineRange(start_scm, end_scm, &start, &end)) return SCM_BOOL_F;
+  SCM lines = scm_c_make_vector((size_t)(end - start), SCM_BOOL_F);
+  for (int i = start; i < end; i++) {
+    erow *row = &E.row[i];
+    scm_c_vector_set_x(lines, (size_t)(i - start),
+                       scm_from_locale_stringn(row->chars, (size_t)row->size));
+  }
+  return lines;
+}
+
+/**
+ * @brief Replace a range of lines with the strings of a vector.
+ * @ingroup plugins
+ * @note Scheme procedure: set-lines! start end lines
+ *
+ * Lines @p start up to @p end are replaced by the elements of @p lines,
+ * which may be longer or shorter than the range; lines are inserted or
+ * deleted to match. Lines whose text is unchanged are left alone, and the
+ * whole replacement is highlighted once as an edit batch.
+ *
+ * @param start_scm First line to replace (0-based).
+ * @param end_scm Line after the last to replace; equal to @p start_scm to insert.
+ * @param lines_scm Vector of strings.
+ * @return \c SCM_BOOL_T, or \c SCM_BOOL_F if an argument has the wrong type
+ *         or the pager shows a read-only file.
+ */
+SCM scmSetLines(SCM start_scm, SCM end_scm, SCM lines_scm) {
+  pluginsMainThreadOnly("set-lines!");
+  if (bufferReadOnly()) return SCM_BOOL_F;
+  if (!scm_is_integer(start_scm) || !scm_is_integer(end_scm) || !scm_is_vector(lines_scm)) {
+    return SCM_BOOL_F;
+  }
+  size_t n = scm_c_vector_length(lines_scm);
+  for (size_t i = 0; i < n; i++) {
+    if (!scm_is_string(scm_c_vector_ref(lines_scm, i))) return SCM_BOOL_F;
+  }
+  int start, end;
+  lineRange(start_scm, end_scm, &start, &end);
+  /* Conversion can throw; the dynwind frees whatever was converted so far. */
+  scm_dynwind_begin(0);
+  char **text = calloc(n + 1, sizeof(char *));
+  size_t *len = malloc(sizeof(size_t) * (n + 1));
+  scm_dynwind_free(text);
+  scm_dynwind_free(len);
+  for (size_t i = 0; i < n; i++) {
+    text[i] = scm_to_locale_stringn(scm_c_vector_ref(lines_scm, i), &len[i]);
+    scm_dynwind_free(text[i]);
+  }
+  int old = end - start;
+  int common = (int)n < old ? (int)n : old;
+  editorBatchBegin();
+  for (int i = 0; i < common; i++) {
+    erow *row = &E.row[start + i];
+    if ((size_t)row->size != len[i] || memcmp(row->chars, text[i], len[i]) != 0) {
+      editorRowSetText(row, text[i], len[i]);
+    }
+  }
+  if ((int)n < old) {
+    editorDelRows(start + common, old - common);
+  } else if ((int)n > old) {
+    editorInsertRows(end, text + common, len + common, (int)n - common);
+  }
+  editorBatchEnd();
+  clampCursor();
+  scm_dynwind_end();
+  return SCM_BOOL_T;
+}
+
+/**
+ * @brief Rewrite a range of lines through a procedure.
+ * @ingroup plugins
+ * @note Scheme procedure: map-lines! proc [start [end]]
+ *
+ * Calls @p proc with the text of each line in turn. A string result that
+ * differs from the line replaces it; returning the line itself, @c #f, or
+ * anything else leaves it unchanged. The loop runs in C as one edit batch,
+ * so only changed lines are rewritten and they are highlighted once when
+ * it finishes.
+ *
+ * @param proc Procedure of one argument.
+ * @param start_scm First line (0-based); defaults to 0.
+ * @param end_scm Line after the last; defaults to the line count.
+ * @return Number of lines changed, or \c SCM_BOOL_F if @p proc is not a
+ *         procedure, a bound is not an integer, or the pager shows a
+ *         read-only file.
+ */
+SCM scmMapLines(SCM proc, SCM start_scm, SCM end_scm) {
+  pluginsMainThreadOnly("map-lines!");
+  if (bufferReadOnly()) return SCM_BOOL_F;
+  if (scm_is_false(scm_procedure_p(proc))) return SCM_BOOL_F;
+  int start, end;
+  if (!lineRange(start_scm, end_scm, &start, &end)) return SCM_BOOL_F;
+  int changed = 0;
+  scm_dynwind_begin(0);
+  editorBatchBegin();
+  scm_dynwind_unwind_handler(batchUnwind, NULL, SCM_F_WIND_EXPLICITLY);
+  /* proc may edit the buffer itself, so rows are looked up afresh each time. */
+  for (int i = start; i < end && i < E.numrows; i++) {
+    SCM line = scm_from_locale_stringn(E.row[i].chars, (size_t)E.row[i].size);
+    SCM out = scm_call_1(proc, line);
+    if (scm_is_eq(out, line) || !scm_is_string(out) || i >= E.numrows) continue;
+    size_t len;
+    char *text = scm_to_locale_stringn(out, &len);
+    erow *row = &E.row[i];
+    if ((size_t)row->size != len || memcmp(row->chars, text, len) != 0) {
+      editorRowSetText(row, text, len);
+      changed++;
+    }
+    free(text);
+  }
+  scm_dynwind_end();
+  clampCursor();
+  return scm_from_int(changed);
+}
+
 // ===== Cursor and viewport =====
 
 /**
@@ -388,6 +903,7 @@ SCM scmDeleteChar(void) {
  * @return Scheme pair (x . y) in editor column/line coordinates.
  */
 SCM scmGetCursor(void) {
+  pluginsMainThreadOnly("get-cursor");
   SCM x = scm_from_int(E.cx);
   SCM y = scm_from_int(E.cy);
   return scm_list_2(x, y);
@@ -402,6 +918,7 @@ SCM scmGetCursor(void) {
  * @return \c SCM_BOOL_T.
  */
 SCM scmSetCursor(SCM x_scm, SCM y_scm) {
+  pluginsMainThreadOnly("set-cursor!");
   int x = scm_to_int(x_scm);
   int y = scm_to_int(y_scm);
   if (y < 0) y = 0;
@@ -422,6 +939,7 @@ SCM scmSetCursor(SCM x_scm, SCM y_scm) {
  * @return \c SCM_BOOL_T.
  */
 SCM scmMoveCursor(SCM dir_scm) {
+  pluginsMainThreadOnly("move-cursor!");
   char *dir = scm_to_locale_string(dir_scm);
   if (strcasecmp(dir, "left") == 0) editorMoveCursor(ARROW_LEFT);
   else if (strcasecmp(dir, "right") == 0) editorMoveCursor(ARROW_RIGHT);
@@ -431,6 +949,19 @@ SCM scmMoveCursor(SCM dir_scm) {
   return SCM_BOOL_T;
 }
 
+/**
+ * @brief Turn soft wrapping of long lines on or off.
+ * @ingroup plugins
+ * @note Scheme procedure: set-soft-wrap! on
+ * @param on_scm Scheme boolean; true wraps rows at the screen width.
+ * @return \c SCM_BOOL_T.
+ */
+SCM scmSetSoftWrap(SCM on_scm) {
+  pluginsMainThreadOnly("set-soft-wrap!");
+  editorSetSoftWrap(scm_is_true(on_scm));
+  return SCM_BOOL_T;
+}
+
 /**
  * @brief Get the editor screen size in rows and columns.
  * @ingroup plugins
@@ -438,6 +969,7 @@ SCM scmMoveCursor(SCM dir_scm) {
  * @return Scheme pair (rows . cols).
  */
 SCM scmScreenSize(void) {
+  pluginsMainThreadOnly("screen-size");
   return scm_list_2(scm_from_int(E.screenrows), scm_from_int(E.screencols));
 }
 
@@ -451,20 +983,103 @@ SCM scmScreenSize(void) {
  * @return \c SCM_BOOL_T.
  */
 SCM scmOpenFile(SCM path_scm) {
+  pluginsMainThreadOnly("open-file!");
   char *path = scm_to_locale_string(path_scm);
   editorOpen(path);
   free(path);
   return SCM_BOOL_T;
 }
 
+/**
+ * @brief Turn follow mode on or off for the open file.
+ * @ingroup plugins
+ * @note Scheme procedure: follow-file! on [pin]
+ *
+ * While on, lines appended to the file show up at the end of the buffer,
+ * and a truncated or rotated file is reloaded.
+ * @param on_scm Scheme boolean.
+ * @param pin_scm Optional Scheme boolean: keep the view on the last line
+ *                while the cursor is there.
+ * @return \c SCM_BOOL_T if the file is being followed, else \c SCM_BOOL_F.
+ */
+SCM scmFollowFile(SCM on_scm, SCM pin_scm) {
+  pluginsMainThreadOnly("follow-file!");
+  if (!scm_is_true(on_scm)) {
+    followStop();
+    return SCM_BOOL_F;
+  }
+  int pin = !SCM_UNBNDP(pin_scm) && scm_is_true(pin_scm);
+  return followStart(pin) ? SCM_BOOL_T : SCM_BOOL_F;
+}
+
 /**
  * @brief Save the current buffer to disk.
  * @ingroup plugins
  * @note Scheme procedure: save-file!
+ *
+ * Unlike C-w, waits for the write to finish before returning.
  * @return \c SCM_BOOL_T.
  */
 SCM scmSaveFile(void) {
+  pluginsMainThreadOnly("save-file!");
   editorSave();
+  editorSaveWait();
+  return SCM_BOOL_T;
+}
+
+/**
+ * @brief Choose how durably save-file! and C-w commit a file to disk.
+ * @ingroup plugins
+ * @note Scheme procedure: set-save-durability! level
+ * @param level_scm Scheme string: "none", "data", or "full".
+ * @return \c SCM_BOOL_T, or \c SCM_BOOL_F for an unknown level.
+ */
+SCM scmSetSaveDurability(SCM level_scm) {
+  pluginsMainThreadOnly("set-save-durability!");
+  char *level = scm_to_locale_string(level_scm);
+  int ok = 1;
+  if (strcasecmp(level, "none") == 0) E.savesync = SAVE_SYNC_NONE;
+  else if (strcasecmp(level, "data") == 0) E.savesync = SAVE_SYNC_DATA;
+  else if (strcasecmp(level, "full") == 0) E.savesync = SAVE_SYNC_FULL;
+  else ok = 0;
+  free(level);
+  return ok ? SCM_BOOL_T : SCM_BOOL_F;
+}
+
+/**
+ * @brief Set the compression level used when saving gzip and zstd files.
+ * @ingroup plugins
+ * @note Scheme procedure: set-compression-level! level
+ * The level is checked against the current buffer's format, or against
+ * the widest range of the built-in formats when the buffer is plain.
+ * @param level_scm Scheme integer: 1-9 for gzip, 1-19 for zstd, or 0 for
+ *                  the format's default.
+ * @return \c SCM_BOOL_T, or \c SCM_BOOL_F if the level is out of range.
+ */
+SCM scmSetCompressionLevel(SCM level_scm) {
+  pluginsMainThreadOnly("set-compression-level!");
+  if (!scm_is_integer(level_scm)) return SCM_BOOL_F;
+  int kind = E.compress;
+  if (kind == COMPRESS_NONE && E.filename) kind = compressForName(E.filename);
+  int level = scm_to_int(level_scm);
+  if (level < 0 || level > compressMaxLevel(kind)) return SCM_BOOL_F;
+  E.compresslevel = level;
+  return SCM_BOOL_T;
+}
+
+/**
+ * @brief Set the file size from which files open read-only in the pager.
+ * @ingroup plugins
+ * @note Scheme procedure: set-pager-threshold! bytes
+ *
+ * Plain files at least this large are shown a window at a time instead of
+ * being loaded. The default is a quarter of physical memory.
+ * @param bytes_scm Scheme integer byte count, or 0 to always load files.
+ * @return \c SCM_BOOL_T.
+ */
+SCM scmSetPagerThreshold(SCM bytes_scm) {
+  pluginsMainThreadOnly("set-pager-threshold!");
+  E.pagerlimit = (off_t)scm_to_int64(bytes_scm);
   return SCM_BOOL_T;
 }
 
@@ -475,6 +1090,7 @@ SCM scmSaveFile(void) {
  * @return Scheme string filename, or \c SCM_BOOL_F if unnamed.
  */
 SCM scmGetFilename(void) {
+  pluginsMainThreadOnly("get-filename");
   if (E.filename == NULL) return SCM_BOOL_F;
   return scm_from_locale_string(E.filename);
 }
@@ -487,6 +1103,7 @@ SCM scmGetFilename(void) {
  * @return \c SCM_BOOL_T.
  */
 SCM scmSetFilename(SCM path_scm) {
+  pluginsMainThreadOnly("set-filename!");
   char *path = scm_to_locale_string(path_scm);
   if (E.filename) free(E.filename);
   E.filename = strdup(path);
@@ -505,8 +1122,11 @@ SCM scmSetFilename(SCM path_scm) {
  * @return Scheme string response, or \c SCM_BOOL_F on cancel.
  */
 SCM scmPrompt(SCM msg_scm) {
+  pluginsMainThreadOnly("prompt");
   char *msg = scm_to_locale_string(msg_scm);
+  profilePause();
   char *resp = editorPrompt(msg, NULL);
+  profileResume();
   free(msg);
   if (resp == NULL) return SCM_BOOL_F;
   SCM out = scm_from_locale_string(resp);
@@ -518,9 +1138,17 @@ SCM scmPrompt(SCM msg_scm) {
  * @brief Force a screen refresh.
  * @ingroup plugins
  * @note Scheme procedure: refresh-screen!
+ *
+ * Inside an edit batch the refresh happens when the batch ends.
+ *
  * @return \c SCM_BOOL_T.
  */
 SCM scmRefreshScreen(void) {
+  pluginsMainThreadOnly("refresh-screen!");
+  if (editorBatchActive()) {
+    batch_refresh = 1;
+    return SCM_BOOL_T;
+  }
   editorRefreshScreen();
   return SCM_BOOL_T;
 }
@@ -535,27 +1163,81 @@ SCM scmRefreshScreen(void) {
  * @return Pair (y . x) of the match position, or \c SCM_BOOL_F if not found.
  */
 SCM scmSearchForward(SCM query_scm) {
+  pluginsMainThreadOnly("search-forward!");
   char *query = scm_to_locale_string(query_scm);
   if (!query || query[0] == '\0') { if (query) free(query); return SCM_BOOL_F; }
-  int start = E.cy;
-  int current = start;
-  for (int i = 0; i < E.numrows; i++) {
-    current++;
-    if (current >= E.numrows) current = 0;
-    erow *row = &E.row[current];
-    if (!row->render) editorUpdateRow(row);
-    char *match = strstr(row->render, query);
-    if (match) {
-      E.cy = current;
-      E.cx = editorRowRxToCx(row, (int)(match - row->render));
-      E.rowoff = E.numrows; // force scroll to center-ish on next refresh
-      SCM result = scm_list_2(scm_from_int(E.cy), scm_from_int(E.cx));
-      free(query);
-      return result;
-    }
+  int cx;
+  int current = editorSearchRows(query, (int)strlen(query), E.cy, 1, &cx);
+  free(query);
+  if (current == -1) {
+    return SCM_BOOL_F;
+  }
+  E.cy = current;
+  E.cx = cx;
+  E.rowoff = E.numrows; // force scroll to center-ish on next refresh
+  return scm_list_2(scm_from_int(E.cy), scm_from_int(E.cx));
+}
+
+/**
+ * @brief Search forward for a regular expression and jump to the next match.
+ * @ingroup plugins
+ * @note Scheme procedure: search-regex! pattern
+ * @param pattern_scm Scheme string holding a POSIX extended regular expression.
+ * @return List (y x len) of the match position and length, or \c SCM_BOOL_F
+ *         if not found or the pattern is invalid (the error is shown in the
+ *         status bar).
+ */
+SCM scmSearchRegex(SCM pattern_scm) {
+  pluginsMainThreadOnly("search-regex!");
+  char *pattern = scm_to_locale_string(pattern_scm);
+  if (!pattern || pattern[0] == '\0') { if (pattern) free(pattern); return SCM_BOOL_F; }
+  int cx, len;
+  const char *error;
+  int current = editorSearchRowsRegex(pattern, E.cy, 1, &cx, &len, &error);
+  free(pattern);
+  if (error) {
+    editorSetStatusMessage("Bad regex: %s", error);
+    return SCM_BOOL_F;
+  }
+  if (current == -1) {
+    return SCM_BOOL_F;
   }
+  E.cy = current;
+  E.cx = cx;
+  E.rowoff = E.numrows; // force scroll to center-ish on next refresh
+  return scm_list_3(scm_from_int(E.cy), scm_from_int(E.cx), scm_from_int(len));
+}
+
+/**
+ * @brief Replace every match in the buffer.
+ * @ingroup plugins
+ * @note Scheme procedure: replace-all! query replacement [regex]
+ * @param query_scm Scheme string to find; a regular expression if
+ *        @p regex_scm is true.
+ * @param with_scm Scheme string to insert in place of each match.
+ * @param regex_scm Optional boolean; defaults to \c #f.
+ * @return Number of replacements, or \c SCM_BOOL_F if the query is empty or
+ *         an invalid regex (the error is shown in the status bar), or the
+ *         pager shows a read-only file.
+ */
+SCM scmReplaceAll(SCM query_scm, SCM with_scm, SCM regex_scm) {
+  pluginsMainThreadOnly("replace-all!");
+  if (bufferReadOnly()) return SCM_BOOL_F;
+  char *query = scm_to_locale_string(query_scm);
+  char *with = scm_to_locale_string(with_scm);
+  int regex = !SCM_UNBNDP(regex_scm) && scm_is_true(regex_scm);
+  int rows;
+  const char *error;
+  int count = editorReplaceAll(query, with, regex, &rows, &error);
   free(query);
-  return SCM_BOOL_F;
+  free(with);
+  if (count < 0) {
+    editorSetStatusMessage("Replace failed: %s", error);
+    return SCM_BOOL_F;
+  }
+  editorSetStatusMessage("Replaced %d occurrence%s in %d line%s", count, count == 1 ? "" : "s",
+                         rows, rows == 1 ? "" : "s");
+  return scm_from_int(count);
 }
 
 // ===== Syntax highlighting =====
@@ -568,6 +1250,7 @@ SCM scmSearchForward(SCM query_scm) {
  * @return \c SCM_BOOL_T.
  */
 SCM scmSelectSyntaxForFilename(SCM path_scm) {
+  pluginsMainThreadOnly("select-syntax-for-filename!");
   char *path = scm_to_locale_string(path_scm);
   char *old = E.filename ? strdup(E.filename) : NULL;
   if (E.filename) { free(E.filename); }
@@ -585,6 +1268,7 @@ SCM scmSelectSyntaxForFilename(SCM path_scm) {
  * @return Scheme string filetype, or \c SCM_BOOL_F if none.
  */
 SCM scmGetFiletype(void) {
+  pluginsMainThreadOnly("get-filetype");
   if (E.syntax == NULL || E.syntax->filetype == NULL) return SCM_BOOL_F;
   return scm_from_locale_string(E.syntax->filetype);
 }
@@ -599,6 +1283,7 @@ SCM scmGetFiletype(void) {
  * @return \c SCM_BOOL_T.
  */
 SCM scmUnbindKey(SCM keySpec) {
+  pluginsMainThreadOnly("unbind-key");
   char *spec = scm_to_locale_string(keySpec);
   unsigned char code = 0;
   if (!parse_keyspec(spec, &code)) { free(spec); return SCM_BOOL_F; }
@@ -618,6 +1303,7 @@ SCM scmUnbindKey(SCM keySpec) {
  * @return Scheme list of pairs (key . procedure).
  */
 SCM scmListBindings(void) {
+  pluginsMainThreadOnly("list-bindings");
   SCM list = SCM_EOL;
   for (int i = 255; i >= 0; i--) {
     if (scm_is_true(key_bindings[i])) {
@@ -638,6 +1324,7 @@ SCM scmListBindings(void) {
  * @return Scheme boolean.
  */
 SCM scmBufferDirty(void) {
+  pluginsMainThreadOnly("buffer-dirty?");
   return scm_from_bool(E.dirty != 0);
 }
 
@@ -649,6 +1336,7 @@ SCM scmBufferDirty(void) {
  * @return \c SCM_BOOL_T.
  */
 SCM scmSetBufferDirty(SCM bool_scm) {
+  pluginsMainThreadOnly("set-buffer-dirty!");
   E.dirty = scm_is_true(bool_scm) ? 1 : 0;
   return SCM_BOOL_T;
 }
@@ -662,6 +1350,7 @@ SCM scmSetBufferDirty(SCM bool_scm) {
  * @return \c SCM_BOOL_T.
  */
 SCM scmCloneTemplate(void) {
+  pluginsMainThreadOnly("clone-template!");
   editorCloneTemplate();
   return SCM_BOOL_T;
 }
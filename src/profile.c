@@ -0,0 +1,486 @@
+/**
+ * @file profile.c
+ * @brief Plugin profiler implementation.
+ * @ingroup profile
+ *
+ * Every key binding, hook, and C-x evaluation is timed. Calls are counted
+ * per site and procedure, e.g. the 'post-save hook save-and-format, with
+ * total and worst time and a log2 histogram of latencies. A call on the
+ * main thread that takes longer than the budget leaves a warning in the
+ * status bar.
+ *
+ * With aborting enabled, a watchdog thread also waits for the budget to run
+ * out. It then marks an async on the main thread that throws
+ * @c 'plugin-over-budget, caught around the call. Guile only runs asyncs
+ * between Scheme instructions, so a call blocked inside C code is stopped
+ * once it returns to Scheme.
+ */
+#include "ze.h"
+
+#include <libguile.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "status.h"
+#include "profile.h"
+
+/** Totals for one procedure called from one site. */
+struct profileEntry {
+  SCM proc;                          /**< Procedure, or #f for C-x evaluations. */
+  char *where;                       /**< Key spec, event name, or "eval". */
+  char *label;                       /**< @c where and the procedure's name. */
+  long long calls;
+  long long total;                   /**< Nanoseconds, all calls. */
+  long long max;                     /**< Nanoseconds, slowest call. */
+  long long over;                    /**< Calls over the budget. */
+  long long hist[PROFILE_BUCKETS];
+};
+
+static struct profileEntry *entries = NULL;
+static int nentries = 0;
+/* Entries are also added to by async hooks on worker threads. */
+static pthread_mutex_t entries_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int budget_ms = PROFILE_DEFAULT_BUDGET;
+static int budget_abort = 0;
+
+static pthread_t main_thread;
+static SCM main_scm_thread = SCM_BOOL_F;
+static SCM over_budget_key = SCM_BOOL_F;
+static SCM interrupt_proc = SCM_BOOL_F;
+static int depth = 0;
+static unsigned armed = 0;           /* Ticket of the outermost call running, or 0. */
+static unsigned next_seq = 0;
+static long long armed_deadline = 0; /* When the armed call runs out of budget. */
+static long long paused_total = 0;   /* Time spent waiting on the user, in nanoseconds. */
+static long long pause_start = 0;
+static int pauses = 0;
+
+/* Watchdog state, shared with its thread. */
+static pthread_mutex_t watch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t watch_wake;
+static long long watch_deadline = 0; /* 0 while nothing is armed. */
+static unsigned watch_seq = 0;
+static _Atomic unsigned fired = 0;
+static int watch_started = 0;
+
+static long long profileNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Histogram bucket of a call that took @p ns. */
+static int profileBucket(long long ns) {
+  long long us = ns / 1000;
+  int b = 0;
+  while (us > 0 && b < PROFILE_BUCKETS - 1) {
+    us >>= 1;
+    b++;
+  }
+  return b;
+}
+
+/* Async run on the main thread once the watchdog fires. */
+static SCM profileInterrupt(void) {
+  /* The call it was meant for may have finished in the meantime. */
+  if (armed != 0 && atomic_load(&fired) == armed) {
+    scm_throw(over_budget_key, SCM_EOL);
+  }
+  return SCM_UNSPECIFIED;
+}
+
+/**
+ * @brief Note the main thread and register the Scheme side of the profiler.
+ * @ingroup profile
+ *
+ * @pre Called once on the main thread, after scm_init_guile().
+ */
+void profileInit(void) {
+  main_thread = pthread_self();
+  main_scm_thread = scm_permanent_object(scm_current_thread());
+  over_budget_key = scm_permanent_object(scm_from_utf8_symbol("plugin-over-budget"));
+  interrupt_proc = scm_permanent_object(
+      scm_c_make_gsubr("ze-plugin-interrupt", 0, 0, 0, (scm_t_subr)&profileInterrupt));
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&watch_wake, &attr);
+  pthread_condattr_destroy(&attr);
+}
+
+/* Without Guile: sleep until an armed deadline passes; return its ticket. */
+static void *profileWatchWait(void *data) {
+  (void)data;
+  pthread_mutex_lock(&watch_lock);
+  for (;;) {
+    if (watch_deadline == 0) {
+      pthread_cond_wait(&watch_wake, &watch_lock);
+      continue;
+    }
+    if (profileNow() >= watch_deadline) {
+      unsigned seq = watch_seq;
+      watch_deadline = 0;
+      pthread_mutex_unlock(&watch_lock);
+      return (void *)(uintptr_t)seq;
+    }
+    struct timespec ts = {watch_deadline / 1000000000LL, watch_deadline % 1000000000LL};
+    pthread_cond_timedwait(&watch_wake, &watch_lock, &ts);
+  }
+}
+
+static void *profileWatch(void *data) {
+  for (;;) {
+    unsigned seq = (unsigned)(uintptr_t)scm_without_guile(profileWatchWait, data);
+    atomic_store(&fired, seq);
+    scm_system_async_mark_for_thread(interrupt_proc, main_scm_thread);
+  }
+  return NULL;
+}
+
+static void *profileWatchThread(void *data) {
+  return scm_with_guile(profileWatch, data);
+}
+
+/**
+ * @brief Set the time budget for plugin calls on the main thread.
+ * @ingroup profile
+ *
+ * @param[in] ms Budget in milliseconds; 0 turns warnings off.
+ * @param[in] abort Nonzero to also stop calls that run over.
+ */
+void profileSetBudget(int ms, int abort) {
+  budget_ms = ms > 0 ? ms : 0;
+  budget_abort = abort && budget_ms > 0;
+  if (budget_abort && !watch_started) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, profileWatchThread, NULL) == 0) {
+      pthread_detach(thread);
+      watch_started = 1;
+    } else {
+      budget_abort = 0;
+    }
+  }
+}
+
+/**
+ * @brief Start timing a plugin call.
+ * @ingroup profile
+ *
+ * On the main thread the outermost call is also the one the budget applies
+ * to; calls it makes are timed but not held to the budget on their own.
+ *
+ * @param[out] m Mark to pass to profileEnd().
+ */
+void profileBegin(struct profileMark *m) {
+  m->start = profileNow();
+  m->seq = 0;
+  m->aborted = 0;
+  m->paused = 0;
+  if (!pthread_equal(pthread_self(), main_thread)) {
+    m->depth = -1;
+    return;
+  }
+  m->paused = paused_total;
+  m->depth = depth++;
+  if (m->depth == 0 && budget_abort) {
+    if (++next_seq == 0) {
+      next_seq = 1;
+    }
+    m->seq = armed = next_seq;
+    armed_deadline = m->start + (long long)budget_ms * 1000000LL;
+    pthread_mutex_lock(&watch_lock);
+    watch_deadline = armed_deadline;
+    watch_seq = m->seq;
+    pthread_cond_signal(&watch_wake);
+    pthread_mutex_unlock(&watch_lock);
+  }
+}
+
+/**
+ * @brief Whether the caller runs on the main thread.
+ * @ingroup profile
+ *
+ * Async hooks run on worker threads; they may read the snapshot they were
+ * given but must not touch the editor state.
+ */
+int profileOnMainThread(void) {
+  return pthread_equal(pthread_self(), main_thread);
+}
+
+/**
+ * @brief Stop the clock while a plugin call waits on the user.
+ * @ingroup profile
+ *
+ * Time until the matching profileResume() is left out of the calls running
+ * on the main thread, and the watchdog is held off meanwhile, so a binding
+ * that prompts is neither warned about nor stopped for the user's typing.
+ */
+void profilePause(void) {
+  if (!profileOnMainThread() || pauses++ > 0) {
+    return;
+  }
+  pause_start = profileNow();
+  if (armed) {
+    pthread_mutex_lock(&watch_lock);
+    if (watch_seq == armed) {
+      watch_deadline = 0;
+    }
+    pthread_mutex_unlock(&watch_lock);
+  }
+}
+
+/**
+ * @brief Restart the clock stopped by profilePause().
+ * @ingroup profile
+ */
+void profileResume(void) {
+  if (!profileOnMainThread() || pauses == 0 || --pauses > 0) {
+    return;
+  }
+  long long waited = profileNow() - pause_start;
+  paused_total += waited;
+  if (armed) {
+    armed_deadline += waited;
+    pthread_mutex_lock(&watch_lock);
+    /* Unless it already fired before the wait: that throw is still due. */
+    if (watch_seq == armed && atomic_load(&fired) != armed) {
+      watch_deadline = armed_deadline;
+      pthread_cond_signal(&watch_wake);
+    }
+    pthread_mutex_unlock(&watch_lock);
+  }
+}
+
+/* Entry for @p proc called from @p where, or NULL. Caller holds entries_lock. */
+static struct profileEntry *profileEntryFor(const char *where, SCM proc) {
+  for (int i = 0; i < nentries; i++) {
+    if (scm_is_eq(entries[i].proc, proc) && strcmp(entries[i].where, where) == 0) {
+      return &entries[i];
+    }
+  }
+  return NULL;
+}
+
+/* "where name" for a new entry. */
+static char *profileLabel(const char *where, SCM proc) {
+  SCM name = scm_is_true(proc) ? scm_procedure_name(proc) : SCM_BOOL_F;
+  char *pname = scm_is_symbol(name) ? scm_to_locale_string(scm_symbol_to_string(name)) : NULL;
+  if (scm_is_true(proc) && pname == NULL) {
+    pname = strdup("(lambda)");
+  }
+  size_t len = strlen(where) + (pname ? strlen(pname) + 1 : 0) + 1;
+  char *label = malloc(len);
+  snprintf(label, len, "%s%s%s", where, pname ? " " : "", pname ? pname : "");
+  free(pname);
+  return label;
+}
+
+/**
+ * @brief Stop timing a plugin call and add it to the totals.
+ * @ingroup profile
+ *
+ * An outermost call on the main thread that ran over the budget leaves a
+ * warning in the status bar.
+ *
+ * @param[in,out] m Mark from profileBegin().
+ * @param[in] where Key spec, event name, or "eval".
+ * @param[in] proc Procedure called, or #f.
+ */
+void profileEnd(struct profileMark *m, const char *where, SCM proc) {
+  long long ns = profileNow() - m->start;
+  if (m->depth >= 0) {
+    ns -= paused_total - m->paused;
+  }
+  int over = budget_ms > 0 && ns > (long long)budget_ms * 1000000LL;
+  pthread_mutex_lock(&entries_lock);
+  struct profileEntry *e = profileEntryFor(where, proc);
+  if (e == NULL) {
+    pthread_mutex_unlock(&entries_lock);
+    char *label = profileLabel(where, proc);
+    pthread_mutex_lock(&entries_lock);
+    e = profileEntryFor(where, proc);
+    if (e == NULL) {
+      entries = realloc(entries, sizeof(*entries) * (nentries + 1));
+      e = &entries[nentries++];
+      memset(e, 0, sizeof(*e));
+      e->proc = scm_gc_protect_object(proc);
+      e->where = strdup(where);
+      e->label = label;
+    } else {
+      free(label);
+    }
+  }
+  e->calls++;
+  e->total += ns;
+  if (ns > e->max) {
+    e->max = ns;
+  }
+  e->over += over;
+  e->hist[profileBucket(ns)]++;
+  char label[64];
+  snprintf(label, sizeof(label), "%s", e->label);
+  pthread_mutex_unlock(&entries_lock);
+
+  if (m->depth < 0) {
+    return;
+  }
+  depth = m->depth;
+  if (m->depth > 0) {
+    return;
+  }
+  if (m->seq) {
+    armed = 0;
+    pthread_mutex_lock(&watch_lock);
+    if (watch_seq == m->seq) {
+      watch_deadline = 0;
+    }
+    pthread_mutex_unlock(&watch_lock);
+  }
+  if (m->aborted) {
+    editorSetStatusMessage("Stopped %s after %lld ms (budget %d ms)", label, ns / 1000000, budget_ms);
+  } else if (over) {
+    editorSetStatusMessage("Slow plugin: %s took %lld ms (budget %d ms)", label, ns / 1000000, budget_ms);
+  }
+}
+
+/** Arguments of a call made through profileCall(). */
+struct profileCallArgs {
+  SCM proc;
+  int argc;
+  SCM a, b;
+  struct profileMark *m;
+};
+
+static SCM profileCallBody(void *data) {
+  struct profileCallArgs *c = data;
+  if (c->argc == 0) {
+    return scm_call_0(c->proc);
+  } else if (c->argc == 1) {
+    return scm_call_1(c->proc, c->a);
+  }
+  return scm_call_2(c->proc, c->a, c->b);
+}
+
+static SCM profileCallStopped(void *data, SCM key, SCM args) {
+  struct profileCallArgs *c = data;
+  (void)args;
+  profileStopped(c->m, key);
+  return SCM_UNSPECIFIED;
+}
+
+/**
+ * @brief Note a throw caught around a timed call.
+ * @ingroup profile
+ *
+ * For handlers that catch every key, so a call stopped for its budget is
+ * reported as such rather than as an error.
+ *
+ * @param[in,out] m Mark of the call.
+ * @param[in] key Key thrown.
+ * @return Nonzero, with @p m marked aborted, if @p key is the budget's.
+ */
+int profileStopped(struct profileMark *m, SCM key) {
+  if (!scm_is_eq(key, over_budget_key)) {
+    return 0;
+  }
+  m->aborted = 1;
+  return 1;
+}
+
+/**
+ * @brief Call a plugin procedure, timing it against the budget.
+ * @ingroup profile
+ *
+ * @param[in] where Key spec or event name the call is made for.
+ * @param[in] proc Procedure to call.
+ * @param[in] argc Number of arguments, 0 to 2.
+ * @param[in] a First argument.
+ * @param[in] b Second argument.
+ * @return What @p proc returned; unspecified if it was stopped.
+ */
+SCM profileCall(const char *where, SCM proc, int argc, SCM a, SCM b) {
+  struct profileMark m;
+  struct profileCallArgs c = {proc, argc, a, b, &m};
+  SCM r;
+  profileBegin(&m);
+  if (m.seq) {
+    r = scm_c_catch(over_budget_key, profileCallBody, &c, profileCallStopped, &c, NULL, NULL);
+  } else {
+    r = profileCallBody(&c);
+  }
+  profileEnd(&m, where, proc);
+  return r;
+}
+
+/**
+ * @brief Everything recorded so far, for the @c plugin-stats procedure.
+ * @ingroup profile
+ *
+ * @return List with one association list per procedure and site, with keys
+ *         @c name, @c calls, @c total-ms, @c max-ms, @c over-budget, and
+ *         @c histogram (a vector of counts; element i counts calls under
+ *         2^i microseconds).
+ */
+SCM profileStats(void) {
+  pthread_mutex_lock(&entries_lock);
+  int n = nentries;
+  struct profileEntry *copy = malloc(sizeof(*copy) * (n ? n : 1));
+  memcpy(copy, entries, sizeof(*copy) * n);
+  pthread_mutex_unlock(&entries_lock);
+  SCM list = SCM_EOL;
+  for (int i = n - 1; i >= 0; i--) {
+    struct profileEntry *e = &copy[i];
+    SCM hist = scm_c_make_vector(PROFILE_BUCKETS, scm_from_int(0));
+    for (int b = 0; b < PROFILE_BUCKETS; b++) {
+      scm_c_vector_set_x(hist, b, scm_from_int64(e->hist[b]));
+    }
+    SCM alist = scm_list_n(
+        scm_cons(scm_from_utf8_symbol("name"), scm_from_locale_string(e->label)),
+        scm_cons(scm_from_utf8_symbol("calls"), scm_from_int64(e->calls)),
+        scm_cons(scm_from_utf8_symbol("total-ms"), scm_from_double(e->total / 1e6)),
+        scm_cons(scm_from_utf8_symbol("max-ms"), scm_from_double(e->max / 1e6)),
+        scm_cons(scm_from_utf8_symbol("over-budget"), scm_from_int64(e->over)),
+        scm_cons(scm_from_utf8_symbol("histogram"), hist),
+        SCM_UNDEFINED);
+    list = scm_cons(alist, list);
+  }
+  free(copy);
+  return list;
+}
+
+/**
+ * @brief Show the procedures that took the most time in the status bar.
+ * @ingroup profile
+ */
+void profileShow(void) {
+  char msg[200];
+  int len = 0;
+  pthread_mutex_lock(&entries_lock);
+  int shown[3] = {-1, -1, -1};
+  for (int k = 0; k < 3; k++) {
+    for (int i = 0; i < nentries; i++) {
+      if (i == shown[0] || i == shown[1]) {
+        continue;
+      }
+      if (shown[k] < 0 || entries[i].total > entries[shown[k]].total) {
+        shown[k] = i;
+      }
+    }
+  }
+  for (int k = 0; k < 3 && shown[k] >= 0 && len < (int)sizeof(msg); k++) {
+    struct profileEntry *e = &entries[shown[k]];
+    len += snprintf(msg + len, sizeof(msg) - len, "%s%s %lldx %.1fms max %.1fms",
+                    k ? " | " : "", e->label, e->calls, e->total / 1e6, e->max / 1e6);
+  }
+  pthread_mutex_unlock(&entries_lock);
+  if (len == 0) {
+    editorSetStatusMessage("No plugin calls yet");
+  } else {
+    editorSetStatusMessage("%s", msg);
+  }
+}
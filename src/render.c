@@ -4,7 +4,9 @@
  * @ingroup render
  */
 #include <ctype.h>
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -12,15 +14,178 @@
 #include "row.h"
 #include "buffer.h"
 #include "syntax.h"
+#include "utf8.h"
+#include "search.h"
+#include "pager.h"
 
 extern struct editorConfig E;
 
+/* Cursor position on screen, computed by editorScroll() in soft-wrap mode. */
+static int wrap_cursor_y;
+static int wrap_cursor_x;
+
+/*
+ * Bring the soft-wrap line starts of @p row up to date for the current screen
+ * width. Only lines starting after the row's first edit since the last call
+ * are recomputed; a changed width recomputes the whole row.
+ */
+static void wrapRow(erow *row) {
+  int cols = E.screencols;
+  if (row->wrapcols != cols) {
+    row->wrapcols = cols;
+    row->wrapstale = 0;
+  }
+  if (row->wraps != NULL && row->wrapstale > row->size) {
+    return;
+  }
+  if (row->wraps == NULL) {
+    row->wraps = malloc(sizeof(ewrap) * 8);
+    row->nwraps = 0;
+  }
+  /* Keep every line that starts before the edit; the last one is re-walked. */
+  int keep = 1;
+  while (keep < row->nwraps && row->wraps[keep].cx < row->wrapstale) {
+    keep++;
+  }
+  if (row->nwraps == 0) {
+    row->wraps[0].cx = 0;
+    row->wraps[0].rx = 0;
+  }
+  row->nwraps = keep;
+  int cap = 8;
+  while (cap < keep) {
+    cap *= 2;
+  }
+  int cx = row->wraps[keep - 1].cx;
+  int rx = row->wraps[keep - 1].rx;
+  int line_rx = rx;
+  while (1) {
+    int width = 0;
+    int rlen;
+    int n = 0;
+    if (cx < row->size) {
+      n = editorRowCharAt(row, cx, rx, &width, &rlen);
+    }
+    /* A full last line gets an empty line after it for the cursor. */
+    int brk = (cx < row->size) ? rx + width - line_rx > cols && rx > line_rx
+                               : rx - line_rx >= cols && rx > line_rx;
+    if (brk) {
+      if (row->nwraps == cap) {
+        cap *= 2;
+        row->wraps = realloc(row->wraps, sizeof(ewrap) * cap);
+      }
+      row->wraps[row->nwraps].cx = cx;
+      row->wraps[row->nwraps].rx = rx;
+      row->nwraps++;
+      line_rx = rx;
+    }
+    if (cx >= row->size) {
+      break;
+    }
+    cx += n;
+    rx += width;
+  }
+  row->wrapstale = INT_MAX;
+}
+
+/* Number of screen lines file row @p filerow occupies in soft-wrap mode. */
+static int wrapLines(int filerow) {
+  if (filerow >= E.numrows) {
+    return 1;
+  }
+  wrapRow(&E.row[filerow]);
+  return E.row[filerow].nwraps;
+}
+
+/* Index of the screen line of @p row that holds byte offset @p cx. */
+static int wrapLineOf(erow *row, int cx) {
+  wrapRow(row);
+  int lo = 0;
+  int hi = row->nwraps - 1;
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if (row->wraps[mid].cx <= cx) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return lo;
+}
+
+/*
+ * Keep the cursor visible when rows are wrapped. Walks at most a screenful of
+ * screen lines between the top of the viewport and the cursor.
+ */
+static void editorScrollWrapped(void) {
+  E.coloff = 0;
+  if (E.rowoff > E.numrows) {
+    E.rowoff = E.numrows;
+  }
+  int top_lines = wrapLines(E.rowoff);
+  if (E.wrapoff >= top_lines) {
+    E.wrapoff = top_lines - 1;
+  }
+  int line = 0;
+  int line_rx = 0;
+  if (E.cy < E.numrows) {
+    erow *row = &E.row[E.cy];
+    line = wrapLineOf(row, E.cx);
+    line_rx = row->wraps[line].rx;
+  }
+  wrap_cursor_x = E.rx - line_rx;
+  if (E.cy < E.rowoff || (E.cy == E.rowoff && line < E.wrapoff)) {
+    E.rowoff = E.cy;
+    E.wrapoff = line;
+    wrap_cursor_y = 0;
+    return;
+  }
+  int y = 0;
+  int r = E.rowoff;
+  int s = E.wrapoff;
+  while (r < E.cy && y < E.screenrows) {
+    y += wrapLines(r) - s;
+    s = 0;
+    r++;
+  }
+  if (r == E.cy) {
+    y += line - s;
+  }
+  if (y < E.screenrows) {
+    wrap_cursor_y = y;
+    return;
+  }
+  /* Cursor is below the viewport: put it on the last screen line. */
+  r = E.cy;
+  s = line;
+  int n = E.screenrows - 1;
+  while (n > 0) {
+    if (n <= s) {
+      s -= n;
+      n = 0;
+    } else if (r == 0) {
+      n -= s;
+      s = 0;
+      break;
+    } else {
+      n -= s + 1;
+      r--;
+      s = wrapLines(r) - 1;
+    }
+  }
+  E.rowoff = r;
+  E.wrapoff = s;
+  wrap_cursor_y = E.screenrows - 1 - n;
+}
+
 /**
  * @brief Recompute scroll offsets to keep the cursor visible.
  * @ingroup render
  *
  * Updates @c E.rowoff and @c E.coloff based on cursor location and render x
- * coordinate (rx) so that the cursor remains within the viewport.
+ * coordinate (rx) so that the cursor remains within the viewport. In soft-wrap
+ * mode @c E.wrapoff selects the first visible screen line of the top row and
+ * horizontal scrolling is disabled.
  *
  * @post Viewport offsets may change.
  * @sa editorDrawRows(), editorRefreshScreen(), editorRowCxToRx()
@@ -30,6 +195,11 @@ void editorScroll(void) {
   if (E.cy < E.numrows) {
     E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
   }
+  if (E.softwrap) {
+    editorScrollWrapped();
+    return;
+  }
+  E.wrapoff = 0;
   if (E.cy < E.rowoff) {
     E.rowoff = E.cy;
   }
@@ -44,19 +214,204 @@ void editorScroll(void) {
   }
 }
 
+/**
+ * @brief Scroll the soft-wrapped view by whole screen lines.
+ * @ingroup render
+ *
+ * Moves the top of the viewport @p lines screen lines down (or up when
+ * negative), stopping at the first and last row, and places the cursor at the
+ * start of the new top line. Cost is proportional to @p lines, not to the
+ * length of the rows passed over.
+ *
+ * @param[in] lines Screen lines to scroll; negative scrolls up.
+ * @sa editorScroll()
+ */
+void editorScrollWrappedLines(int lines) {
+  int r = E.rowoff < E.numrows ? E.rowoff : E.numrows - 1;
+  if (r < 0) {
+    return;
+  }
+  int s = E.wrapoff;
+  if (s >= wrapLines(r)) {
+    s = wrapLines(r) - 1;
+  }
+  while (lines > 0) {
+    int last = wrapLines(r) - 1;
+    if (s + lines <= last || r + 1 >= E.numrows) {
+      s = (s + lines <= last) ? s + lines : last;
+      break;
+    }
+    lines -= last - s + 1;
+    r++;
+    s = 0;
+  }
+  while (lines < 0) {
+    if (-lines <= s || r == 0) {
+      s = (-lines <= s) ? s + lines : 0;
+      break;
+    }
+    lines += s + 1;
+    r--;
+    s = wrapLines(r) - 1;
+  }
+  wrapRow(&E.row[r]);
+  E.rowoff = r;
+  E.wrapoff = s;
+  E.cy = r;
+  E.cx = E.row[r].wraps[s].cx;
+}
+
+/**
+ * @brief Turn soft wrapping of long rows on or off.
+ * @ingroup render
+ *
+ * @param[in] on Nonzero to wrap rows at the screen width.
+ * @sa editorScroll()
+ */
+void editorSetSoftWrap(int on) {
+  E.softwrap = on ? 1 : 0;
+  E.coloff = 0;
+  E.wrapoff = 0;
+}
+
+/*
+ * Search match overlay for the chunk being drawn: the render range
+ * [from, to) of the match at @c next, clipped to the chunk.
+ */
+struct overlay {
+  const ematch *next;
+  const ematch *end;
+  int from;
+  int to;
+};
+
+/*
+ * Advance @p ov to the first match in chunk @p ch of @p row that ends after
+ * render index @p j, or past the chunk if there is none.
+ */
+static void overlaySeek(struct overlay *ov, erow *row, echunk *ch, int j) {
+  int chunk_end = ch->cx + ch->size;
+  ov->from = ov->to = INT_MAX;
+  while (ov->next < ov->end) {
+    int start = ov->next->cx;
+    int end = start + ov->next->len;
+    if (start >= chunk_end) {
+      return;
+    }
+    if (end > ch->cx) {
+      ov->from = (start <= ch->cx) ? 0 : editorRowCxToRenderIdx(row, start);
+      ov->to = (end >= chunk_end) ? ch->rsize : editorRowCxToRenderIdx(row, end);
+      if (ov->to > j) {
+        return;
+      }
+    }
+    if (end > chunk_end) {
+      ov->from = ov->to = INT_MAX;
+      return;
+    }
+    ov->next++;
+  }
+}
+
+/*
+ * Draw file row @p filerow from display column @p from, filling at most
+ * @p cols screen columns. Only the chunks of the row that intersect the span
+ * are rendered and highlighted. Matches of an active search are drawn with
+ * HL_MATCH on top of the row's own highlighting.
+ */
+static void drawRowSpan(struct abuf *ab, int filerow, int from, int cols) {
+  erow *row = &E.row[filerow];
+  int cx = editorRowRxToCx(row, from);
+  int col = editorRowCxToRx(row, cx) - from;
+  int k = editorRowChunkIndex(row, cx);
+  int j = editorRowCxToRenderIdx(row, cx);
+  int current_color = -1;
+  struct overlay ov;
+  int nmatches = editorSearchRowMatches(filerow, &ov.next);
+  ov.end = ov.next + nmatches;
+  /* Skip matches that end before the span. */
+  while (ov.next < ov.end && ov.next->cx + ov.next->len <= cx) {
+    ov.next++;
+  }
+  for (; k < row->nchunks && col < cols; k++, j = 0) {
+    echunk *ch = editorRowChunk(row, k);
+    char *c = ch->render;
+    unsigned char *hl = ch->hl;
+    overlaySeek(&ov, row, ch, j);
+    while (j < ch->rsize && col < cols) {
+      if (j >= ov.to) {
+        overlaySeek(&ov, row, ch, j);
+      }
+      int cls = (j >= ov.from && j < ov.to) ? HL_MATCH : hl[j];
+      unsigned int cp;
+      int n = utf8Decode(&c[j], ch->rsize - j, &cp);
+      int width = n ? utf8Width(cp) : 1;
+      if (col < 0) {
+        /* Wide character straddling the left edge: blank its visible half. */
+        for (int b = 0; b < col + width; b++) {
+          abAppend(ab, " ", 1);
+        }
+        col += width;
+        j += n ? n : 1;
+        continue;
+      }
+      if (col + width > cols) {
+        col = cols;
+        break;
+      }
+      if (n == 0 || iscntrl((unsigned char)c[j])) {
+        char sym = (n == 0) ? '?' : (c[j] <= 26) ? '@' + c[j] : '?';
+        abAppend(ab, "\x1b[7m", 4);
+        abAppend(ab, &sym, 1);
+        abAppend(ab, "\x1b[m", 3);
+        if (current_color != -1) {
+          char buf[16];
+          int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", current_color);
+          abAppend(ab, buf, clen);
+        }
+        n = 1;
+      } else if (cls == HL_NORMAL) {
+        if (current_color != -1) {
+          abAppend(ab, "\x1b[39m", 5);
+          current_color = -1;
+        }
+        abAppend(ab, &c[j], n);
+      } else {
+        int color = editorSyntaxToColor(cls);
+        if (color != current_color) {
+          current_color = color;
+          char buf[16];
+          int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
+          abAppend(ab, buf, clen);
+        }
+        abAppend(ab, &c[j], n);
+      }
+      col += width;
+      j += n;
+    }
+  }
+  abAppend(ab, "\x1b[39m", 5);
+}
+
 /**
  * @brief Render visible rows to the append buffer.
  * @ingroup render
  *
  * Writes the visible portion of the buffer into @p ab using ANSI escapes and
- * syntax highlighting. Control characters are inverted for visibility.
+ * syntax highlighting. Control characters and invalid UTF-8 bytes are
+ * inverted for visibility. Multi-byte characters are emitted whole and
+ * clipped by display width, so wide characters never overrun the right edge.
+ * Only the chunks of each row that intersect the viewport are rendered and
+ * highlighted. In soft-wrap mode each screen line shows the next cached wrap
+ * segment, starting from line @c E.wrapoff of row @c E.rowoff.
  *
  * @param[in,out] ab Append buffer to receive terminal bytes.
  * @sa editorDrawStatusBar(), editorDrawMessageBar(), editorRefreshScreen()
  */
 void editorDrawRows(struct abuf *ab) {
+  int filerow = E.rowoff;
+  int line = E.softwrap ? E.wrapoff : 0;
   for (int y = 0; y < E.screenrows; y++) {
-    int filerow = y + E.rowoff;
     if (filerow >= E.numrows) {
       if (E.numrows == 0 && y == E.screenrows / 3) {
         char welcome[80];
@@ -77,42 +432,23 @@ void editorDrawRows(struct abuf *ab) {
       } else {
         abAppend(ab, "~", 1);
       }
-    } else {
-      int len = E.row[filerow].rsize - E.coloff;
-      if (len < 0) len = 0;
-      if (len > E.screencols) len = E.screencols;
-      char *c = &E.row[filerow].render[E.coloff];
-      unsigned char *hl = &E.row[filerow].hl[E.coloff];
-      int current_color = -1;
-      for (int j = 0; j < len; j++) {
-        if (iscntrl(c[j])) {
-          char sym = (c[j] <= 26) ? '@' + c[j] : '?';
-          abAppend(ab, "\x1b[7m", 4);
-          abAppend(ab, &sym, 1);
-          abAppend(ab, "\x1b[m", 3);
-          if (current_color != -1) {
-            char buf[16];
-            int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", current_color);
-            abAppend(ab, buf, clen);
-          }
-        } else if (hl[j] == HL_NORMAL) {
-          if (current_color != -1) {
-            abAppend(ab, "\x1b[39m", 5);
-            current_color = -1;
-          }
-          abAppend(ab, &c[j], 1);
-        } else {
-          int color = editorSyntaxToColor(hl[j]);
-          if (color != current_color) {
-            current_color = color;
-            char buf[16];
-            int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
-            abAppend(ab, buf, clen);
-          }
-          abAppend(ab, &c[j], 1);
-        }
+      filerow++;
+    } else if (E.softwrap) {
+      erow *row = &E.row[filerow];
+      wrapRow(row);
+      int from = row->wraps[line].rx;
+      int cols = E.screencols;
+      if (line + 1 < row->nwraps) {
+        cols = row->wraps[line + 1].rx - from;
       }
-      abAppend(ab, "\x1b[39m", 5);
+      drawRowSpan(ab, filerow, from, cols);
+      if (++line >= row->nwraps) {
+        filerow++;
+        line = 0;
+      }
+    } else {
+      drawRowSpan(ab, filerow, E.coloff, E.screencols);
+      filerow++;
     }
     abAppend(ab, "\x1b[K", 3);
     abAppend(ab, "\r\n", 2);
@@ -124,7 +460,7 @@ void editorDrawRows(struct abuf *ab) {
  * @ingroup render
  *
  * Shows filename, line count, modified flag, and right-aligned filetype and
- * cursor position.
+ * cursor position, preceded by the match count while searching.
  *
  * @param[in,out] ab Append buffer to receive terminal bytes.
  * @sa editorDrawMessageBar()
@@ -132,11 +468,23 @@ void editorDrawRows(struct abuf *ab) {
 void editorDrawStatusBar(struct abuf *ab) {
   abAppend(ab, "\x1b[7m", 4);
   char status[80], rstatus[80];
-  int len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
-                     E.filename ? E.filename : "[No Name]", E.numrows,
-                     E.dirty ? "(modified)" : "");
-  int rlen = snprintf(rstatus, sizeof(rstatus), "%s | %d/%d",
-                      E.syntax ? E.syntax->filetype : "no ft", E.cy + 1, E.numrows);
+  /* The pager has a window of rows onto a file that may not be counted yet. */
+  int counted = 1;
+  long long lines = pagerActive() ? pagerLineCount(&counted) : E.numrows;
+  int len = snprintf(status, sizeof(status), "%.20s - %lld%s lines %s",
+                     E.filename ? E.filename : "[No Name]", lines, counted ? "" : "+",
+                     pagerActive() ? "(read-only)" : E.dirty ? "(modified)" : "");
+  char matches[40] = "";
+  int index, total, complete;
+  if (editorSearchIndex(&index, &total, &complete)) {
+    if (index) {
+      snprintf(matches, sizeof(matches), "match %d of %d | ", index, total);
+    } else {
+      snprintf(matches, sizeof(matches), "%d%s matches | ", total, complete ? "" : "+");
+    }
+  }
+  int rlen = snprintf(rstatus, sizeof(rstatus), "%s%s | %lld/%lld", matches,
+                      E.syntax ? E.syntax->filetype : "no ft", pagerLineOf(E.cy) + 1, lines);
   if (len > E.screencols) len = E.screencols;
   abAppend(ab, status, len);
   while (len < E.screencols) {
@@ -174,12 +522,15 @@ void editorDrawMessageBar(struct abuf *ab) {
  * @ingroup render
  *
  * Scrolls the viewport, composes rows, status, and message bars into a dynamic
- * buffer, restores the cursor position, and writes to STDOUT.
+ * buffer, restores the cursor position, and writes to STDOUT. Rows edited in
+ * an open edit batch are highlighted first.
  *
  * @post Terminal output is written; the append buffer is freed by abFree().
  * @sa editorScroll(), editorDrawRows(), abAppend(), abFree()
  */
 void editorRefreshScreen(void) {
+  editorBatchFlush();
+  pagerSync();
   editorScroll();
   struct abuf ab = ABUF_INIT;
   abAppend(&ab, "\x1b[?25l", 6);
@@ -188,7 +539,11 @@ void editorRefreshScreen(void) {
   editorDrawStatusBar(&ab);
   editorDrawMessageBar(&ab);
   char buf[32];
-  snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1, (E.rx - E.coloff) + 1);
+  if (E.softwrap) {
+    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", wrap_cursor_y + 1, wrap_cursor_x + 1);
+  } else {
+    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1, (E.rx - E.coloff) + 1);
+  }
   abAppend(&ab, buf, strlen(buf));
   abAppend(&ab, "\x1b[?25h", 6);
   write(STDOUT_FILENO, ab.b, ab.len);
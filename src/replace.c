@@ -0,0 +1,281 @@
+/**
+ * @file replace.c
+ * @brief Search and replace implementation.
+ * @ingroup replace
+ *
+ * Each row is rewritten in one pass: its matches are collected first, then
+ * the new text is assembled into a single allocation and the row's chunks
+ * are updated once over the span from the first match to the end of the
+ * last, so highlighting is redone once per row however many matches it has.
+ */
+#include "ze.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bytesearch.h"
+#include "dfa.h"
+#include "input.h"
+#include "journal.h"
+#include "render.h"
+#include "row.h"
+#include "status.h"
+#include "terminal.h"
+#include "utf8.h"
+#include "replace.h"
+
+extern struct editorConfig E;
+
+/* What to replace and with what: a literal query, or a regex when @c re is set. */
+struct replaceSpec {
+  const char *query;
+  int qlen;
+  struct dfa *re;
+  const char *with;
+  int wlen;
+};
+
+/* Match offsets and lengths collected for the row being rewritten. */
+struct replaceMatches {
+  int *at;
+  int *len;
+  int n;
+  int cap;
+};
+
+static struct replaceMatches M;
+
+static void replaceCollect(void *ctx, int at, int mlen) {
+  (void)ctx;
+  if (M.n == M.cap) {
+    M.cap = M.cap ? M.cap * 2 : 64;
+    M.at = realloc(M.at, sizeof(int) * M.cap);
+    M.len = realloc(M.len, sizeof(int) * M.cap);
+  }
+  M.at[M.n] = at;
+  M.len[M.n] = mlen;
+  M.n++;
+}
+
+/* Collect the non-overlapping matches in @p row that start at or after @p from. */
+static void replaceFind(erow *row, int from, const struct replaceSpec *rs) {
+  M.n = 0;
+  if (rs->re && from == 0) {
+    dfaSearchAll(rs->re, row->chars, row->size, replaceCollect, NULL);
+  } else if (rs->re) {
+    int mlen;
+    int at;
+    while (from <= row->size && (at = dfaSearch(rs->re, row->chars, row->size, from, &mlen)) >= 0) {
+      replaceCollect(NULL, at, mlen);
+      from = at + mlen;
+    }
+  } else {
+    const char *p = row->chars + from;
+    const char *end = row->chars + row->size;
+    while ((p = byteSearch(p, (size_t)(end - p), rs->query, (size_t)rs->qlen)) != NULL) {
+      replaceCollect(NULL, (int)(p - row->chars), rs->qlen);
+      p += rs->qlen;
+    }
+  }
+}
+
+/*
+ * Replace the first @p n collected matches in @p row with the replacement
+ * text, building the new contents in one allocation.
+ */
+static void replaceApply(erow *row, int n, const struct replaceSpec *rs) {
+  int removed = 0;
+  for (int i = 0; i < n; i++) {
+    removed += M.len[i];
+  }
+  int size = row->size - removed + n * rs->wlen;
+  char *chars = malloc(size + 1);
+  char *out = chars;
+  int pos = 0;
+  for (int i = 0; i < n; i++) {
+    memcpy(out, row->chars + pos, M.at[i] - pos);
+    out += M.at[i] - pos;
+    memcpy(out, rs->with, rs->wlen);
+    out += rs->wlen;
+    pos = M.at[i] + M.len[i];
+  }
+  memcpy(out, row->chars + pos, row->size - pos);
+  chars[size] = '\0';
+
+  int first = M.at[0];
+  int oldspan = M.at[n - 1] + M.len[n - 1] - first;
+  int newspan = oldspan + size - row->size;
+  journalSetRow(row->idx, chars, size);
+  editorRowDropChars(row);
+  row->chars = chars;
+  row->size = size;
+  editorUpdateRowRange(row, first, oldspan, newspan);
+  E.dirty++;
+  E.gen++;
+}
+
+/* Keep the cursor inside its row and off UTF-8 continuation bytes. */
+static void replaceClampCursor(void) {
+  if (E.cy >= E.numrows) {
+    return;
+  }
+  erow *row = &E.row[E.cy];
+  if (E.cx > row->size) {
+    E.cx = row->size;
+  }
+  while (E.cx > 0 && UTF8_IS_CONT(row->chars[E.cx])) {
+    E.cx--;
+  }
+}
+
+/* Fill @p rs for @p query and @p with; returns 0 with @p error set if invalid. */
+static int replaceSpecInit(struct replaceSpec *rs, const char *query, const char *with,
+                           int regex, const char **error) {
+  rs->query = query;
+  rs->qlen = (int)strlen(query);
+  rs->with = with;
+  rs->wlen = (int)strlen(with);
+  rs->re = NULL;
+  *error = NULL;
+  if (rs->qlen == 0) {
+    *error = "empty search string";
+    return 0;
+  }
+  if (regex && (rs->re = dfaCached(query, error)) == NULL) {
+    return 0;
+  }
+  return 1;
+}
+
+/**
+ * @brief Replace every match in the buffer.
+ * @ingroup replace
+ *
+ * Matches are non-overlapping and found left to right; replacement text is
+ * inserted literally and never rescanned. Each affected row is reallocated
+ * once and its chunks updated once.
+ *
+ * @param[in] query Literal string, or a regular expression if @p regex is set.
+ * @param[in] with Replacement text (may be empty).
+ * @param[in] regex Nonzero to treat @p query as a regular expression.
+ * @param[out] rows Number of rows changed; may be NULL.
+ * @param[out] error Set to a message if @p query is empty or invalid.
+ * @return Number of replacements, or -1 on error.
+ * @sa editorQueryReplace(), dfaCompile()
+ */
+int editorReplaceAll(const char *query, const char *with, int regex, int *rows,
+                     const char **error) {
+  struct replaceSpec rs;
+  if (!replaceSpecInit(&rs, query, with, regex, error)) {
+    return -1;
+  }
+  int count = 0;
+  int changed = 0;
+  for (int r = 0; r < E.numrows; r++) {
+    replaceFind(&E.row[r], 0, &rs);
+    if (M.n > 0) {
+      replaceApply(&E.row[r], M.n, &rs);
+      count += M.n;
+      changed++;
+    }
+  }
+  if (rows) {
+    *rows = changed;
+  }
+  replaceClampCursor();
+  return count;
+}
+
+static int query_regex = 0;
+static char query_prompt[64];
+
+static void replaceSetPrompt(void) {
+  snprintf(query_prompt, sizeof(query_prompt), "%s: %%s",
+           query_regex ? "Query replace regex" : "Query replace");
+}
+
+/* Prompt callback: Ctrl+r switches between literal and regex matching. */
+static void replacePromptCallback(char *query, int key) {
+  (void)query;
+  if (key == CTRL_KEY('r')) {
+    query_regex = !query_regex;
+    replaceSetPrompt();
+  }
+}
+
+/**
+ * @brief Interactively replace matches from the cursor to the end of the buffer.
+ * @ingroup replace
+ *
+ * Prompts for a query (Ctrl+r toggles regex matching) and its replacement,
+ * then stops at each match: @c y or space replaces it, @c n skips it, @c !
+ * replaces it and every later match without asking, and @c q or Esc stops.
+ * Reports the number of replacements in the status bar.
+ *
+ * @post Buffer and cursor may change.
+ * @sa editorReplaceAll(), editorPrompt()
+ */
+void editorQueryReplace(void) {
+  replaceSetPrompt();
+  char *query = editorPrompt(query_prompt, replacePromptCallback);
+  if (query == NULL) {
+    return;
+  }
+  char *with = editorPrompt("Replace with: %s", NULL);
+  if (with == NULL) {
+    free(query);
+    return;
+  }
+  struct replaceSpec rs;
+  const char *error;
+  if (!replaceSpecInit(&rs, query, with, query_regex, &error)) {
+    editorSetStatusMessage("Bad regex: %s", error);
+    free(query);
+    free(with);
+    return;
+  }
+
+  int count = 0;
+  int all = 0;
+  int row = E.cy;
+  int cx = E.cx;
+  while (row < E.numrows) {
+    erow *r = &E.row[row];
+    replaceFind(r, cx, &rs);
+    if (M.n == 0) {
+      row++;
+      cx = 0;
+      continue;
+    }
+    if (all) {
+      replaceApply(r, M.n, &rs);
+      count += M.n;
+      row++;
+      cx = 0;
+      continue;
+    }
+    int at = M.at[0];
+    int mlen = M.len[0];
+    E.cy = row;
+    E.cx = at;
+    editorSetStatusMessage("Replace this match? (y, n, !, q) [%d replaced]", count);
+    editorRefreshScreen();
+    int c = editorReadKey();
+    if (c == 'y' || c == ' ') {
+      replaceApply(r, 1, &rs);
+      count++;
+      cx = at + rs.wlen;
+    } else if (c == 'n') {
+      cx = at + mlen;
+    } else if (c == '!') {
+      all = 1;
+    } else {
+      break;
+    }
+  }
+  replaceClampCursor();
+  editorSetStatusMessage("Replaced %d occurrence%s", count, count == 1 ? "" : "s");
+  free(query);
+  free(with);
+}
@@ -3,98 +3,624 @@
  * @brief Row manipulation and conversion implementations.
  * @ingroup row
  */
+#include <limits.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "ze.h"
 #include "syntax.h"
+#include "utf8.h"
+#include "row.h"
+#include "journal.h"
 
 extern struct editorConfig E;
 
+/** Access chunk @p k of @p row without bringing it up to date. */
+#define ROW_CHUNK(row, k) ((row)->chunks ? &(row)->chunks[k] : &(row)->head)
+
+/** Open edit batches and the rows whose highlighting they have put off. */
+static struct {
+  int depth;
+  struct syntaxSpan *rows;  /* Edited rows in order, without repeats. */
+  int n, cap;
+} batch = {0, NULL, 0, 0};
+
+/** Readers on other threads still using row text, and buffers given up meanwhile. */
+static struct {
+  int holders;
+  char **retired;
+  int nretired;
+} shares = {0, NULL, 0};
+
+/* Index of the first entry of batch.rows for row @p at or later. */
+static int batchFind(int at) {
+  int lo = 0, hi = batch.n;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (batch.rows[mid].row < at) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/*
+ * Note that chunks @p first..@p last of row @p at need highlighting when the
+ * batch ends; a @p last of -1 only asks for the state entering the row to be
+ * checked. A row edited twice is redone from the earlier first chunk to its
+ * end, as the second edit may have moved the chunks after it.
+ */
+static void batchMark(int at, int first, int last) {
+  int i = batchFind(at);
+  if (i < batch.n && batch.rows[i].row == at) {
+    struct syntaxSpan *b = &batch.rows[i];
+    if (b->last < 0) {
+      b->first = first;
+      b->last = last;
+    } else if (last >= 0) {
+      b->first = first < b->first ? first : b->first;
+      b->last = INT_MAX;
+    }
+    return;
+  }
+  if (batch.n == batch.cap) {
+    batch.cap = batch.cap ? batch.cap * 2 : 16;
+    batch.rows = realloc(batch.rows, sizeof(*batch.rows) * batch.cap);
+  }
+  memmove(&batch.rows[i + 1], &batch.rows[i], sizeof(*batch.rows) * (batch.n - i));
+  batch.rows[i] = (struct syntaxSpan){at, first, last};
+  batch.n++;
+}
+
+/* Follow the edited rows as rows from @p from on move by @p delta. */
+static void batchShift(int from, int delta) {
+  for (int i = batchFind(from); i < batch.n; i++) {
+    batch.rows[i].row += delta;
+  }
+}
+
+/* Forget the @p n rows from @p at on, which are being deleted. */
+static void batchDrop(int at, int n) {
+  int i = batchFind(at);
+  int j = batchFind(at + n);
+  if (j > i) {
+    memmove(&batch.rows[i], &batch.rows[j], sizeof(*batch.rows) * (batch.n - j));
+    batch.n -= j - i;
+  }
+}
+
+/**
+ * @brief Measure the character that starts at a byte offset of a row.
+ * @ingroup row
+ *
+ * Invalid UTF-8 bytes are measured one at a time as single-column characters.
+ *
+ * @param[in] row Row to inspect.
+ * @param[in] cx Byte offset in @c chars; must be < @c row->size.
+ * @param[in] rx Display column the character is drawn at (for tab stops).
+ * @param[out] width Display columns the character occupies.
+ * @param[out] rlen Number of bytes it expands to in render.
+ * @return Length of the character in @c chars.
+ */
+int editorRowCharAt(erow *row, int cx, int rx, int *width, int *rlen) {
+  if (row->chars[cx] == '\t') {
+    *width = ZE_TAB_STOP - (rx % ZE_TAB_STOP);
+    *rlen = *width;
+    return 1;
+  }
+  unsigned int cp;
+  int n = utf8Decode(&row->chars[cx], row->size - cx, &cp);
+  if (n == 0) {
+    *width = 1;
+    *rlen = 1;
+    return 1;
+  }
+  *width = utf8Width(cp);
+  *rlen = n;
+  return n;
+}
+
+/* Release a chunk's derived buffers. */
+static void chunkFree(echunk *ch) {
+  free(ch->render);
+  free(ch->hl);
+  free(ch->cols);
+  ch->render = NULL;
+  ch->hl = NULL;
+  ch->cols = NULL;
+  ch->ncols = 0;
+}
+
+/*
+ * Recompute the width and tab count of @p ch for its current @c rx. Drops
+ * derived buffers, which are rebuilt lazily by editorRowChunk().
+ */
+static void chunkMeasure(erow *row, echunk *ch) {
+  int end = ch->cx + ch->size;
+  int rx = ch->rx;
+  int tabs = 0;
+  for (int cx = ch->cx; cx < end;) {
+    int width, rlen;
+    if (row->chars[cx] == '\t') {
+      tabs++;
+    }
+    cx += editorRowCharAt(row, cx, rx, &width, &rlen);
+    rx += width;
+  }
+  chunkFree(ch);
+  ch->width = rx - ch->rx;
+  ch->tabs = tabs;
+  ch->phase = ch->rx % ZE_TAB_STOP;
+}
+
+/*
+ * Make @c rx and @c width current for chunks 0..k. Tab-free chunks only need
+ * their start column moved; chunks with tabs are re-measured when their tab
+ * phase changed.
+ */
+static echunk *chunkSync(erow *row, int k) {
+  while (row->rxvalid <= k) {
+    echunk *prev = ROW_CHUNK(row, row->rxvalid - 1);
+    echunk *ch = ROW_CHUNK(row, row->rxvalid);
+    ch->rx = prev->rx + prev->width;
+    if (ch->tabs && ch->phase != ch->rx % ZE_TAB_STOP) {
+      chunkMeasure(row, ch);
+    }
+    row->rxvalid++;
+  }
+  return ROW_CHUNK(row, k);
+}
+
+/* Expand tabs of a measured chunk into its render buffer. */
+static void chunkRender(erow *row, echunk *ch) {
+  free(ch->render);
+  free(ch->hl);
+  ch->hl = NULL;
+  ch->render = malloc(ch->size + ch->tabs * (ZE_TAB_STOP - 1) + 1);
+  int end = ch->cx + ch->size;
+  int rx = ch->rx;
+  int idx = 0;
+  for (int cx = ch->cx; cx < end;) {
+    int width, rlen;
+    int n = editorRowCharAt(row, cx, rx, &width, &rlen);
+    if (row->chars[cx] == '\t') {
+      memset(&ch->render[idx], ' ', rlen);
+    } else {
+      memcpy(&ch->render[idx], &row->chars[cx], rlen);
+    }
+    idx += rlen;
+    rx += width;
+    cx += n;
+  }
+  ch->render[idx] = '\0';
+  ch->rsize = idx;
+}
+
+/*
+ * Build the checkpoint table for @p ch if it is stale. Chunks shorter than one
+ * stride are scanned directly and never get a table.
+ */
+static void chunkIndexColumns(erow *row, echunk *ch) {
+  if (ch->cols != NULL || ch->size < ZE_COLUMN_STRIDE) {
+    return;
+  }
+  int cap = ch->size / ZE_COLUMN_STRIDE + 1;
+  ch->cols = malloc(sizeof(ecolumn) * cap);
+  int k = 0;
+  int cx = 0, rx = 0, ridx = 0;
+  while (1) {
+    if (k < cap && cx >= k * ZE_COLUMN_STRIDE) {
+      ch->cols[k].cx = cx;
+      ch->cols[k].rx = rx;
+      ch->cols[k].ridx = ridx;
+      k++;
+    }
+    if (cx >= ch->size) {
+      break;
+    }
+    int width, rlen;
+    cx += editorRowCharAt(row, ch->cx + cx, ch->rx + rx, &width, &rlen);
+    rx += width;
+    ridx += rlen;
+  }
+  ch->ncols = k;
+}
+
+/*
+ * Return the last checkpoint of @p ch whose field at byte offset @p field (one
+ * of the ecolumn members) is <= @p value. Every member grows monotonically
+ * along the chunk, so a binary search over the table suffices.
+ */
+static ecolumn chunkColumnFloor(erow *row, echunk *ch, size_t field, int value) {
+  ecolumn best = {0, 0, 0};
+  chunkIndexColumns(row, ch);
+  int lo = 0;
+  int hi = ch->ncols - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    int v = *(const int *)((const char *)&ch->cols[mid] + field);
+    if (v <= value) {
+      best = ch->cols[mid];
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return best;
+}
+
+/* Index of the chunk covering display column @p rx, syncing lazily. */
+static int chunkForRx(erow *row, int rx) {
+  int lo = 0;
+  int hi = row->rxvalid - 1;
+  int k = 0;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    if (ROW_CHUNK(row, mid)->rx <= rx) {
+      k = mid;
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  echunk *ch = ROW_CHUNK(row, k);
+  while (k + 1 < row->nchunks && ch->rx + ch->width <= rx) {
+    ch = chunkSync(row, ++k);
+  }
+  return k;
+}
+
+/**
+ * @brief Find the chunk of a row that contains a character index.
+ * @ingroup row
+ *
+ * @param[in] row Row to search. Must be non-NULL.
+ * @param[in] cx Character index within @p row (0..size). The end of the row
+ *               belongs to the last chunk.
+ * @return Chunk index in [0, row->nchunks).
+ * @sa editorRowChunk()
+ */
+int editorRowChunkIndex(erow *row, int cx) {
+  int lo = 0;
+  int hi = row->nchunks - 1;
+  int k = 0;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    if (ROW_CHUNK(row, mid)->cx <= cx) {
+      k = mid;
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return k;
+}
+
+/**
+ * @brief Return chunk @p k of a row with its render and highlighting current.
+ * @ingroup row
+ *
+ * Renders and highlights the chunk on first use, so only chunks that are
+ * actually drawn or searched pay for tab expansion and syntax highlighting.
+ *
+ * @param[in,out] row Row owning the chunk.
+ * @param[in] k Chunk index in [0, row->nchunks).
+ * @return Pointer to the chunk; valid until the row is next modified.
+ * @sa editorRowChunkIndex(), editorSyntaxRun()
+ */
+echunk *editorRowChunk(erow *row, int k) {
+  echunk *ch = chunkSync(row, k);
+  if (ch->render == NULL) {
+    chunkRender(row, ch);
+  }
+  if (ch->hl == NULL) {
+    ch->hl = malloc(ch->rsize + 1);
+    ch->hl_out = editorSyntaxRun(ch->render, ch->hl, ch->rsize, ch->hl_in);
+  }
+  return ch;
+}
+
 /**
- * @brief Convert an index in characters (cx) to a render index (rx).
+ * @brief Convert an index in characters (cx) to a display column (rx).
  * @ingroup row
  *
- * Accounts for tabs expanding to @c ZE_TAB_STOP columns.
+ * Accounts for tabs expanding to @c ZE_TAB_STOP columns, multi-byte UTF-8
+ * sequences, and zero-width and double-width characters. Starts from the
+ * nearest cached checkpoint of the chunk containing @p cx, so at most
+ * @c ZE_COLUMN_STRIDE bytes are scanned.
  *
  * @param[in] row Row whose data to measure. Must be non-NULL.
  * @param[in] cx Character index within @p row (0..size).
- * @return Render column index corresponding to @p cx.
+ * @return Display column corresponding to @p cx.
  * @sa editorRowRxToCx()
  */
 int editorRowCxToRx(erow *row, int cx) {
-  int rx = 0;
-  for (int j = 0; j < cx; j++) {
-    if (row->chars[j] == '\t') {
-      rx += (ZE_TAB_STOP - 1) - (rx % ZE_TAB_STOP);
+  echunk *ch = chunkSync(row, editorRowChunkIndex(row, cx));
+  ecolumn c = chunkColumnFloor(row, ch, offsetof(ecolumn, cx), cx - ch->cx);
+  int j = ch->cx + c.cx;
+  int rx = ch->rx + c.rx;
+  while (j < cx) {
+    int width, rlen;
+    int n = editorRowCharAt(row, j, rx, &width, &rlen);
+    if (j + n > cx) {
+      break;
     }
-    rx++;
+    rx += width;
+    j += n;
   }
   return rx;
 }
 
 /**
- * @brief Convert a render index (rx) to a character index (cx).
+ * @brief Convert a display column (rx) to a character index (cx).
  * @ingroup row
  *
- * Inverse of editorRowCxToRx(), handling tab expansion.
+ * Inverse of editorRowCxToRx(). Returns the start of the character that
+ * covers column @p rx.
  *
  * @param[in] row Row whose data to measure. Must be non-NULL.
- * @param[in] rx Render column index (0..rsize).
+ * @param[in] rx Display column.
  * @return Character index corresponding to @p rx.
  * @sa editorRowCxToRx()
  */
 int editorRowRxToCx(erow *row, int rx) {
-  int cur_rx = 0;
-  int cx;
-  for (cx = 0; cx < row->size; cx++) {
-    if (row->chars[cx] == '\t') {
-      cur_rx += (ZE_TAB_STOP - 1) - (cur_rx % ZE_TAB_STOP);
-    }
-    cur_rx++;
+  echunk *ch = ROW_CHUNK(row, chunkForRx(row, rx));
+  ecolumn c = chunkColumnFloor(row, ch, offsetof(ecolumn, rx), rx - ch->rx);
+  int cx = ch->cx + c.cx;
+  int cur_rx = ch->rx + c.rx;
+  while (cx < row->size) {
+    int width, rlen;
+    int n = editorRowCharAt(row, cx, cur_rx, &width, &rlen);
+    cur_rx += width;
     if (cur_rx > rx) {
       return cx;
     }
+    cx += n;
   }
   return cx;
 }
 
 /**
- * @brief Recompute `render`, `rsize`, and syntax highlighting for a row.
+ * @brief Convert a character index (cx) to a byte offset in its chunk's render.
  * @ingroup row
  *
- * Allocates/updates @c row->render from @c row->chars expanding tabs, updates
- * @c row->rsize, and recomputes syntax highlighting. Propagates multi-line
- * comment state to the next row when it changes.
- *
- * @param[in,out] row Row to update. Its render buffer is reallocated.
- * @sa editorUpdateSyntax(), editorRowInsertChar(), editorRowDelChar()
+ * @param[in] row Row whose data to measure. Must be non-NULL.
+ * @param[in] cx Character index within @p row (0..size).
+ * @return Offset into the @c render of chunk editorRowChunkIndex(row, cx)
+ *         where the character at @p cx begins.
+ * @sa editorRowChunk()
  */
-void editorUpdateRow(erow *row) {
-  int tabs = 0;
-  for (int j = 0; j < row->size; j++) {
-    if (row->chars[j] == '\t') {
-      tabs++;
+int editorRowCxToRenderIdx(erow *row, int cx) {
+  echunk *ch = chunkSync(row, editorRowChunkIndex(row, cx));
+  ecolumn c = chunkColumnFloor(row, ch, offsetof(ecolumn, cx), cx - ch->cx);
+  int j = ch->cx + c.cx;
+  int rx = ch->rx + c.rx;
+  int ridx = c.ridx;
+  while (j < cx) {
+    int width, rlen;
+    int n = editorRowCharAt(row, j, rx, &width, &rlen);
+    if (j + n > cx) {
+      break;
     }
+    rx += width;
+    ridx += rlen;
+    j += n;
   }
-  free(row->render);
-  row->render = malloc(row->size + tabs * (ZE_TAB_STOP - 1) + 1);
-  int idx = 0;
-  for (int j = 0; j < row->size; j++) {
-    if (row->chars[j] == '\t') {
-      row->render[idx++] = ' ';
-      while (idx % ZE_TAB_STOP != 0) {
-        row->render[idx++] = ' ';
-      }
+  return ridx;
+}
+
+/* Make room for a chunk at index @p at, moving a lone head into the array. */
+static echunk *chunkInsert(erow *row, int at) {
+  if (row->chunks == NULL) {
+    row->chunks = malloc(sizeof(echunk) * 2);
+    row->chunks[0] = row->head;
+  } else {
+    row->chunks = realloc(row->chunks, sizeof(echunk) * (row->nchunks + 1));
+  }
+  memmove(&row->chunks[at + 1], &row->chunks[at],
+          sizeof(echunk) * (row->nchunks - at));
+  row->nchunks++;
+  memset(&row->chunks[at], 0, sizeof(echunk));
+  return &row->chunks[at];
+}
+
+/* Remove chunks first..last, moving a lone survivor back into the head. */
+static void chunkRemove(erow *row, int first, int last) {
+  for (int i = first; i <= last; i++) {
+    chunkFree(&row->chunks[i]);
+  }
+  memmove(&row->chunks[first], &row->chunks[last + 1],
+          sizeof(echunk) * (row->nchunks - last - 1));
+  row->nchunks -= last - first + 1;
+  if (row->nchunks == 1) {
+    row->head = row->chunks[0];
+    free(row->chunks);
+    row->chunks = NULL;
+  }
+}
+
+/*
+ * Pick where to end a chunk that starts at @p from: shortly after a separator
+ * near ZE_CHUNK_SIZE bytes in, so tokens rarely straddle a boundary, and never
+ * inside a UTF-8 sequence.
+ */
+static int chunkCutPoint(erow *row, int from) {
+  int cut = from + ZE_CHUNK_SIZE;
+  for (int i = cut; i > cut - ZE_CHUNK_SIZE / 4; i--) {
+    if (is_separator((unsigned char)row->chars[i - 1]) && !UTF8_IS_CONT(row->chars[i])) {
+      return i;
+    }
+  }
+  while (cut > from + 1 && UTF8_IS_CONT(row->chars[cut])) {
+    cut--;
+  }
+  return cut;
+}
+
+/*
+ * Re-measure chunk @p k after its text changed and restore the size bounds:
+ * chunks over twice ZE_CHUNK_SIZE are split, chunks under a quarter of it are
+ * merged into a neighbour. Returns the last index of the rebuilt range and
+ * updates *first when a merge pulled in the previous chunk.
+ */
+static int chunkRebalance(erow *row, int *first, int k) {
+  echunk *ch = ROW_CHUNK(row, k);
+  if (row->nchunks > 1 && ch->size < ZE_CHUNK_SIZE / 4) {
+    int keep = (k + 1 < row->nchunks) ? k : k - 1;
+    echunk *a = &row->chunks[keep];
+    a->size += row->chunks[keep + 1].size;
+    chunkRemove(row, keep + 1, keep + 1);
+    k = keep;
+    if (k < *first) {
+      *first = k;
+    }
+  }
+  if (row->rxvalid > k) {
+    row->rxvalid = k;
+  }
+  if (k > 0) {
+    chunkSync(row, k - 1);
+  }
+  while (1) {
+    ch = ROW_CHUNK(row, k);
+    if (k > 0) {
+      echunk *prev = ROW_CHUNK(row, k - 1);
+      ch->rx = prev->rx + prev->width;
     } else {
-      row->render[idx++] = row->chars[j];
+      ch->rx = 0;
+    }
+    if (ch->size <= 2 * ZE_CHUNK_SIZE) {
+      chunkMeasure(row, ch);
+      row->rxvalid = k + 1;
+      return k;
+    }
+    int cut = chunkCutPoint(row, ch->cx);
+    int rest = ch->cx + ch->size - cut;
+    ch->size = cut - ch->cx;
+    chunkMeasure(row, ch);
+    row->rxvalid = k + 1;
+    echunk *next = chunkInsert(row, k + 1);
+    next->cx = cut;
+    next->size = rest;
+    k++;
+  }
+}
+
+/**
+ * @brief Update a row after bytes in its @c chars were replaced.
+ * @ingroup row
+ *
+ * Call after @c row->chars and @c row->size reflect the edit: the @p oldlen
+ * bytes that started at @p at were replaced by @p newlen bytes. Only the
+ * chunks overlapping the edit are re-measured and re-highlighted; later chunks
+ * are shifted, and re-highlighted only while the highlighter state entering
+ * them keeps changing.
+ *
+ * @param[in,out] row Edited row.
+ * @param[in] at Offset of the edit in @c chars.
+ * @param[in] oldlen Number of bytes removed at @p at.
+ * @param[in] newlen Number of bytes inserted at @p at.
+ * @sa editorUpdateRow(), editorUpdateSyntaxFrom()
+ */
+void editorUpdateRowRange(erow *row, int at, int oldlen, int newlen) {
+  int delta = newlen - oldlen;
+  int k = editorRowChunkIndex(row, at);
+  int m = (oldlen > 0) ? editorRowChunkIndex(row, at + oldlen - 1) : k;
+  echunk *last = ROW_CHUNK(row, m);
+  int old_end_rx = last->rx + last->width;
+  int valid_end = -1;
+  if (row->rxvalid > m + 1) {
+    echunk *v = ROW_CHUNK(row, row->rxvalid - 1);
+    valid_end = v->cx + v->size + delta;
+  }
+  echunk *ch = ROW_CHUNK(row, k);
+  ch->size = last->cx + last->size - ch->cx + delta;
+  if (m > k) {
+    chunkRemove(row, k + 1, m);
+  }
+  for (int i = k + 1; i < row->nchunks; i++) {
+    row->chunks[i].cx += delta;
+  }
+  int first = k;
+  int end = chunkRebalance(row, &first, k);
+  /* A character starting up to three bytes earlier may have been completed. */
+  if (row->wrapstale > at - 3) {
+    row->wrapstale = at > 3 ? at - 3 : 0;
+  }
+
+  /* Later chunks keep their measurements unless the tab phase moved. */
+  echunk *e = ROW_CHUNK(row, end);
+  int dw = e->rx + e->width - old_end_rx;
+  for (int i = end + 1; i < row->nchunks; i++) {
+    echunk *next = ROW_CHUNK(row, i);
+    if (next->cx >= valid_end || (next->tabs && dw % ZE_TAB_STOP != 0)) {
+      break;
     }
+    next->rx += dw;
+    row->rxvalid = i + 1;
+  }
+  if (batch.depth > 0) {
+    batchMark(row->idx, first, end);
+    return;
+  }
+  editorUpdateSyntaxFrom(row, first, end);
+}
+
+/**
+ * @brief Recompute chunks, render, and syntax highlighting for a whole row.
+ * @ingroup row
+ *
+ * Rebuilds the row's chunk list from @c row->chars, splitting rows longer
+ * than twice @c ZE_CHUNK_SIZE, and recomputes syntax highlighting. Propagates
+ * multi-line comment state to the next row when it changes. Edits that touch a
+ * known range should use editorUpdateRowRange() instead. Inside an edit batch
+ * the highlighting is left for editorBatchEnd().
+ *
+ * @param[in,out] row Row to update.
+ * @sa editorUpdateSyntax(), editorUpdateRowRange()
+ */
+void editorUpdateRow(erow *row) {
+  for (int i = 0; i < row->nchunks; i++) {
+    chunkFree(ROW_CHUNK(row, i));
+  }
+  free(row->chunks);
+  row->chunks = NULL;
+  row->nchunks = 1;
+  memset(&row->head, 0, sizeof(echunk));
+  row->head.size = row->size;
+  row->rxvalid = 0;
+  row->wrapstale = 0;
+  int first = 0;
+  chunkRebalance(row, &first, 0);
+  if (batch.depth > 0) {
+    batchMark(row->idx, 0, row->nchunks - 1);
+    return;
   }
-  row->render[idx] = '\0';
-  row->rsize = idx;
   editorUpdateSyntax(row);
 }
 
+/* Fill in a fresh row @p at holding a copy of @p len bytes of @p s. */
+static void rowInit(int at, const char *s, size_t len) {
+  E.row[at].idx = at;
+  E.row[at].size = (int)len;
+  E.row[at].chars = malloc(len + 1);
+  memcpy(E.row[at].chars, s, len);
+  E.row[at].chars[len] = '\0';
+  E.row[at].hl_open_comment = 0;
+  E.row[at].shared = 0;
+  memset(&E.row[at].head, 0, sizeof(echunk));
+  E.row[at].chunks = NULL;
+  E.row[at].nchunks = 1;
+  E.row[at].rxvalid = 0;
+  E.row[at].wraps = NULL;
+  E.row[at].nwraps = 0;
+  E.row[at].wrapcols = 0;
+  E.row[at].wrapstale = INT_MAX;
+}
+
 /**
  * @brief Insert a new row at position `at` initialized from a string.
  * @ingroup row
@@ -115,37 +641,159 @@ void editorInsertRow(int at, char *s, size_t len) {
   if (at < 0 || at > E.numrows) {
     return;
   }
+  journalInsertRow(at, s, len);
   E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
   memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numrows - at));
   for (int j = at + 1; j <= E.numrows; j++) {
     E.row[j].idx++;
   }
-  E.row[at].idx = at;
-  E.row[at].size = (int)len;
-  E.row[at].chars = malloc(len + 1);
-  memcpy(E.row[at].chars, s, len);
-  E.row[at].chars[len] = '\0';
-  E.row[at].rsize = 0;
-  E.row[at].render = NULL;
-  E.row[at].hl = NULL;
-  E.row[at].hl_open_comment = 0;
+  rowInit(at, s, len);
+  if (batch.depth > 0) {
+    /* The row pushed down now follows the new one. */
+    batchShift(at, 1);
+    batchMark(at + 1, 0, -1);
+  }
   editorUpdateRow(&E.row[at]);
   E.numrows++;
   E.dirty++;
+  E.gen++;
+}
+
+/**
+ * @brief Insert several rows at once.
+ * @ingroup row
+ *
+ * Like @p n calls of editorInsertRow() at consecutive positions, but the rows
+ * after @p at move once and the new rows are highlighted in a single pass.
+ *
+ * @param[in] at Index of the first new row, in [0, E.numrows].
+ * @param[in] s Texts of the new rows; not owned.
+ * @param[in] len Byte length of each text.
+ * @param[in] n Number of rows to insert.
+ * @sa editorInsertRow(), editorDelRows()
+ */
+void editorInsertRows(int at, char *const *s, const size_t *len, int n) {
+  if (at < 0 || at > E.numrows || n <= 0) {
+    return;
+  }
+  for (int i = 0; i < n; i++) {
+    journalInsertRow(at + i, s[i], len[i]);
+  }
+  E.row = realloc(E.row, sizeof(erow) * (E.numrows + n));
+  memmove(&E.row[at + n], &E.row[at], sizeof(erow) * (E.numrows - at));
+  for (int j = at + n; j < E.numrows + n; j++) {
+    E.row[j].idx += n;
+  }
+  editorBatchBegin();
+  batchShift(at, n);
+  for (int i = 0; i < n; i++) {
+    rowInit(at + i, s[i], len[i]);
+    editorUpdateRow(&E.row[at + i]);
+  }
+  E.numrows += n;
+  batchMark(at + n, 0, -1);
+  editorBatchEnd();
+  E.dirty++;
+  E.gen++;
 }
 
 /**
  * @brief Free dynamic memory associated with a row.
  * @ingroup row
  *
- * Releases @c render, @c chars, and @c hl arrays if allocated.
+ * Releases @c chars and every chunk's render, highlight, and column buffers.
  *
  * @param[in,out] row Row whose buffers to free.
  */
 void editorFreeRow(erow *row) {
-  free(row->render);
-  free(row->chars);
-  free(row->hl);
+  for (int i = 0; i < row->nchunks; i++) {
+    chunkFree(ROW_CHUNK(row, i));
+  }
+  free(row->chunks);
+  free(row->wraps);
+  editorRowDropChars(row);
+}
+
+/**
+ * @brief Let go of a row's text buffer.
+ * @ingroup row
+ *
+ * Frees @c chars, or, while a reader from editorRowsShare() may still use
+ * it, keeps it until the last one is done. The row is left without text;
+ * callers either discard it or install a new buffer.
+ *
+ * @param[in,out] row Row whose @c chars is released.
+ * @sa editorRowUnshare(), editorRowsRelease()
+ */
+void editorRowDropChars(erow *row) {
+  if (row->shared && shares.holders > 0) {
+    shares.retired = realloc(shares.retired, sizeof(char *) * (shares.nretired + 1));
+    shares.retired[shares.nretired++] = row->chars;
+  } else {
+    free(row->chars);
+  }
+  row->shared = 0;
+  row->chars = NULL;
+}
+
+/**
+ * @brief Give a row a private copy of its text before it is modified.
+ * @ingroup row
+ *
+ * Rows captured by a background save or a hook snapshot share @c chars
+ * with it; anything that writes to @c chars in place calls this first.
+ * Rows not shared are left untouched.
+ *
+ * @param[in,out] row Row about to be modified.
+ * @sa editorRowDropChars(), editorRowsShare()
+ */
+void editorRowUnshare(erow *row) {
+  if (!row->shared) {
+    return;
+  }
+  char *chars = malloc(row->size + 1);
+  memcpy(chars, row->chars, row->size + 1);
+  editorRowDropChars(row);
+  row->chars = chars;
+}
+
+/**
+ * @brief Let a reader on another thread keep using the current row text.
+ * @ingroup row
+ *
+ * Flags every row @c shared, so edits copy or retire its buffer instead of
+ * changing or freeing it. The @c chars pointers taken now stay valid and
+ * unchanged until the matching editorRowsRelease(). Main thread only.
+ *
+ * @sa editorSave(), pluginsBufferSnapshot()
+ */
+void editorRowsShare(void) {
+  shares.holders++;
+  for (int j = 0; j < E.numrows; j++) {
+    E.row[j].shared = 1;
+  }
+}
+
+/**
+ * @brief End a reader's hold taken with editorRowsShare().
+ * @ingroup row
+ *
+ * When no reader is left, the retired buffers are freed and rows are no
+ * longer copied before they are written. Main thread only.
+ */
+void editorRowsRelease(void) {
+  if (--shares.holders > 0) {
+    return;
+  }
+  for (int i = 0; i < shares.nretired; i++) {
+    free(shares.retired[i]);
+  }
+  free(shares.retired);
+  shares.retired = NULL;
+  shares.nretired = 0;
+  for (int j = 0; j < E.numrows; j++) {
+    E.row[j].shared = 0;
+  }
 }
 
 /**
@@ -161,36 +809,84 @@ void editorDelRow(int at) {
   if (at < 0 || at >= E.numrows) {
     return;
   }
+  journalDeleteRow(at);
   editorFreeRow(&E.row[at]);
   memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numrows - at - 1));
-  for (int j = 0; j < E.numrows - 1; j++) {
+  for (int j = at; j < E.numrows - 1; j++) {
     E.row[j].idx--;
   }
   E.numrows--;
+  if (batch.depth > 0) {
+    /* The row that moved up now follows a different row. */
+    batchDrop(at, 1);
+    batchShift(at + 1, -1);
+    batchMark(at, 0, -1);
+  }
+  E.dirty++;
+  E.gen++;
+}
+
+/**
+ * @brief Delete several consecutive rows at once.
+ * @ingroup row
+ *
+ * Like @p n calls of editorDelRow(@p at), but the rows after them move once.
+ * The range is clipped to the buffer.
+ *
+ * @param[in] at Index of the first row to delete.
+ * @param[in] n Number of rows to delete.
+ * @sa editorDelRow(), editorInsertRows()
+ */
+void editorDelRows(int at, int n) {
+  if (at < 0 || at >= E.numrows || n <= 0) {
+    return;
+  }
+  if (n > E.numrows - at) {
+    n = E.numrows - at;
+  }
+  for (int i = 0; i < n; i++) {
+    journalDeleteRow(at);
+    editorFreeRow(&E.row[at + i]);
+  }
+  memmove(&E.row[at], &E.row[at + n], sizeof(erow) * (E.numrows - at - n));
+  E.numrows -= n;
+  for (int j = at; j < E.numrows; j++) {
+    E.row[j].idx -= n;
+  }
+  editorBatchBegin();
+  batchDrop(at, n);
+  batchShift(at + n, -n);
+  batchMark(at, 0, -1);
+  editorBatchEnd();
   E.dirty++;
+  E.gen++;
 }
 
 /**
  * @brief Insert a character into a row at index `at`.
  * @ingroup row
  *
- * Reallocates the row text, shifts tail, inserts @p c, updates render and marks dirty.
+ * Reallocates the row text, shifts tail, inserts @p c, updates the affected
+ * chunk and marks dirty.
  *
  * @param[in,out] row Target row. Must be non-NULL.
  * @param[in] at Insertion index; values outside [0, size] clamp to end.
  * @param[in] c Character code to insert (low 8 bits used).
- * @sa editorRowDelChar(), editorUpdateRow()
+ * @sa editorRowDelChar(), editorUpdateRowRange()
  */
 void editorRowInsertChar(erow *row, int at, int c) {
   if (at < 0 || at > row->size) {
     at = row->size;
   }
+  journalInsertChar(row->idx, at, c);
+  editorRowUnshare(row);
   row->chars = realloc(row->chars, row->size + 2);
   memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
   row->size++;
   row->chars[at] = (char)c;
-  editorUpdateRow(row);
+  editorUpdateRowRange(row, at, 0, 1);
   E.dirty++;
+  E.gen++;
 }
 
 /**
@@ -203,15 +899,19 @@ void editorRowInsertChar(erow *row, int at, int c) {
  * @param[in,out] row Target row.
  * @param[in] s Bytes to append; need not be NUL-terminated.
  * @param[in] len Number of bytes from @p s to append.
- * @sa editorRowInsertChar(), editorUpdateRow()
+ * @sa editorRowInsertChar(), editorUpdateRowRange()
  */
 void editorRowAppendString(erow *row, char *s, size_t len) {
+  int at = row->size;
+  journalAppend(row->idx, s, len);
+  editorRowUnshare(row);
   row->chars = realloc(row->chars, row->size + len + 1);
   memcpy(&row->chars[row->size], s, len);
   row->size += (int)len;
   row->chars[row->size] = '\0';
-  editorUpdateRow(row);
+  editorUpdateRowRange(row, at, 0, (int)len);
   E.dirty++;
+  E.gen++;
 }
 
 /**
@@ -222,39 +922,127 @@ void editorRowAppendString(erow *row, char *s, size_t len) {
  *
  * @param[in,out] row Target row.
  * @param[in] at Index to delete in [0, size).
- * @sa editorRowInsertChar(), editorUpdateRow()
+ * @sa editorRowInsertChar(), editorUpdateRowRange()
  */
 void editorRowDelChar(erow *row, int at) {
   if (at < 0 || at >= row->size) {
     return;
   }
+  journalDeleteChar(row->idx, at);
+  editorRowUnshare(row);
   memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
   row->size--;
-  editorUpdateRow(row);
+  editorUpdateRowRange(row, at, 1, 0);
   E.dirty++;
+  E.gen++;
 }
 
 /**
  * @brief Delete from a row starting at a character index to the end of the line.
  * @ingroup row
  *
- * Deletes characters from @p at (exclusive) to the end, effectively trimming the
- * line at @p at. Updates render and marks dirty.
+ * Truncates the line at @p at, keeping the characters before it. Updates
+ * render and marks dirty.
  *
  * @param[in,out] row Target row.
- * @param[in] at Index after which characters are removed. Must be in range.
+ * @param[in] at Index of the first character removed. Must be in range.
+ * @sa editorUpdateRowRange()
  */
 void editorDelRowAtChar(erow *row, int at) {
   if (at < 0 || at >= row->size) {
     return;
   }
-  int len_diff = row->size - at - 1;
-  for (int i = at - 1; i < len_diff; i++) {
-    editorRowDelChar(row, i);
-  }
+  int removed = row->size - at;
+  journalTruncate(row->idx, at);
+  editorRowUnshare(row);
   row->size = at;
+  row->chars[row->size] = '\0';
+  editorUpdateRowRange(row, at, removed, 0);
+  E.dirty++;
+  E.gen++;
+}
+
+/**
+ * @brief Replace the whole text of a row.
+ * @ingroup row
+ *
+ * Installs a copy of @p s as the row's text, re-renders it, and marks the
+ * buffer dirty.
+ *
+ * @param[in,out] row Target row.
+ * @param[in] s New text; need not be NUL-terminated.
+ * @param[in] len Number of bytes from @p s.
+ * @sa editorUpdateRow()
+ */
+void editorRowSetText(erow *row, const char *s, size_t len) {
+  journalSetRow(row->idx, s, len);
+  char *chars = malloc(len + 1);
+  memcpy(chars, s, len);
+  chars[len] = '\0';
+  editorRowDropChars(row);
+  row->chars = chars;
+  row->size = (int)len;
   editorUpdateRow(row);
   E.dirty++;
+  E.gen++;
 }
 
+/**
+ * @brief Start an edit batch.
+ * @ingroup row
+ *
+ * Until the matching editorBatchEnd(), row edits still update each row's text
+ * and measurements but leave syntax highlighting for the end of the batch, so
+ * a plugin rewriting thousands of lines highlights each of them once, in
+ * order. Batches nest; only the outermost end does the work.
+ *
+ * @sa editorBatchEnd(), editorBatchFlush()
+ */
+void editorBatchBegin(void) {
+  batch.depth++;
+}
 
+/**
+ * @brief Bring the highlighting of rows edited in a batch up to date.
+ * @ingroup row
+ *
+ * Leaves the batch open. editorRefreshScreen() calls this so anything drawn
+ * while a batch is open is drawn correctly.
+ *
+ * @sa editorBatchEnd(), editorUpdateSyntaxRows()
+ */
+void editorBatchFlush(void) {
+  int n = batch.n;
+  batch.n = 0;
+  if (n > 0) {
+    editorUpdateSyntaxRows(batch.rows, n);
+  }
+}
+
+/**
+ * @brief End an edit batch.
+ * @ingroup row
+ *
+ * When the outermost batch ends, re-highlights the rows edited in it in one
+ * pass. Unmatched calls are ignored.
+ *
+ * @sa editorBatchBegin()
+ */
+void editorBatchEnd(void) {
+  if (batch.depth == 0) {
+    return;
+  }
+  if (--batch.depth == 0) {
+    editorBatchFlush();
+  }
+}
+
+/**
+ * @brief Report whether an edit batch is open.
+ * @ingroup row
+ *
+ * @return Nonzero between editorBatchBegin() and the matching editorBatchEnd().
+ */
+int editorBatchActive(void) {
+  return batch.depth > 0;
+}
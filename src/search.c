@@ -3,89 +3,800 @@
  * @brief Interactive forward search implementation.
  * @ingroup search
  */
+#include "ze.h"
+
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
 
-#include "ze.h"
+#include "bytesearch.h"
+#include "dfa.h"
+#include "idle.h"
 #include "row.h"
 #include "input.h"
+#include "search.h"
 
 extern struct editorConfig E;
 
 /**
- * @brief Highlight matches and move cursor during interactive search.
+ * @brief Find the next row containing a string.
  * @ingroup search
  *
- * Maintains search state across invocations. On arrow keys, changes search
- * direction; on other input, resets state. Highlights the next match in the
- * buffer and moves the cursor there, restoring previous highlight as needed.
+ * Scans @c chars of each row, starting with the row after @p from in
+ * direction @p dir and wrapping around the buffer, so @p from itself is
+ * checked last. Only byte offsets are computed; callers map the hit to
+ * display columns if they need to.
  *
- * @param[in] query NUL-terminated search string (may be empty).
- * @param[in] key Last key pressed to drive search behavior.
- * @post Cursor, row highlighting, and scroll offset may change.
- * @sa editorFind(), editorRowRxToCx()
+ * @param[in] query Bytes to find; may contain NUL bytes.
+ * @param[in] qlen Length of @p query.
+ * @param[in] from Row the search starts from; -1 starts at the first row.
+ * @param[in] dir 1 to search forward, -1 backward.
+ * @param[out] cx Byte offset of the first match in the returned row.
+ * @return Index of the matching row, or -1 if no row matches.
+ * @sa byteSearch()
  */
-void editorFindCallback(char *query, int key) {
-  static int last_match = -1;
-  static int direction = 1;
+int editorSearchRows(const char *query, int qlen, int from, int dir, int *cx) {
+  int current = from;
+  for (int i = 0; i < E.numrows; i++) {
+    current += dir;
+    if (current < 0) {
+      current = E.numrows - 1;
+    } else if (current >= E.numrows) {
+      current = 0;
+    }
+    erow *row = &E.row[current];
+    const char *match = byteSearch(row->chars, (size_t)row->size, query, (size_t)qlen);
+    if (match) {
+      *cx = (int)(match - row->chars);
+      return current;
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief Find the next row matching a regular expression.
+ * @ingroup search
+ *
+ * Like editorSearchRows(), but matches @p pattern with dfaSearch(), so the
+ * time spent is linear in the bytes scanned whatever the pattern.
+ *
+ * @param[in] pattern NUL-terminated regular expression.
+ * @param[in] from Row the search starts from; -1 starts at the first row.
+ * @param[in] dir 1 to search forward, -1 backward.
+ * @param[out] cx Byte offset of the leftmost match in the returned row.
+ * @param[out] len Length of that match in bytes.
+ * @param[out] error Set to a message if @p pattern is invalid, else NULL.
+ * @return Index of the matching row, or -1 if no row matches or the pattern
+ *         is invalid.
+ * @sa dfaCompile()
+ */
+int editorSearchRowsRegex(const char *pattern, int from, int dir, int *cx, int *len,
+                          const char **error) {
+  struct dfa *re = dfaCached(pattern, error);
+  if (re == NULL) {
+    return -1;
+  }
+  int current = from;
+  for (int i = 0; i < E.numrows; i++) {
+    current += dir;
+    if (current < 0) {
+      current = E.numrows - 1;
+    } else if (current >= E.numrows) {
+      current = 0;
+    }
+    erow *row = &E.row[current];
+    int at = dfaSearch(re, row->chars, row->size, 0, len);
+    if (at >= 0) {
+      *cx = at;
+      return current;
+    }
+  }
+  return -1;
+}
+
+/*
+ * Incremental search state for the query being typed at the Search: prompt.
+ * The buffer is cut into blocks of rows that are scanned independently, by
+ * worker threads and by the main thread whenever it needs a block's matches
+ * before a worker has got to it. The buffer cannot change while the prompt
+ * is up, so workers read rows without locking; everything else in the state
+ * is guarded by search_lock.
+ */
+/* Rows are cut into blocks of about this many bytes for scanning. */
+#define SEARCH_BLOCK_BYTES (256 * 1024)
+/* Upper bound on worker threads. */
+#define SEARCH_MAX_WORKERS 8
+/* How long to wait for a worker before checking for input again. */
+#define SEARCH_WAIT_MS 10
+/* Minimum time between redraws while scanning in the background. */
+#define SEARCH_REDRAW_MS 100
+/* Bytes scanned between checks for pending input. */
+#define SEARCH_SLICE_BYTES (1 << 20)
+/* Workers stop taking blocks once this many matches have been found. */
+#define SEARCH_MAX_MATCHES (1 << 22)
+
+enum searchBlockState { BLOCK_PENDING, BLOCK_CLAIMED, BLOCK_DONE };
+
+/* A run of rows [first, last) scanned as one unit. */
+struct searchBlock {
+  int first;
+  int last;
+  int state;
+  ematch *matches;     /* Matches in the block, sorted; valid once BLOCK_DONE. */
+  int nmatches;
+};
+
+struct searchState {
+  char *query;         /* Query that the blocks are scanned for; NULL when idle. */
+  int qlen;
+  int regex;           /* Match the query as a regular expression. */
+  const char *error;   /* Why the regex query does not compile, or NULL. */
+  struct searchBlock *blocks;
+  int nblocks;
+  int *order;          /* Blocks by distance from the origin: the scan order. */
+  int claim;           /* Position in @c order of the next block to hand out. */
+  int ndone;           /* Blocks in BLOCK_DONE. */
+  int nmatches;        /* Matches in all done blocks. */
+  _Atomic unsigned int gen;  /* Bumped whenever the query changes. */
+  int origin;          /* Row the search started from. */
+  int origin_cx;
+  ematch current;      /* Match the cursor was moved to. */
+  int have_current;
+  long last_redraw;    /* Time of the last idle redraw, in milliseconds. */
+  int redraw_done;     /* @c ndone at the last idle redraw. */
+  pthread_t workers[SEARCH_MAX_WORKERS];
+  int nworkers;
+  int quit;            /* Tells the workers to exit. */
+  char prompt[96];     /* Prompt format shown by editorFind(). */
+};
+
+static struct searchState S;
+static pthread_mutex_t search_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Signalled when blocks become claimable, and when a block is done. */
+static pthread_cond_t search_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t search_done = PTHREAD_COND_INITIALIZER;
 
-  static int saved_hl_line;
-  static char *saved_hl = NULL;
+/* Compare two match positions. */
+static int matchCmp(int row, int cx, const ematch *m) {
+  if (row != m->row) {
+    return row < m->row ? -1 : 1;
+  }
+  return cx < m->cx ? -1 : cx > m->cx;
+}
 
-  if (saved_hl) {
-    memcpy(E.row[saved_hl_line].hl, saved_hl, E.row[saved_hl_line].rsize);
-    free(saved_hl);
-    saved_hl = NULL;
+/* Index of the first of @p n sorted matches at or after (row, cx). */
+static int matchLowerBound(const ematch *matches, int n, int row, int cx) {
+  int lo = 0;
+  int hi = n;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (matchCmp(row, cx, &matches[mid]) > 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
   }
+  return lo;
+}
 
-  if (key == '\r' || key == '\x1b') {
-    last_match = -1;
-    direction = 1;
+/* Index of the block holding row @p row. */
+static int blockOf(int row) {
+  int lo = 0;
+  int hi = S.nblocks - 1;
+  while (lo < hi) {
+    int mid = lo + (hi - lo + 1) / 2;
+    if (S.blocks[mid].first <= row) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return lo;
+}
+
+/*
+ * Cut the buffer into blocks of about SEARCH_BLOCK_BYTES and order them
+ * outward from the origin, alternating forward and backward.
+ */
+static void searchLayout(void) {
+  S.nblocks = 0;
+  int cap = 0;
+  int bytes = 0;
+  for (int r = 0; r < E.numrows; r++) {
+    if (r == 0 || bytes >= SEARCH_BLOCK_BYTES) {
+      if (S.nblocks == cap) {
+        cap = cap ? cap * 2 : 16;
+        S.blocks = realloc(S.blocks, sizeof(struct searchBlock) * cap);
+      }
+      struct searchBlock *blk = &S.blocks[S.nblocks++];
+      memset(blk, 0, sizeof(*blk));
+      blk->first = r;
+      bytes = 0;
+    }
+    S.blocks[S.nblocks - 1].last = r + 1;
+    bytes += E.row[r].size + 1;
+  }
+  S.order = malloc(sizeof(int) * (S.nblocks ? S.nblocks : 1));
+  if (S.nblocks == 0) {
     return;
-  } else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
-    direction = 1;
-  } else if (key == ARROW_LEFT || key == ARROW_UP) {
-    direction = -1;
-  } else {
-    last_match = -1;
-    direction = 1;
   }
+  char *seen = calloc(S.nblocks, 1);
+  int ob = blockOf(S.origin);
+  int n = 0;
+  for (int d = 0; n < S.nblocks; d++) {
+    int fwd = (ob + d) % S.nblocks;
+    int back = ((ob - d) % S.nblocks + S.nblocks) % S.nblocks;
+    if (!seen[fwd]) {
+      seen[fwd] = 1;
+      S.order[n++] = fwd;
+    }
+    if (!seen[back]) {
+      seen[back] = 1;
+      S.order[n++] = back;
+    }
+  }
+  free(seen);
+}
 
-  if (last_match == -1) {
-    direction = 1;
+/* What a scan matches: a literal query, or a compiled regex when @c re is set. */
+struct scanQuery {
+  char *query;
+  int qlen;
+  struct dfa *re;
+};
+
+/* Matches collected by one scan. */
+struct scanResult {
+  ematch *matches;
+  int n;
+  int cap;
+  int row;
+};
+
+static void scanAppend(struct scanResult *res, int cx, int len) {
+  if (res->n == res->cap) {
+    res->cap = res->cap ? res->cap * 2 : 64;
+    res->matches = realloc(res->matches, sizeof(ematch) * res->cap);
   }
-  int current = last_match;
-  for (int i = 0; i < E.numrows; i++) {
-    current += direction;
-    if (current == -1) {
-      current = E.numrows - 1;
-    } else if (current == E.numrows) {
-      current = 0;
+  ematch *m = &res->matches[res->n++];
+  m->row = res->row;
+  m->cx = cx;
+  m->len = len;
+}
+
+static void scanRegexEmit(void *ctx, int at, int mlen) {
+  scanAppend(ctx, at, mlen);
+}
+
+/*
+ * Collect the matches in rows [first, last): overlapping ones for a literal
+ * query, leftmost-longest non-overlapping ones for a regex. Gives up if the
+ * query changes underneath (S.gen moves on from @p gen). Returns the number
+ * of bytes scanned, or -1 if abandoned.
+ */
+static int scanRows(const struct scanQuery *q, int first, int last, unsigned int gen,
+                    struct scanResult *res) {
+  int bytes = 0;
+  for (int r = first; r < last; r++) {
+    if (S.gen != gen) {
+      return -1;
     }
-    erow *row = &E.row[current];
-    char *match = strstr(row->render, query);
-    if (match) {
-      last_match = current;
-      E.cy = current;
-      E.cx = editorRowRxToCx(row, (int)(match - row->render));
-      E.rowoff = E.numrows;
-
-      saved_hl_line = current;
-      saved_hl = malloc(row->rsize);
-      memcpy(saved_hl, row->hl, row->rsize);
-      memset(&row->hl[match - row->render], HL_MATCH, strlen(query));
+    erow *row = &E.row[r];
+    res->row = r;
+    if (q->re) {
+      dfaSearchAll(q->re, row->chars, row->size, scanRegexEmit, res);
+    } else {
+      const char *p = row->chars;
+      const char *end = row->chars + row->size;
+      while ((p = byteSearch(p, (size_t)(end - p), q->query, (size_t)q->qlen)) != NULL) {
+        scanAppend(res, (int)(p - row->chars), q->qlen);
+        p++;
+      }
+    }
+    bytes += row->size + 1;
+  }
+  return bytes;
+}
+
+/*
+ * Next block in scan order for a worker to take, marked claimed; -1 if there
+ * is none or enough matches have been found. Called with search_lock held.
+ */
+static int searchClaim(void) {
+  if (S.query == NULL || S.nmatches >= SEARCH_MAX_MATCHES) {
+    return -1;
+  }
+  while (S.claim < S.nblocks) {
+    int b = S.order[S.claim++];
+    if (S.blocks[b].state == BLOCK_PENDING) {
+      S.blocks[b].state = BLOCK_CLAIMED;
+      return b;
+    }
+  }
+  return -1;
+}
+
+/*
+ * Store the result of scanning block @p b for query generation @p gen, or
+ * drop it if the query has changed since. Called with search_lock held.
+ */
+static void searchFinish(int b, unsigned int gen, int bytes, struct scanResult *res) {
+  if (bytes < 0 || gen != S.gen) {
+    free(res->matches);
+    return;
+  }
+  struct searchBlock *blk = &S.blocks[b];
+  blk->matches = res->matches;
+  blk->nmatches = res->n;
+  blk->state = BLOCK_DONE;
+  S.ndone++;
+  S.nmatches += res->n;
+  pthread_cond_broadcast(&search_done);
+}
+
+/*
+ * Scan claimed block @p b on the main thread. Called with search_lock held;
+ * releases it while scanning. Returns the number of bytes scanned.
+ */
+static int searchScanBlock(int b) {
+  unsigned int gen = S.gen;
+  struct scanQuery q = { S.query, S.qlen, NULL };
+  if (S.regex) {
+    const char *error;
+    q.re = dfaCached(S.query, &error);
+  }
+  int first = S.blocks[b].first;
+  int last = S.blocks[b].last;
+  pthread_mutex_unlock(&search_lock);
+  struct scanResult res = { NULL, 0, 0, 0 };
+  int bytes = scanRows(&q, first, last, gen, &res);
+  pthread_mutex_lock(&search_lock);
+  searchFinish(b, gen, bytes, &res);
+  return bytes;
+}
+
+/*
+ * Worker thread: claim blocks in scan order and scan them. Each worker keeps
+ * its own copy of the query and, for a regex, its own DFA, since DFA states
+ * are built as it runs.
+ */
+static void *searchWorker(void *arg) {
+  (void)arg;
+  struct scanQuery q = { NULL, 0, NULL };
+  int regex = 0;
+  pthread_mutex_lock(&search_lock);
+  while (!S.quit) {
+    int b = searchClaim();
+    if (b < 0) {
+      pthread_cond_wait(&search_work, &search_lock);
+      continue;
+    }
+    if (q.query == NULL || regex != S.regex || strcmp(q.query, S.query) != 0) {
+      free(q.query);
+      dfaFree(q.re);
+      q.query = strdup(S.query);
+      q.qlen = S.qlen;
+      q.re = NULL;
+      regex = S.regex;
+      if (regex) {
+        const char *error;
+        q.re = dfaCompile(q.query, &error);
+      }
+    }
+    unsigned int gen = S.gen;
+    int first = S.blocks[b].first;
+    int last = S.blocks[b].last;
+    pthread_mutex_unlock(&search_lock);
+    struct scanResult res = { NULL, 0, 0, 0 };
+    int bytes = scanRows(&q, first, last, gen, &res);
+    pthread_mutex_lock(&search_lock);
+    searchFinish(b, gen, bytes, &res);
+  }
+  pthread_mutex_unlock(&search_lock);
+  free(q.query);
+  dfaFree(q.re);
+  return NULL;
+}
+
+/* Start one worker per spare CPU, if the buffer is big enough to split. */
+static void searchStartWorkers(void) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int n = (S.nblocks > 1 && cpus > 1) ? (int)cpus - 1 : 0;
+  if (n > SEARCH_MAX_WORKERS) {
+    n = SEARCH_MAX_WORKERS;
+  }
+  S.quit = 0;
+  for (S.nworkers = 0; S.nworkers < n; S.nworkers++) {
+    if (pthread_create(&S.workers[S.nworkers], NULL, searchWorker, NULL) != 0) {
       break;
     }
   }
 }
 
+/*
+ * Find the nearest match strictly after (dir 1) or before (dir -1) position
+ * (row, cx), wrapping around the buffer. Returns 1 and stores it in @p out,
+ * 0 if the buffer has no match, or -1 with the first block on the way that
+ * is not scanned yet in @p wait. Called with search_lock held.
+ */
+static int searchNearest(int row, int cx, int dir, ematch *out, int *wait) {
+  int start = blockOf(row);
+  for (int i = 0; i <= S.nblocks; i++) {
+    int b = ((start + dir * i) % S.nblocks + S.nblocks) % S.nblocks;
+    struct searchBlock *blk = &S.blocks[b];
+    if (blk->state != BLOCK_DONE) {
+      *wait = b;
+      return -1;
+    }
+    if (blk->nmatches == 0) {
+      continue;
+    }
+    int j;
+    if (i == 0) {
+      /* The starting block: only matches past (row, cx) count. */
+      j = (dir > 0) ? matchLowerBound(blk->matches, blk->nmatches, row, cx + 1)
+                    : matchLowerBound(blk->matches, blk->nmatches, row, cx) - 1;
+      if (j < 0 || j >= blk->nmatches) {
+        continue;
+      }
+    } else {
+      j = (dir > 0) ? 0 : blk->nmatches - 1;
+    }
+    *out = blk->matches[j];
+    return 1;
+  }
+  return 0;
+}
+
+/*
+ * Find the nearest match from (row, cx) in direction @p dir. Blocks on the
+ * way that no worker has taken yet are scanned here; for blocks a worker is
+ * scanning, wait for it. Returns 1 on success, 0 if the buffer has no match,
+ * and -1 if a key arrived first.
+ */
+static int searchStep(int row, int cx, int dir, ematch *out) {
+  int bytes = 0;
+  int found;
+  int b;
+  pthread_mutex_lock(&search_lock);
+  while ((found = searchNearest(row, cx, dir, out, &b)) < 0) {
+    if (S.blocks[b].state == BLOCK_PENDING) {
+      S.blocks[b].state = BLOCK_CLAIMED;
+      bytes += searchScanBlock(b);
+    } else {
+      struct timespec until;
+      clock_gettime(CLOCK_REALTIME, &until);
+      until.tv_nsec += SEARCH_WAIT_MS * 1000000L;
+      if (until.tv_nsec >= 1000000000L) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000L;
+      }
+      pthread_cond_timedwait(&search_done, &search_lock, &until);
+      bytes = SEARCH_SLICE_BYTES;
+    }
+    if (bytes >= SEARCH_SLICE_BYTES) {
+      if (editorInputPending()) {
+        break;
+      }
+      bytes = 0;
+    }
+  }
+  pthread_mutex_unlock(&search_lock);
+  return found;
+}
+
+/*
+ * Make every block unscanned again for a new query and wake the workers.
+ * Bumping the generation makes scans still running for the old query give
+ * up. Blocks that are done are kept only if @p keep is set. Called with
+ * search_lock held.
+ */
+static void searchRestart(int keep) {
+  S.gen++;
+  S.claim = 0;
+  for (int b = 0; b < S.nblocks; b++) {
+    struct searchBlock *blk = &S.blocks[b];
+    if (blk->state == BLOCK_DONE && keep) {
+      continue;
+    }
+    if (blk->state == BLOCK_DONE) {
+      S.ndone--;
+      S.nmatches -= blk->nmatches;
+    }
+    free(blk->matches);
+    blk->matches = NULL;
+    blk->nmatches = 0;
+    blk->state = BLOCK_PENDING;
+  }
+  pthread_cond_broadcast(&search_work);
+}
+
+/* Replace the query, or clear it when @p query is NULL. */
+static void searchSetQuery(const char *query, int qlen) {
+  free(S.query);
+  S.query = NULL;
+  S.qlen = 0;
+  if (query) {
+    S.query = malloc(qlen + 1);
+    memcpy(S.query, query, qlen + 1);
+    S.qlen = qlen;
+  }
+}
+
+/* Forget all matches and start scanning for @p query (NULL for none) again. */
+static void searchReset(const char *query, int qlen) {
+  pthread_mutex_lock(&search_lock);
+  searchSetQuery(query, qlen);
+  S.error = NULL;
+  searchRestart(0);
+  if (query && S.regex && dfaCached(query, &S.error) == NULL) {
+    /* Nothing can match an invalid pattern: mark every block scanned. */
+    for (int b = 0; b < S.nblocks; b++) {
+      S.blocks[b].state = BLOCK_DONE;
+    }
+    S.ndone = S.nblocks;
+  }
+  pthread_mutex_unlock(&search_lock);
+}
+
+/*
+ * Narrow the matches to @p query if it extends the current literal query:
+ * every match of the longer query starts at a match of its prefix, so blocks
+ * already scanned need no rescan. Returns 0 if the query did not just grow.
+ */
+static int searchRefine(const char *query, int qlen) {
+  if (S.regex || S.query == NULL || qlen <= S.qlen || memcmp(query, S.query, S.qlen) != 0) {
+    return 0;
+  }
+  pthread_mutex_lock(&search_lock);
+  S.nmatches = 0;
+  for (int b = 0; b < S.nblocks; b++) {
+    struct searchBlock *blk = &S.blocks[b];
+    int n = 0;
+    for (int i = 0; i < blk->nmatches; i++) {
+      ematch *m = &blk->matches[i];
+      erow *row = &E.row[m->row];
+      if (row->size - m->cx >= qlen && memcmp(&row->chars[m->cx], query, qlen) == 0) {
+        m->len = qlen;
+        blk->matches[n++] = *m;
+      }
+    }
+    blk->nmatches = n;
+    S.nmatches += n;
+  }
+  searchSetQuery(query, qlen);
+  searchRestart(1);
+  pthread_mutex_unlock(&search_lock);
+  return 1;
+}
+
+/* Milliseconds on a monotonic clock. */
+static long searchNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/*
+ * Idle task: without workers, scan blocks on the main thread a slice at a
+ * time. Either way, redraw now and then so new matches and the count show
+ * up while the rest of the buffer is scanned.
+ */
+static int searchIdle(void *data) {
+  (void)data;
+  if (S.query == NULL) {
+    return 0;
+  }
+  int more = 0;
+  pthread_mutex_lock(&search_lock);
+  if (S.nworkers == 0) {
+    int bytes = 0;
+    int b;
+    while (bytes < SEARCH_SLICE_BYTES && (b = searchClaim()) >= 0) {
+      bytes += searchScanBlock(b);
+    }
+    more = (bytes >= SEARCH_SLICE_BYTES);
+  }
+  long now = searchNow();
+  int redraw = (S.ndone != S.redraw_done &&
+                (S.ndone == S.nblocks || now - S.last_redraw >= SEARCH_REDRAW_MS));
+  if (redraw) {
+    S.redraw_done = S.ndone;
+    S.last_redraw = now;
+  }
+  pthread_mutex_unlock(&search_lock);
+  return (more ? IDLE_MORE : 0) | (redraw ? IDLE_REDRAW : 0);
+}
+
+/* Stop the workers and drop the search state at the end of a search. */
+static void searchEnd(void) {
+  pthread_mutex_lock(&search_lock);
+  S.quit = 1;
+  S.gen++;
+  pthread_cond_broadcast(&search_work);
+  pthread_mutex_unlock(&search_lock);
+  for (int i = 0; i < S.nworkers; i++) {
+    pthread_join(S.workers[i], NULL);
+  }
+  S.nworkers = 0;
+  for (int b = 0; b < S.nblocks; b++) {
+    free(S.blocks[b].matches);
+  }
+  free(S.blocks);
+  free(S.order);
+  free(S.query);
+  S.blocks = NULL;
+  S.order = NULL;
+  S.query = NULL;
+  S.nblocks = 0;
+  S.ndone = 0;
+  S.nmatches = 0;
+  S.have_current = 0;
+  S.error = NULL;
+}
+
+/* Show the search mode, and why a regex does not compile, in the prompt. */
+static void searchPrompt(void) {
+  if (!S.regex) {
+    snprintf(S.prompt, sizeof(S.prompt), "Search: %%s");
+  } else if (S.error) {
+    snprintf(S.prompt, sizeof(S.prompt), "Regex search (%s): %%s", S.error);
+  } else {
+    snprintf(S.prompt, sizeof(S.prompt), "Regex search: %%s");
+  }
+}
+
+/**
+ * @brief Get the matches of the active search in one row.
+ * @ingroup search
+ *
+ * Used to overlay match highlighting when drawing, leaving the row's own
+ * highlighting untouched. Rows the search has not scanned yet report none.
+ *
+ * @param[in] row Row index.
+ * @param[out] matches Matches in the row, sorted by @c cx.
+ * @return Number of matches, or 0 when no search is active.
+ */
+int editorSearchRowMatches(int row, const ematch **matches) {
+  if (S.query == NULL || row >= E.numrows) {
+    return 0;
+  }
+  int n = 0;
+  pthread_mutex_lock(&search_lock);
+  struct searchBlock *blk = &S.blocks[blockOf(row)];
+  if (blk->state == BLOCK_DONE) {
+    int first = matchLowerBound(blk->matches, blk->nmatches, row, 0);
+    int last = matchLowerBound(blk->matches, blk->nmatches, row + 1, 0);
+    *matches = &blk->matches[first];
+    n = last - first;
+  }
+  pthread_mutex_unlock(&search_lock);
+  return n;
+}
+
+/**
+ * @brief Check whether a search session is running.
+ * @ingroup search
+ *
+ * Search threads read the rows for as long as a query is active, so idle
+ * tasks that add or remove rows hold off until this returns 0.
+ *
+ * @return 1 while a search with a non-empty query is active, else 0.
+ */
+int editorSearchActive(void) {
+  return S.query != NULL;
+}
+
+/**
+ * @brief Get the position of the current match among all matches.
+ * @ingroup search
+ *
+ * @param[out] index 1-based position of the match under the cursor in
+ *             buffer order, or 0 if there is none or the buffer has not been
+ *             fully scanned yet.
+ * @param[out] total Number of matches found so far.
+ * @param[out] complete 1 if the whole buffer has been scanned.
+ * @return 1 while a search with a non-empty query is active, else 0.
+ */
+int editorSearchIndex(int *index, int *total, int *complete) {
+  if (S.query == NULL) {
+    return 0;
+  }
+  pthread_mutex_lock(&search_lock);
+  *complete = (S.ndone == S.nblocks);
+  *total = S.nmatches;
+  *index = 0;
+  if (*complete && S.have_current) {
+    int cb = blockOf(S.current.row);
+    for (int b = 0; b < cb; b++) {
+      *index += S.blocks[b].nmatches;
+    }
+    struct searchBlock *blk = &S.blocks[cb];
+    *index += matchLowerBound(blk->matches, blk->nmatches, S.current.row, S.current.cx) + 1;
+  }
+  pthread_mutex_unlock(&search_lock);
+  return 1;
+}
+
+/**
+ * @brief Move the cursor between matches during interactive search.
+ * @ingroup search
+ *
+ * Called after every key at the Search: prompt. Arrow keys move to the next
+ * or previous match by binary search in the sorted match index. Ctrl+r
+ * switches between literal and regex matching. Other keys change the query:
+ * when a literal query grew, the known matches are narrowed in place;
+ * otherwise matching restarts. The cursor jumps to the first match at or
+ * after where the search started, scanning rows outward from there only as
+ * far as needed. Scanning gives up as soon as another key is pending and
+ * picks up again on the next call; the rest of the buffer is scanned by an
+ * idle task. Matches are highlighted at draw time through
+ * editorSearchRowMatches(), so rows are never modified.
+ *
+ * @param[in] query NUL-terminated search string (may be empty).
+ * @param[in] key Last key pressed to drive search behavior.
+ * @post Cursor and scroll offset may change.
+ * @sa editorFind(), editorSearchRows(), editorSearchIndex(), editorIdleAdd()
+ */
+void editorFindCallback(char *query, int key) {
+  if (key == '\r' || key == '\x1b') {
+    searchEnd();
+    return;
+  }
+  if (key == CTRL_KEY('r')) {
+    S.regex = !S.regex;
+    searchReset(NULL, 0);
+  }
+  int qlen = (int)strlen(query);
+  if (qlen == 0 || E.numrows == 0) {
+    searchReset(NULL, 0);
+    S.have_current = 0;
+    searchPrompt();
+    return;
+  }
+
+  int direction = 1;
+  int from_row = S.origin;
+  int from_cx = S.origin_cx - 1;
+  if (S.have_current && (key == ARROW_RIGHT || key == ARROW_DOWN)) {
+    from_row = S.current.row;
+    from_cx = S.current.cx;
+  } else if (S.have_current && (key == ARROW_LEFT || key == ARROW_UP)) {
+    direction = -1;
+    from_row = S.current.row;
+    from_cx = S.current.cx;
+  } else if (!searchRefine(query, qlen) && (S.query == NULL || strcmp(query, S.query) != 0)) {
+    searchReset(query, qlen);
+  }
+
+  searchPrompt();
+  ematch m;
+  int found = searchStep(from_row, from_cx, direction, &m);
+  if (found == -1) {
+    return;
+  }
+  S.have_current = found;
+  if (found) {
+    S.current = m;
+    E.cy = m.row;
+    E.cx = m.cx;
+    E.rowoff = E.numrows;
+  }
+}
+
 /**
  * @brief Prompt for a query and perform an interactive forward search.
  * @ingroup search
  *
- * Prompts the user with "Search: " and uses editorFindCallback() to move to
- * matches as the query changes. Restores the original cursor and viewport if
- * the prompt is cancelled.
+ * Prompts the user with "Search: " (or "Regex search: " after Ctrl+r) and
+ * uses editorFindCallback() to move to matches as the query changes. The
+ * buffer is split into blocks that a pool of worker threads scans while the
+ * prompt is up. Restores the original cursor and viewport if the prompt is
+ * cancelled.
  *
  * @post May modify cursor and viewport on success; restores them on cancel.
  * @sa editorPrompt(), editorFindCallback()
@@ -95,7 +806,16 @@ void editorFind(void) {
   int saved_cy = E.cy;
   int saved_coloff = E.coloff;
   int saved_rowoff = E.rowoff;
-  char *query = editorPrompt("Search: %s", editorFindCallback);
+  int saved_wrapoff = E.wrapoff;
+  S.origin = (E.cy < E.numrows) ? E.cy : 0;
+  S.origin_cx = (E.cy < E.numrows) ? E.cx : 0;
+  searchLayout();
+  searchStartWorkers();
+  searchPrompt();
+  editorIdleAdd(searchIdle, NULL);
+  char *query = editorPrompt(S.prompt, editorFindCallback);
+  editorIdleRemove(searchIdle, NULL);
+  searchEnd();
   if (query) {
     free(query);
   } else {
@@ -103,7 +823,6 @@ void editorFind(void) {
     E.cy = saved_cy;
     E.coloff = saved_coloff;
     E.rowoff = saved_rowoff;
+    E.wrapoff = saved_wrapoff;
   }
 }
-
-
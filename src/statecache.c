@@ -0,0 +1,347 @@
+/**
+ * @file statecache.c
+ * @brief State cache implementation.
+ * @ingroup statecache
+ *
+ * When a file is left, what ze worked out about it is written to
+ * "~/.ze/cache/", one record per file named after a hash of its path: the
+ * cursor and viewport, whether each row leaves a multi-line comment open,
+ * and, for a file shown in the pager, its line index. The record starts
+ * with the file's size, modification time, and a hash of its first and last
+ * 64 KiB. Reopening a file that still matches restores the cursor, loads the
+ * rows without highlighting them (see editorSyntaxAssume()), and hands the
+ * pager the index instead of counting lines again.
+ */
+#include "ze.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "buffer.h"
+#include "dirview.h"
+#include "pager.h"
+#include "syntax.h"
+#include "statecache.h"
+
+extern struct editorConfig E;
+
+/** Bytes hashed at each end of the file. */
+#define CACHE_SAMPLE (64 * 1024)
+
+static const char cache_magic[4] = {'Z', 'E', 'S', '1'};
+
+/** What a record holds besides the cursor. */
+enum cacheKind {
+  CACHE_CURSOR = 0,  /* Nothing else: the buffer did not match the file. */
+  CACHE_ROWS,        /* Multi-line comment state of every row. */
+  CACHE_PAGER        /* The pager's line index. */
+};
+
+/* Record read by stateCacheLoad() and not yet applied. */
+static struct {
+  int found;
+  int kind;
+  long long cy, cx, rowoff, coloff;  /* Cursor and viewport as file lines. */
+  long long numrows;
+  unsigned char *open;               /* Bit per row; NULL if all clear. */
+  struct pagerIndex index;
+  off_t *idx;
+} C;
+
+static uint64_t cacheHash(uint64_t h, const unsigned char *s, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    h ^= s[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+/* Hash of the start and end of the file open as @p fd, @p size bytes long. */
+static uint64_t cacheSample(int fd, off_t size) {
+  static unsigned char buf[CACHE_SAMPLE];
+  uint64_t h = 14695981039346656037ULL;
+  off_t tail = size > CACHE_SAMPLE ? size - CACHE_SAMPLE : 0;
+  off_t at[2] = {0, tail > CACHE_SAMPLE ? tail : CACHE_SAMPLE};
+  for (int i = 0; i < 2 && at[i] < size; i++) {
+    ssize_t n = pread(fd, buf, sizeof(buf), at[i]);
+    if (n > 0) {
+      h = cacheHash(h, buf, (size_t)n);
+    }
+  }
+  return h;
+}
+
+/* Record file for @p path, or NULL without a home directory. */
+static char *cachePathFor(const char *path, int create) {
+  const char *home = getenv("HOME");
+  if (home == NULL) {
+    return NULL;
+  }
+  size_t len = strlen(home) + 40;
+  char *out = malloc(len);
+  if (create) {
+    snprintf(out, len, "%s/.ze", home);
+    mkdir(out, 0700);
+    snprintf(out, len, "%s/.ze/cache", home);
+    mkdir(out, 0700);
+  }
+  uint64_t h = cacheHash(14695981039346656037ULL, (const unsigned char *)path, strlen(path));
+  snprintf(out, len, "%s/.ze/cache/%016llx", home, (unsigned long long)h);
+  return out;
+}
+
+static void putString(struct abuf *ab, const char *s) {
+  abPutVarint(ab, strlen(s));
+  abAppend(ab, s, (int)strlen(s));
+}
+
+/* Header naming the file, its version, and the highlighting rules used. */
+static void cacheHeader(struct abuf *ab, const char *path, const struct stat *st, uint64_t sample) {
+  abAppend(ab, cache_magic, sizeof(cache_magic));
+  putString(ab, path);
+  abPutVarint(ab, (unsigned long long)st->st_size);
+  abPutVarint(ab, (unsigned long long)st->st_mtim.tv_sec);
+  abPutVarint(ab, (unsigned long long)st->st_mtim.tv_nsec);
+  abPutVarint(ab, sample);
+  putString(ab, E.syntax ? E.syntax->filetype : "");
+}
+
+static int writeAll(int fd, const char *s, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, s, len);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    s += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+/**
+ * @brief Remember the cursor and what is known about the open file.
+ * @ingroup statecache
+ *
+ * Call before the buffer is replaced. Row states and the line index are
+ * only kept while the buffer holds exactly what is on disk; otherwise just
+ * the cursor is. Failures are silent: the cache only saves time.
+ */
+void stateCacheSave(void) {
+  if (E.filename == NULL || dirviewActive()) {
+    return;
+  }
+  char *path = realpath(E.filename, NULL);
+  if (path == NULL) {
+    return;
+  }
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd == -1 || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+    if (fd != -1) {
+      close(fd);
+    }
+    free(path);
+    return;
+  }
+
+  struct abuf ab = ABUF_INIT;
+  cacheHeader(&ab, path, &st, cacheSample(fd, st.st_size));
+  close(fd);
+  abPutVarint(&ab, (unsigned long long)pagerLineOf(E.cy));
+  abPutVarint(&ab, (unsigned long long)E.cx);
+  abPutVarint(&ab, (unsigned long long)pagerLineOf(E.rowoff));
+  abPutVarint(&ab, (unsigned long long)E.coloff);
+
+  struct pagerIndex index;
+  /* Rows freed ahead of a reload no longer describe the file. */
+  int intact = !E.dirty && st.st_size == E.filesize && (E.numrows > 0 || E.filesize == 0);
+  if (pagerIndexGet(&index)) {
+    abPutVarint(&ab, CACHE_PAGER);
+    abPutVarint(&ab, (unsigned long long)index.scanned);
+    abPutVarint(&ab, (unsigned long long)index.newlines);
+    abPutVarint(&ab, (unsigned long long)(index.complete | index.tail << 1));
+    abPutVarint(&ab, (unsigned long long)index.nidx);
+    /* Offsets only grow; their differences are short varints. */
+    for (long long k = 0; k < index.nidx; k++) {
+      abPutVarint(&ab, (unsigned long long)(index.idx[k] - (k > 0 ? index.idx[k - 1] : 0)));
+    }
+  } else if (intact) {
+    abPutVarint(&ab, CACHE_ROWS);
+    abPutVarint(&ab, (unsigned long long)E.numrows);
+    int comments = E.syntax && E.syntax->multiline_comment_start;
+    abPutVarint(&ab, (unsigned long long)comments);
+    if (comments) {
+      int nbytes = (E.numrows + 7) / 8;
+      unsigned char *bits = calloc(nbytes ? nbytes : 1, 1);
+      for (int i = 0; i < E.numrows; i++) {
+        bits[i >> 3] |= (unsigned char)((E.row[i].hl_open_comment != 0) << (i & 7));
+      }
+      abAppend(&ab, (const char *)bits, nbytes);
+      free(bits);
+    }
+  } else {
+    abPutVarint(&ab, CACHE_CURSOR);
+  }
+
+  char *file = cachePathFor(path, 1);
+  if (file != NULL) {
+    /* Replace the record whole so a reader never sees half of one. */
+    size_t len = strlen(file) + 8;
+    char *tmp = malloc(len);
+    snprintf(tmp, len, "%s.XXXXXX", file);
+    int out = mkstemp(tmp);
+    if (out != -1) {
+      int ok = writeAll(out, ab.b, (size_t)ab.len) == 0;
+      ok = close(out) == 0 && ok;
+      if (!ok || rename(tmp, file) == -1) {
+        unlink(tmp);
+      }
+    }
+    free(tmp);
+    free(file);
+  }
+  abFree(&ab);
+  free(path);
+}
+
+/* Forget a record read by stateCacheLoad(). */
+static void cacheDrop(void) {
+  editorSyntaxAssume(NULL, 0);
+  free(C.open);
+  free(C.idx);
+  memset(&C, 0, sizeof(C));
+}
+
+/**
+ * @brief Look up what was kept about the file being opened.
+ * @ingroup statecache
+ *
+ * Call after E.filename and E.syntax are set and before the rows are
+ * loaded. If the record matches the file, rows loaded from now on take
+ * their comment state from it instead of being highlighted.
+ *
+ * @param[in] fd The file, open for reading.
+ * @param[in] st Its stat() result.
+ * @return 1 if a record applies, else 0.
+ * @sa stateCacheApply()
+ */
+int stateCacheLoad(int fd, const struct stat *st) {
+  cacheDrop();
+  char *path = E.filename ? realpath(E.filename, NULL) : NULL;
+  char *file = path ? cachePathFor(path, 0) : NULL;
+  int in = file ? open(file, O_RDONLY) : -1;
+  struct stat cst;
+  unsigned char *data = NULL;
+  if (in != -1 && fstat(in, &cst) == 0 && cst.st_size > 0 &&
+      (data = malloc(cst.st_size)) != NULL &&
+      pread(in, data, cst.st_size, 0) == cst.st_size) {
+    struct abuf want = ABUF_INIT;
+    cacheHeader(&want, path, st, cacheSample(fd, st->st_size));
+    if (cst.st_size > want.len && memcmp(data, want.b, want.len) == 0) {
+      const unsigned char *p = data + want.len;
+      const unsigned char *end = data + cst.st_size;
+      unsigned long long cy = 0, cx = 0, rowoff = 0, coloff = 0, kind = 0, v = 0;
+      int ok = abGetVarint(&p, end, &cy) == 0 && abGetVarint(&p, end, &cx) == 0 &&
+               abGetVarint(&p, end, &rowoff) == 0 && abGetVarint(&p, end, &coloff) == 0 &&
+               abGetVarint(&p, end, &kind) == 0;
+      C.cy = (long long)cy;
+      C.cx = (long long)cx;
+      C.rowoff = (long long)rowoff;
+      C.coloff = (long long)coloff;
+      C.kind = (int)kind;
+      if (ok && C.kind == CACHE_ROWS) {
+        ok = abGetVarint(&p, end, &v) == 0 && v <= INT_MAX;
+        C.numrows = (long long)v;
+        long long nbytes = (C.numrows + 7) / 8;
+        ok = ok && abGetVarint(&p, end, &v) == 0;
+        if (ok && v && nbytes <= end - p) {
+          C.open = malloc(nbytes ? nbytes : 1);
+          memcpy(C.open, p, nbytes);
+          p += nbytes;
+        }
+      } else if (ok && C.kind == CACHE_PAGER) {
+        unsigned long long scanned = 0, newlines = 0, flags = 0, nidx = 0;
+        ok = abGetVarint(&p, end, &scanned) == 0 && abGetVarint(&p, end, &newlines) == 0 &&
+             abGetVarint(&p, end, &flags) == 0 && abGetVarint(&p, end, &nidx) == 0;
+        C.index.scanned = (off_t)scanned;
+        C.index.newlines = (long long)newlines;
+        C.index.complete = flags & 1;
+        C.index.tail = (flags >> 1) & 1;
+        C.index.nidx = (long long)nidx;
+        if (ok && C.index.nidx > 0 && C.index.nidx <= end - p) {
+          C.idx = malloc(sizeof(off_t) * C.index.nidx);
+          off_t off = 0;
+          for (long long k = 0; ok && k < C.index.nidx; k++) {
+            ok = abGetVarint(&p, end, &v) == 0;
+            off += (off_t)v;
+            C.idx[k] = off;
+          }
+          C.index.idx = C.idx;
+        }
+      }
+      C.found = ok;
+    }
+    abFree(&want);
+  }
+  if (in != -1) {
+    close(in);
+  }
+  free(data);
+  free(file);
+  free(path);
+  if (!C.found) {
+    cacheDrop();
+    return 0;
+  }
+  if (C.kind == CACHE_ROWS && C.numrows <= INT_MAX) {
+    editorSyntaxAssume(C.open, (int)C.numrows);
+  }
+  return 1;
+}
+
+/**
+ * @brief Finish opening a file with what stateCacheLoad() found.
+ * @ingroup statecache
+ *
+ * Call once the rows are loaded or the pager is showing the file. Restores
+ * the cursor and viewport and gives the pager its line index. If the file
+ * turned out to have a different number of rows than recorded, the rows are
+ * highlighted after all.
+ */
+void stateCacheApply(void) {
+  if (!C.found) {
+    return;
+  }
+  editorSyntaxAssume(NULL, 0);
+  if (pagerActive()) {
+    if (C.kind == CACHE_PAGER && C.idx != NULL) {
+      pagerIndexSet(&C.index);
+    }
+    pagerGoto(C.cy, (int)C.cx);
+    long long top = pagerLineOf(E.cy) - C.rowoff;
+    E.rowoff = top >= 0 && top <= E.cy && top < E.screenrows ? E.cy - (int)top : E.rowoff;
+  } else {
+    if (C.kind == CACHE_ROWS && C.numrows != E.numrows) {
+      for (int i = 0; i < E.numrows; i++) {
+        editorUpdateSyntax(&E.row[i]);
+      }
+    }
+    if (C.cy <= E.numrows) {
+      E.cy = (int)C.cy;
+      E.cx = E.cy < E.numrows && C.cx <= E.row[E.cy].size ? (int)C.cx : 0;
+      E.rowoff = C.rowoff <= C.cy ? (int)C.rowoff : E.cy;
+      E.coloff = (int)C.coloff;
+    }
+  }
+  cacheDrop();
+}
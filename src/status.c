@@ -10,6 +10,7 @@
 #include <libguile.h>
 
 #include "ze.h"
+#include "plugins.h"
 
 extern struct editorConfig E;
 
@@ -47,6 +48,7 @@ void editorSetStatusMessage(const char *fmt, ...) {
  * @sa editorSetStatusMessage()
  */
 void scmEditorSetStatusMessage(SCM message) {
+  pluginsMainThreadOnly("set-editor-status");
   char *fmt = scm_to_locale_string(message);
   strncpy(E.statusmsg, fmt, sizeof(E.statusmsg) - 1);
   E.statusmsg[sizeof(E.statusmsg) - 1] = '\0';
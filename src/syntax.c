@@ -8,6 +8,8 @@
 #include <stdlib.h>
 
 #include "ze.h"
+#include "row.h"
+#include "syntax.h"
 
 extern struct editorConfig E;
 
@@ -130,21 +132,29 @@ int is_separator(int c) {
 }
 
 /**
- * @brief Compute highlighting for a row based on current filetype.
+ * @brief Highlight one run of rendered text based on current filetype.
  * @ingroup syntax
  *
- * Updates @c row->hl based on the current filetype rules in @c E.syntax,
- * marking comments, strings, numbers, and keywords. Propagates multi-line
- * comment state to the following row when it changes.
+ * Fills @p hl based on the current filetype rules in @c E.syntax, marking
+ * comments, strings, numbers, and keywords. Open strings, comments, escapes,
+ * and token context are carried in and out through HL_STATE_* bits, so a long
+ * row can be highlighted one chunk at a time.
  *
- * @param[in,out] row Row whose render buffer has been prepared.
- * @sa editorUpdateRow(), editorSelectSyntaxHighlight()
+ * @param[in] render Rendered text; must be NUL-terminated at @p rsize.
+ * @param[out] hl Receives @p rsize highlight classes.
+ * @param[in] rsize Number of bytes in @p render.
+ * @param[in] state Highlighter state at the start of @p render.
+ * @return Highlighter state after the last byte.
+ * @sa editorUpdateSyntaxFrom()
  */
-void editorUpdateSyntax(erow *row) {
-  row->hl = realloc(row->hl, row->rsize);
-  memset(row->hl, HL_NORMAL, row->rsize);
+int editorSyntaxRun(const char *render, unsigned char *hl, int rsize, int state) {
+  memset(hl, HL_NORMAL, rsize);
   if (E.syntax == NULL) {
-    return;
+    return 0;
+  }
+  if (state & HL_STATE_LINE) {
+    memset(hl, HL_COMMENT, rsize);
+    return state;
   }
   char **keywords = E.syntax->keywords;
   char *scs = E.syntax->singleline_comment_start;
@@ -155,27 +165,33 @@ void editorUpdateSyntax(erow *row) {
   int mcs_len = mcs ? (int)strlen(mcs) : 0;
   int mce_len = mce ? (int)strlen(mce) : 0;
 
-  int prev_sep = 1;
-  int in_string = 0;
-  int in_comment = (row->idx > 0 && E.row[row->idx - 1].hl_open_comment);
+  int prev_sep = !(state & HL_STATE_NOSEP);
+  int in_string = state & HL_STATE_STRING;
+  int in_comment = (state & HL_STATE_COMMENT) != 0;
+  int escape = 0;
 
   int i = 0;
-  while (i < row->rsize) {
-    char c = row->render[i];
-    unsigned char prev_hl = (i > 0) ? row->hl[i - 1] : HL_NORMAL;
+  if ((state & HL_STATE_ESCAPE) && in_string && rsize > 0) {
+    hl[0] = HL_STRING;
+    i = 1;
+  }
+  while (i < rsize) {
+    char c = render[i];
+    unsigned char prev_hl = (i > 0) ? hl[i - 1]
+                          : (state & HL_STATE_NUMBER) ? HL_NUMBER : HL_NORMAL;
 
     if (scs_len && !in_string && !in_comment) {
-      if (!strncmp(&row->render[i], scs, scs_len)) {
-        memset(&row->hl[i], HL_COMMENT, row->rsize - i);
-        break;
+      if (!strncmp(&render[i], scs, scs_len)) {
+        memset(&hl[i], HL_COMMENT, rsize - i);
+        return HL_STATE_LINE;
       }
     }
 
     if (mcs_len && mce_len && !in_string) {
       if (in_comment) {
-        row->hl[i] = HL_MLCOMMENT;
-        if (!strncmp(&row->render[i], mce, mce_len)) {
-          memset(&row->hl[i], HL_MLCOMMENT, mce_len);
+        hl[i] = HL_MLCOMMENT;
+        if (!strncmp(&render[i], mce, mce_len)) {
+          memset(&hl[i], HL_MLCOMMENT, mce_len);
           i += mce_len;
           in_comment = 0;
           prev_sep = 1;
@@ -184,8 +200,8 @@ void editorUpdateSyntax(erow *row) {
           i++;
           continue;
         }
-      } else if (!strncmp(&row->render[i], mcs, mcs_len)) {
-        memset(&row->hl[i], HL_MLCOMMENT, mcs_len);
+      } else if (!strncmp(&render[i], mcs, mcs_len)) {
+        memset(&hl[i], HL_MLCOMMENT, mcs_len);
         i += mcs_len;
         in_comment = 1;
         continue;
@@ -194,11 +210,14 @@ void editorUpdateSyntax(erow *row) {
 
     if (E.syntax->flags & HL_HIGHLIGHT_STRINGS) {
       if (in_string) {
-        row->hl[i] = HL_STRING;
-        if (c == '\\' && i + 1 < row->rsize) {
-          row->hl[i + 1] = HL_STRING;
-          i += 2;
-          continue;
+        hl[i] = HL_STRING;
+        if (c == '\\') {
+          if (i + 1 < rsize) {
+            hl[i + 1] = HL_STRING;
+            i += 2;
+            continue;
+          }
+          escape = 1;
         }
         if (c == in_string) {
           in_string = 0;
@@ -208,8 +227,8 @@ void editorUpdateSyntax(erow *row) {
         continue;
       } else {
         if (c == '"' || c == '\'') {
-          in_string = c;
-          row->hl[i] = HL_STRING;
+          in_string = (unsigned char)c;
+          hl[i] = HL_STRING;
           i++;
           continue;
         }
@@ -219,7 +238,7 @@ void editorUpdateSyntax(erow *row) {
     if (E.syntax->flags & HL_HIGHLIGHT_NUMBERS) {
       if ((isdigit(c) && (prev_sep || prev_hl == HL_NUMBER)) ||
           (c == '.' && prev_hl == HL_NUMBER)) {
-        row->hl[i] = HL_NUMBER;
+        hl[i] = HL_NUMBER;
         i++;
         prev_sep = 0;
         continue;
@@ -234,9 +253,9 @@ void editorUpdateSyntax(erow *row) {
         if (kw2) {
           klen--;
         }
-        if (!strncmp(&row->render[i], keywords[j], klen) &&
-            is_separator(row->render[i + klen])) {
-          memset(&row->hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
+        if (!strncmp(&render[i], keywords[j], klen) &&
+            is_separator(render[i + klen])) {
+          memset(&hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
           i += klen;
           break;
         }
@@ -251,10 +270,143 @@ void editorUpdateSyntax(erow *row) {
     i++;
   }
 
+  int number = (rsize > 0) ? hl[rsize - 1] == HL_NUMBER : (state & HL_STATE_NUMBER);
+  return in_string | (in_comment ? HL_STATE_COMMENT : 0) |
+         (prev_sep ? 0 : HL_STATE_NOSEP) | (number ? HL_STATE_NUMBER : 0) |
+         (escape ? HL_STATE_ESCAPE : 0);
+}
+
+/* Multi-line comment states known in advance; see editorSyntaxAssume(). */
+static struct {
+  const unsigned char *open;
+  int n;
+} assumed;
+
+/**
+ * @brief Take rows' multi-line comment states as given instead of computing them.
+ * @ingroup syntax
+ *
+ * Until called again with @p n of 0, rows 0..@p n-1 that are highlighted
+ * from their first chunk and have only one chunk are not highlighted: the
+ * row leaving a multi-line comment open is read from bit @c idx of @p open
+ * (all clear if @p open is NULL), and the row is highlighted when it is first
+ * drawn. Used while loading a file whose states were saved before.
+ *
+ * @param[in] open Bit per row, least significant first; not copied.
+ * @param[in] n Rows covered by @p open.
+ */
+void editorSyntaxAssume(const unsigned char *open, int n) {
+  assumed.open = open;
+  assumed.n = n;
+}
+
+/*
+ * Re-highlight chunks of @p row as editorUpdateSyntaxFrom() does. The next
+ * row is updated when the comment state leaving @p row changed, unless
+ * @p cascade is 0 because the caller is about to update it anyway.
+ */
+static void syntaxFrom(erow *row, int first, int last, int cascade) {
+  int state;
+  if (first == 0) {
+    state = (row->idx > 0 && E.row[row->idx - 1].hl_open_comment) ? HL_STATE_COMMENT : 0;
+  } else {
+    state = row->chunks[first - 1].hl_out;
+  }
+  /* A known outcome needs no highlighting now; editorRowChunk() does it when drawn. */
+  if (first == 0 && row->nchunks == 1 && row->idx < assumed.n) {
+    row->head.hl_in = state;
+    free(row->head.hl);
+    row->head.hl = NULL;
+    row->hl_open_comment = assumed.open ? (assumed.open[row->idx >> 3] >> (row->idx & 7)) & 1 : 0;
+    return;
+  }
+  for (int k = first; k < row->nchunks; k++) {
+    echunk *ch = row->chunks ? &row->chunks[k] : &row->head;
+    if (k > last && ch->hl_in == state) {
+      return;
+    }
+    ch->hl_in = state;
+    free(ch->hl);
+    ch->hl = NULL;
+    state = editorRowChunk(row, k)->hl_out;
+  }
+
+  int in_comment = (state & HL_STATE_COMMENT) != 0;
   int changed = (row->hl_open_comment != in_comment);
   row->hl_open_comment = in_comment;
-  if (changed && row->idx + 1 < E.numrows) {
-    editorUpdateSyntax(&E.row[row->idx + 1]);
+  if (changed && cascade && row->idx + 1 < E.numrows) {
+    editorUpdateSyntaxFrom(&E.row[row->idx + 1], 0, 0);
+  }
+}
+
+/**
+ * @brief Re-highlight a row starting at a given chunk.
+ * @ingroup syntax
+ *
+ * Unconditionally re-highlights chunks @p first..@p last, then keeps going
+ * only while the state entering the next chunk differs from what it was last
+ * highlighted with. When the end of the row is reached and its multi-line
+ * comment state changed, the following row is updated as well.
+ *
+ * @param[in,out] row Row whose chunks have been measured.
+ * @param[in] first First chunk to re-highlight.
+ * @param[in] last Last chunk that must be re-highlighted.
+ * @sa editorUpdateSyntax(), editorUpdateRowRange()
+ */
+void editorUpdateSyntaxFrom(erow *row, int first, int last) {
+  syntaxFrom(row, first, last, 1);
+}
+
+/**
+ * @brief Compute highlighting for a row based on current filetype.
+ * @ingroup syntax
+ *
+ * Re-highlights every chunk of @p row and propagates multi-line comment state
+ * to the following row when it changes.
+ *
+ * @param[in,out] row Row whose chunks have been measured.
+ * @sa editorUpdateSyntaxFrom(), editorSelectSyntaxHighlight()
+ */
+void editorUpdateSyntax(erow *row) {
+  editorUpdateSyntaxFrom(row, 0, row->nchunks - 1);
+}
+
+/**
+ * @brief Re-highlight a set of edited rows in one pass.
+ * @ingroup syntax
+ *
+ * Goes through @p rows in order, each row starting from the state its
+ * predecessor just left, so a comment opened near the top is carried down
+ * once rather than once per edited row. Rows between the edited ones are
+ * highlighted only while the state entering them differs from what they
+ * were last highlighted with; the first that matches ends the run.
+ *
+ * @param[in] rows Edited rows, in increasing order without repeats.
+ * @param[in] n Number of entries in @p rows.
+ * @sa editorUpdateSyntax(), editorBatchEnd()
+ */
+void editorUpdateSyntaxRows(const struct syntaxSpan *rows, int n) {
+  int i = 0;
+  while (i < n && rows[i].row < E.numrows) {
+    for (int at = rows[i].row; at < E.numrows; at++) {
+      erow *row = &E.row[at];
+      int state = (at > 0 && E.row[at - 1].hl_open_comment) ? HL_STATE_COMMENT : 0;
+      int entered = (row->chunks ? &row->chunks[0] : &row->head)->hl_in;
+      int first = 0, last = -1;
+      if (i < n && rows[i].row == at) {
+        first = rows[i].first < row->nchunks ? rows[i].first : 0;
+        last = rows[i].last < row->nchunks ? rows[i].last : row->nchunks - 1;
+        i++;
+      }
+      if (last < 0 && entered == state) {
+        break;
+      }
+      /* Chunks before the edit were highlighted with a state now stale. */
+      if (entered != state) {
+        first = 0;
+      }
+      syntaxFrom(row, first, last, 0);
+    }
   }
 }
 
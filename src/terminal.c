@@ -11,6 +11,7 @@
 #include <unistd.h>
 
 #include "terminal.h"
+#include "idle.h"
 
 extern struct editorConfig E;
 
@@ -78,17 +79,29 @@ void enableRawMode(void) {
  * @ingroup terminal
  *
  * Blocks until one byte is read; if the byte begins an escape sequence,
- * attempts to parse known sequences into control codes.
+ * attempts to parse known sequences into control codes. Idle tasks run while
+ * waiting, back to back while they have work queued and no key is pending.
  *
  * @return ASCII char or one of the custom key codes (e.g., ARROW_*).
+ * @sa editorIdleRun()
  */
 char editorReadKey(void) {
   int nread;
   char c;
-  while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
+  int more = IDLE_MORE;
+  while (1) {
+    if (more && !editorInputPending()) {
+      more = editorIdleRun();
+      continue;
+    }
+    nread = read(STDIN_FILENO, &c, 1);
+    if (nread == 1) {
+      break;
+    }
     if (nread == -1 && errno != EAGAIN) {
       die("read");
     }
+    more = editorIdleRun();
   }
 
   if (c == '\x1b') {
@@ -0,0 +1,158 @@
+/**
+ * @file textscan.c
+ * @brief Text format detection implementation.
+ * @ingroup textscan
+ */
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "textscan.h"
+
+/**
+ * @brief Start a scan.
+ * @ingroup textscan
+ *
+ * @param[out] t Totals to reset.
+ */
+void textScanInit(struct textScan *t) {
+  memset(t, 0, sizeof(*t));
+  t->utf8 = 1;
+  t->last = -1;
+}
+
+/* Validate @p len bytes as UTF-8, continuing the sequence in @p t. */
+static void textScanUtf8(struct textScan *t, const unsigned char *s, size_t len) {
+  for (size_t i = 0; i < len && t->utf8; i++) {
+    unsigned char c = s[i];
+    if (t->need > 0) {
+      if (c < t->lo || c > t->hi) {
+        t->utf8 = 0;
+        return;
+      }
+      t->need--;
+      t->lo = 0x80;
+      t->hi = 0xBF;
+      continue;
+    }
+    if (c < 0x80) {
+      continue;
+    }
+    /* The second byte's range rules out overlong forms, surrogates, and
+     * code points past U+10FFFF. */
+    t->lo = 0x80;
+    t->hi = 0xBF;
+    if (c >= 0xC2 && c <= 0xDF) {
+      t->need = 1;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+      t->need = 2;
+      if (c == 0xE0) t->lo = 0xA0;
+      if (c == 0xED) t->hi = 0x9F;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+      t->need = 3;
+      if (c == 0xF0) t->lo = 0x90;
+      if (c == 0xF4) t->hi = 0x8F;
+    } else {
+      t->utf8 = 0;
+    }
+  }
+}
+
+/* Tally @p len bytes one at a time. */
+static void textScanBytes(struct textScan *t, const unsigned char *s, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    unsigned char c = s[i];
+    if (c == '\n') {
+      t->lf++;
+      t->crlf += t->cr;
+    }
+    t->nul += c == '\0';
+    t->cr = c == '\r';
+  }
+  textScanUtf8(t, s, len);
+}
+
+#if defined(__SSE2__)
+/* Sum the 16 byte counters in @p v. */
+static long long textScanSum(__m128i v) {
+  __m128i s = _mm_sad_epu8(v, _mm_setzero_si128());
+  return _mm_cvtsi128_si32(s) + _mm_cvtsi128_si32(_mm_srli_si128(s, 8));
+}
+#endif
+
+/**
+ * @brief Add a block of a file to the totals.
+ * @ingroup textscan
+ *
+ * Blocks must be passed in file order. A CRLF pair or UTF-8 sequence split
+ * between blocks is still counted or validated as one. On SSE2 targets 16
+ * bytes are classified per step: matches are counted in per-byte counters
+ * summed every 255 steps, CRLF pairs by comparing against the same bytes
+ * loaded one earlier, and UTF-8 is only decoded in steps that contain a
+ * non-ASCII byte or finish a sequence.
+ *
+ * @param[in,out] t Totals so far.
+ * @param[in] s Next bytes of the file.
+ * @param[in] len Length of @p s.
+ */
+void textScanBlock(struct textScan *t, const char *s, size_t len) {
+  const unsigned char *u = (const unsigned char *)s;
+  size_t i = 0;
+  if (len == 0) {
+    return;
+  }
+#if defined(__SSE2__)
+  if (len > 16) {
+    /* The first byte pairs with the carried '\r'; the rest look back. */
+    textScanBytes(t, u, 1);
+    i = 1;
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i zero = _mm_setzero_si128();
+    while (i + 16 <= len) {
+      __m128i lf = zero, crlf = zero, nul = zero;
+      for (int k = 0; k < 255 && i + 16 <= len; k++, i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(u + i));
+        __m128i p = _mm_loadu_si128((const __m128i *)(u + i - 1));
+        __m128i isnl = _mm_cmpeq_epi8(v, nl);
+        /* Compare results are -1 per match, so subtracting counts up. */
+        lf = _mm_sub_epi8(lf, isnl);
+        crlf = _mm_sub_epi8(crlf, _mm_and_si128(isnl, _mm_cmpeq_epi8(p, cr)));
+        nul = _mm_sub_epi8(nul, _mm_cmpeq_epi8(v, zero));
+        if (t->utf8 && (t->need || _mm_movemask_epi8(v))) {
+          textScanUtf8(t, u + i, 16);
+        }
+      }
+      t->lf += textScanSum(lf);
+      t->crlf += textScanSum(crlf);
+      t->nul += textScanSum(nul);
+    }
+    t->cr = u[i - 1] == '\r';
+  }
+#endif
+  textScanBytes(t, u + i, len - i);
+  t->last = u[len - 1];
+}
+
+/**
+ * @brief Line-ending style of everything scanned.
+ * @ingroup textscan
+ *
+ * @return An @c editorEol value.
+ */
+int textScanEol(const struct textScan *t) {
+  if (t->crlf == 0) {
+    return EOL_LF;
+  }
+  return t->crlf == t->lf ? EOL_CRLF : EOL_MIXED;
+}
+
+/**
+ * @brief Whether everything scanned is complete, valid UTF-8.
+ * @ingroup textscan
+ */
+int textScanValid(const struct textScan *t) {
+  return t->utf8 && t->need == 0;
+}
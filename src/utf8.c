@@ -0,0 +1,128 @@
+/**
+ * @file utf8.c
+ * @brief UTF-8 decoding and display width implementation.
+ * @ingroup utf8
+ */
+#include "utf8.h"
+
+/** Inclusive code point range used by the width tables. */
+struct utf8Range {
+  unsigned int first;
+  unsigned int last;
+};
+
+/* Combining marks and zero-width format characters. */
+static const struct utf8Range zero_width[] = {
+  {0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x05BF, 0x05BF},
+  {0x05C1, 0x05C2}, {0x05C4, 0x05C5}, {0x05C7, 0x05C7}, {0x0610, 0x061A},
+  {0x064B, 0x065F}, {0x0670, 0x0670}, {0x06D6, 0x06DC}, {0x06DF, 0x06E4},
+  {0x06E7, 0x06E8}, {0x06EA, 0x06ED}, {0x0900, 0x0902}, {0x093A, 0x093A},
+  {0x093C, 0x093C}, {0x0941, 0x0948}, {0x094D, 0x094D}, {0x0951, 0x0957},
+  {0x0E31, 0x0E31}, {0x0E34, 0x0E3A}, {0x0E47, 0x0E4E}, {0x1AB0, 0x1AFF},
+  {0x1DC0, 0x1DFF}, {0x200B, 0x200F}, {0x202A, 0x202E}, {0x2060, 0x2064},
+  {0x20D0, 0x20FF}, {0xFE00, 0xFE0F}, {0xFE20, 0xFE2F}, {0xFEFF, 0xFEFF},
+  {0xE0100, 0xE01EF}
+};
+
+/* East Asian wide and fullwidth characters, plus emoji presentation blocks. */
+static const struct utf8Range double_width[] = {
+  {0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC},
+  {0x23F0, 0x23F0}, {0x23F3, 0x23F3}, {0x25FD, 0x25FE}, {0x2614, 0x2615},
+  {0x2648, 0x2653}, {0x267F, 0x267F}, {0x2693, 0x2693}, {0x26A1, 0x26A1},
+  {0x26AA, 0x26AB}, {0x26BD, 0x26BE}, {0x26C4, 0x26C5}, {0x26CE, 0x26CE},
+  {0x26D4, 0x26D4}, {0x26EA, 0x26EA}, {0x26F2, 0x26F3}, {0x26F5, 0x26F5},
+  {0x26FA, 0x26FA}, {0x26FD, 0x26FD}, {0x2705, 0x2705}, {0x270A, 0x270B},
+  {0x2728, 0x2728}, {0x274C, 0x274C}, {0x274E, 0x274E}, {0x2753, 0x2755},
+  {0x2757, 0x2757}, {0x2795, 0x2797}, {0x27B0, 0x27B0}, {0x27BF, 0x27BF},
+  {0x2B1B, 0x2B1C}, {0x2B50, 0x2B50}, {0x2B55, 0x2B55}, {0x2E80, 0x303E},
+  {0x3041, 0x33FF}, {0x3400, 0x4DBF}, {0x4E00, 0x9FFF}, {0xA000, 0xA4CF},
+  {0xA960, 0xA97F}, {0xAC00, 0xD7A3}, {0xF900, 0xFAFF}, {0xFE10, 0xFE19},
+  {0xFE30, 0xFE6F}, {0xFF00, 0xFF60}, {0xFFE0, 0xFFE6}, {0x16FE0, 0x16FE4},
+  {0x17000, 0x18CFF}, {0x1B000, 0x1B2FF}, {0x1F004, 0x1F004}, {0x1F0CF, 0x1F0CF},
+  {0x1F18E, 0x1F18E}, {0x1F191, 0x1F19A}, {0x1F200, 0x1F202}, {0x1F210, 0x1F23B},
+  {0x1F240, 0x1F248}, {0x1F250, 0x1F251}, {0x1F260, 0x1F265}, {0x1F300, 0x1F64F},
+  {0x1F680, 0x1F6FF}, {0x1F7E0, 0x1F7EB}, {0x1F900, 0x1F9FF}, {0x1FA70, 0x1FAFF},
+  {0x20000, 0x2FFFD}, {0x30000, 0x3FFFD}
+};
+
+static int in_table(unsigned int cp, const struct utf8Range *table, int n) {
+  if (cp < table[0].first || cp > table[n - 1].last) return 0;
+  int lo = 0;
+  int hi = n - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    if (cp > table[mid].last) {
+      lo = mid + 1;
+    } else if (cp < table[mid].first) {
+      hi = mid - 1;
+    } else {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Decode one UTF-8 sequence.
+ * @ingroup utf8
+ *
+ * Rejects truncated sequences, overlong encodings, surrogates, and code
+ * points above U+10FFFF.
+ *
+ * @param[in] s Bytes to decode. Need not be NUL-terminated.
+ * @param[in] len Number of bytes available at @p s (must be > 0).
+ * @param[out] cp Decoded code point; set to the raw byte when invalid.
+ * @return Length of the sequence (1..4), or 0 if @p s does not start with a
+ *         valid sequence.
+ * @sa utf8Width()
+ */
+int utf8Decode(const char *s, int len, unsigned int *cp) {
+  const unsigned char *u = (const unsigned char *)s;
+  *cp = u[0];
+  if (u[0] < 0x80) return 1;
+  int n;
+  unsigned int min;
+  if ((u[0] & 0xE0) == 0xC0) {
+    n = 2; min = 0x80; *cp = u[0] & 0x1F;
+  } else if ((u[0] & 0xF0) == 0xE0) {
+    n = 3; min = 0x800; *cp = u[0] & 0x0F;
+  } else if ((u[0] & 0xF8) == 0xF0) {
+    n = 4; min = 0x10000; *cp = u[0] & 0x07;
+  } else {
+    return 0;
+  }
+  if (len < n) {
+    *cp = u[0];
+    return 0;
+  }
+  for (int i = 1; i < n; i++) {
+    if (!UTF8_IS_CONT(u[i])) {
+      *cp = u[0];
+      return 0;
+    }
+    *cp = (*cp << 6) | (u[i] & 0x3F);
+  }
+  if (*cp < min || *cp > 0x10FFFF || (*cp >= 0xD800 && *cp <= 0xDFFF)) {
+    *cp = u[0];
+    return 0;
+  }
+  return n;
+}
+
+/**
+ * @brief Number of terminal columns occupied by a code point.
+ * @ingroup utf8
+ *
+ * ASCII (including control characters, which ze draws as a single inverted
+ * symbol) is one column wide. Combining marks are zero columns and East Asian
+ * wide characters two.
+ *
+ * @param[in] cp Code point as returned by utf8Decode().
+ * @return 0, 1, or 2.
+ */
+int utf8Width(unsigned int cp) {
+  if (cp < 0x300) return 1;
+  if (in_table(cp, zero_width, (int)(sizeof(zero_width) / sizeof(zero_width[0])))) return 0;
+  if (in_table(cp, double_width, (int)(sizeof(double_width) / sizeof(double_width[0])))) return 2;
+  return 1;
+}
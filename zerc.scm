@@ -5,11 +5,11 @@
   (lambda ()
     (display "Loading ze config") (newline)))
 
-(define (preSaveHook contents)
-  (number->string (string-length contents)))
+(define (preSaveHook buf)
+  (number->string (buffer-length buf)))
 
-(define (postSaveHook contents)
-  (string-append (string-append "Wrote " (number->string (string-length contents)) " bytes to file")))
+(define (postSaveHook buf)
+  (string-append (string-append "Wrote " (number->string (buffer-length buf)) " bytes to file")))
 
 (define (preDirOpenHook dirname)
   (string-append "Opening directory " dirname))
@@ -20,5 +20,5 @@
 (define (preFileOpenHook filename)
   (string-append "Opening file " filename))
 
-(define (postFileOpenHook contents)
-  (string-append (string-append "Read " (number->string (string-length contents)) " bytes from file")))
\ No newline at end of file
+(define (postFileOpenHook buf)
+  (string-append (string-append "Read " (number->string (buffer-length buf)) " bytes from file")))
\ No newline at end of file